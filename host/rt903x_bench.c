@@ -0,0 +1,829 @@
+/*
+ * rt903x_bench.c
+ *
+ * Runs the real rt903 driver sequences on the host against i2c_bus_fake with a small chip
+ * model behind it, and checks what they cost on the bus: cold and warm init (trim cache),
+ * RAM upload and residency, f0 readout, the polling stream loop, the INT driven stream engine
+ * and the effect scheduler on top of it.
+ * Exit code 0 when every check holds.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "rt903x.h"
+#include "rt903x_reg.h"
+#include "rt903x_stream.h"
+#include "rt903x_sched.h"
+#include "rt903x_port.h"
+#include "ics_util.h"
+#include "i2c_bus_fake.h"
+
+#define BENCH_INT_GPIO          5
+#define BENCH_STREAM_LEN        3000
+#define BENCH_POLL_STEP         0x80    /* FIFO bytes the chip plays per INT_STATUS poll */
+#define BENCH_TICK_STEP         0x10    /* FIFO bytes the chip plays per ms in engine mode */
+#define BENCH_STALL_MAX_MS      500     /* a stalled producer gives up waiting for the engine */
+#define BENCH_EFUSE_TRANS       (4 * 4) /* per efuse byte: index write, READ write, status read, data read */
+
+static int bench_failed = 0;
+
+#define BENCH_CHECK(cond, fmt, ...)                                             \
+    do {                                                                        \
+        if (!(cond)) {                                                          \
+            printf("FAIL %s:%d " fmt "\n", __func__, __LINE__, ##__VA_ARGS__);  \
+            bench_failed++;                                                     \
+        }                                                                       \
+    } while (0)
+
+/* the rt903 as far as the driver sequences see it */
+typedef struct
+{
+    i2c_fake_dev_t *fake;
+    uint8_t efuse[4];
+    uint16_t fifo;              /*!< bytes queued in the stream FIFO */
+    uint8_t int_status;         /*!< pending, cleared by reading INT_STATUS */
+    bool ticking;               /*!< the tick thread plays the FIFO, otherwise every INT_STATUS poll does */
+    uint32_t prot_at;           /*!< trip protection once this many stream bytes were written, 0 never */
+    uint32_t stream_trans;
+    uint32_t stream_bytes;
+    uint32_t ram_bytes;
+    uint32_t efuse_reads;
+    uint32_t int_reads;
+} bench_chip_t;
+
+/* the fake is single threaded, the engine, producer and tick threads share it through this */
+typedef struct
+{
+    i2c_bus_t bus;
+    i2c_fake_bus_t fake;
+    pthread_mutex_t lock;
+} bench_bus_t;
+
+static bench_bus_t bench_bus;
+static bench_chip_t bench_chip;
+
+static uint16_t bench_reg16(const uint8_t *regs, uint8_t reg_l)
+{
+    return (uint16_t)(regs[reg_l] | (regs[reg_l + 1] << 8));
+}
+
+static void bench_chip_play(bench_chip_t *chip, uint16_t bytes)
+{
+    uint8_t *regs = chip->fake->regs;
+    if ((regs[REG_PLAY_CTRL] & BIT_GO_MASK) == 0 || (regs[REG_PLAY_MODE] & BIT_PLAY_MODE_MASK) != BIT_PLAY_MODE_STREAM)
+    {
+        return;
+    }
+    if (chip->prot_at > 0 && chip->stream_bytes >= chip->prot_at)
+    {
+        // 保护：芯片停下、FIFO 清空，之后不再报 AE/PLAYDONE
+        chip->prot_at = 0;
+        chip->fifo = 0;
+        chip->int_status |= BIT_INTS_PROTECTION;
+        regs[REG_PLAY_CTRL] = 0;
+        return;
+    }
+    uint16_t before = chip->fifo;
+    uint16_t ae = bench_reg16(regs, REG_FIFO_AE_L);
+    chip->fifo -= min(chip->fifo, bytes);
+    if (chip->fifo == 0)
+    {
+        chip->int_status |= BIT_INTS_PLAYDONE;
+        regs[REG_PLAY_CTRL] = 0;
+    }
+    else if (before > ae && chip->fifo <= ae)
+    {
+        // 只在跌破阈值的那一刻报，没填回阈值之上就不会再来
+        chip->int_status |= BIT_INTS_FIFO_AE;
+    }
+}
+
+/* open drain INT pin, low while an unmasked source is pending */
+static void bench_chip_line(bench_chip_t *chip)
+{
+    uint8_t *regs = chip->fake->regs;
+    bool low = (regs[REG_INT_CFG] & BIT_INT_CFG_PIN_EN) && (chip->int_status & ~regs[REG_INT_MASK] & BIT_INTM_ALL);
+    rt903x_port_host_irq_set(BENCH_INT_GPIO, low ? 0 : 1);
+}
+
+static void bench_chip_write(bench_chip_t *chip, uint8_t reg, uint8_t val)
+{
+    uint8_t *regs = chip->fake->regs;
+    switch (reg)
+    {
+        case REG_SOFT_RESET:
+            memset(regs, 0, I2C_FAKE_REG_NUM);
+            regs[REG_DEV_ID] = CHIP_ID;
+            chip->fifo = 0;
+            chip->int_status = 0;
+            break;
+        case REG_EFS_MODE_CTRL:
+            // 读 efuse 立即完成，READ 位读回来已经清掉
+            if (val & BIT_EFS_READ)
+            {
+                regs[REG_EFS_RD_DATA] = chip->efuse[regs[REG_EFS_ADDR_INDEX] & 3];
+                chip->efuse_reads++;
+            }
+            regs[reg] = 0;
+            break;
+        case REG_STREAM_DATA:
+            if (chip->fifo < bench_reg16(regs, REG_LIST_BASE_ADDR_L))
+            {
+                chip->fifo++;
+            }
+            chip->stream_bytes++;
+            break;
+        case REG_RAM_DATA:
+            chip->ram_bytes++;
+            break;
+        default:
+            regs[reg] = val;
+            break;
+    }
+}
+
+static uint8_t bench_chip_read(bench_chip_t *chip, uint8_t reg)
+{
+    if (reg != REG_INT_STATUS)
+    {
+        return chip->fake->regs[reg];
+    }
+    if (!chip->ticking)
+    {
+        bench_chip_play(chip, BENCH_POLL_STEP);
+    }
+    uint8_t status = chip->int_status;
+    chip->int_status = 0;
+    chip->int_reads++;
+    return status;
+}
+
+static int bench_chip_xfer(i2c_fake_dev_t *dev, const uint8_t *wr, uint16_t wr_len, uint8_t *rd, uint16_t rd_len)
+{
+    bench_chip_t *chip = (bench_chip_t *)dev->model;
+    if (wr_len > 0)
+    {
+        dev->ptr = wr[0];
+        chip->stream_trans += (wr[0] == REG_STREAM_DATA && wr_len > 1) ? 1 : 0;
+    }
+    for (uint16_t i = 1; i < wr_len; i++)
+    {
+        bench_chip_write(chip, dev->ptr, wr[i]);
+        if (dev->ptr != REG_STREAM_DATA && dev->ptr != REG_RAM_DATA)
+        {
+            dev->ptr++;
+        }
+    }
+    for (uint16_t i = 0; i < rd_len; i++)
+    {
+        rd[i] = bench_chip_read(chip, dev->ptr);
+        if (dev->ptr != REG_INT_STATUS)
+        {
+            dev->ptr++;
+        }
+    }
+    bench_chip_line(chip);
+    return 0;
+}
+
+static int bench_write_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, const uint8_t *data, uint16_t len)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->write_reg(&b->fake.bus, addr, reg, data, len);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_read_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->read_reg(&b->fake.bus, addr, reg, data, len);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_write_regs(i2c_bus_t *bus, uint16_t addr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->write_regs(&b->fake.bus, addr, regs, count, stats);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_write(i2c_bus_t *bus, uint16_t addr, const uint8_t *data, uint16_t len)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->write(&b->fake.bus, addr, data, len);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_read(i2c_bus_t *bus, uint16_t addr, uint8_t *data, uint16_t len)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->read(&b->fake.bus, addr, data, len);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_writev(i2c_bus_t *bus, uint16_t addr, const i2c_iovec_t *iov, uint8_t iovcnt)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->writev(&b->fake.bus, addr, iov, iovcnt);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static int bench_write_read(i2c_bus_t *bus, uint16_t addr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len)
+{
+    bench_bus_t *b = (bench_bus_t *)bus->ctx;
+    pthread_mutex_lock(&b->lock);
+    int res = b->fake.bus.ops->write_read(&b->fake.bus, addr, wr_buf, wr_len, rd_buf, rd_len);
+    pthread_mutex_unlock(&b->lock);
+    return res;
+}
+
+static const i2c_bus_ops_t bench_bus_ops = {
+    .write_reg  = bench_write_reg,
+    .read_reg   = bench_read_reg,
+    .write_regs = bench_write_regs,
+    .write      = bench_write,
+    .read       = bench_read,
+    .writev     = bench_writev,
+    .write_read = bench_write_read,
+};
+
+static void bench_reset_counters(void)
+{
+    pthread_mutex_lock(&bench_bus.lock);
+    i2c_fake_bus_reset_counters(&bench_bus.fake);
+    bench_chip.stream_trans = 0;
+    bench_chip.stream_bytes = 0;
+    bench_chip.ram_bytes = 0;
+    bench_chip.efuse_reads = 0;
+    bench_chip.int_reads = 0;
+    pthread_mutex_unlock(&bench_bus.lock);
+}
+
+/* FIFO writes a stream of len costs: one prime of the whole FIFO, then one per FIFO_AE */
+static uint32_t bench_stream_writes(rt903x_dev_t *dev, uint32_t len)
+{
+    uint32_t fifo = rt903x_ram_fifo_size(dev);
+    uint32_t refill = rt903x_ram_refill_size(dev);
+    return (len <= fifo) ? 1 : 1 + (len - fifo + refill - 1) / refill;
+}
+
+static void bench_init(rt903x_dev_t *dev)
+{
+    DEF_RT903_INFO info = {false, 0, RT903_I2C_1_ADDRESS, 400000};
+
+    /* cold: empty trim cache, the efuse protocol runs */
+    rt903x_dev_init(dev, info, &bench_bus.bus);
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_init(dev) == 0, "cold init");
+    uint32_t cold = bench_bus.fake.trans;
+    uint8_t trims[3];
+    memcpy(trims, &bench_chip.fake->regs[REG_PMU_CFG3], sizeof(trims));
+    BENCH_CHECK(bench_chip.efuse_reads == 4, "cold init read %u efuse bytes", (unsigned)bench_chip.efuse_reads);
+    BENCH_CHECK(!dev->config.trim_cached, "cold init used the cache");
+    /* chip id + soft reset + efuse + 5 trim bursts + 4 init bursts */
+    BENCH_CHECK(cold == 2 + BENCH_EFUSE_TRANS + 5 + 4, "cold init %u transactions", (unsigned)cold);
+
+    /* warm: trims come from the cache written above, no efuse access */
+    rt903x_dev_init(dev, info, &bench_bus.bus);
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_init(dev) == 0, "warm init");
+    uint32_t warm = bench_bus.fake.trans;
+    BENCH_CHECK(bench_chip.efuse_reads == 0, "warm init read %u efuse bytes", (unsigned)bench_chip.efuse_reads);
+    BENCH_CHECK(dev->config.trim_cached, "warm init missed the cache");
+    BENCH_CHECK(warm == cold - BENCH_EFUSE_TRANS, "warm init %u transactions, cold %u", (unsigned)warm, (unsigned)cold);
+    BENCH_CHECK(memcmp(trims, &bench_chip.fake->regs[REG_PMU_CFG3], sizeof(trims)) == 0, "warm trims differ");
+
+    /* the cached trims match this chip */
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_trim_verify(dev) == 0, "trim verify");
+    BENCH_CHECK(bench_chip.efuse_reads == 4, "trim verify read %u efuse bytes", (unsigned)bench_chip.efuse_reads);
+
+    /* another chip at the same port/address: it starts on the cached trims, trim_verify fixes them */
+    for (uint8_t i = 0; i < sizeof(bench_chip.efuse); i++)
+    {
+        bench_chip.efuse[i] ^= 0x55;
+    }
+    rt903x_dev_init(dev, info, &bench_bus.bus);
+    BENCH_CHECK(rt903x_init(dev) == 0 && dev->config.trim_cached, "swapped chip warm init");
+    BENCH_CHECK(memcmp(trims, &bench_chip.fake->regs[REG_PMU_CFG3], sizeof(trims)) == 0, "swapped chip skipped the cache");
+    BENCH_CHECK(rt903x_trim_verify(dev) == 1, "swapped chip not caught");
+    BENCH_CHECK(memcmp(trims, &bench_chip.fake->regs[REG_PMU_CFG3], sizeof(trims)) != 0, "swapped chip kept the cached trims");
+    printf("init: cold %u transactions, warm %u\n", (unsigned)cold, (unsigned)warm);
+}
+
+static void bench_ram(rt903x_dev_t *dev)
+{
+    static uint8_t wave[RT903X_WAVE_HDR_LEN + 96] = {0x02, 0x24, 0x00, 96};
+    for (uint8_t i = 0; i < 96; i++)
+    {
+        wave[RT903X_WAVE_HDR_LEN + i] = (uint8_t)(i * 8);
+    }
+
+    /* upload: address burst + data, playlist address burst + data; play setup writes mode and
+     * gain, BOOST_CFG3 already holds 8.5 V from the trim sequence */
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_ram_arm(dev, wave, sizeof(wave), 0x80, BOOST_VOUT_850) == 1, "first arm");
+    BENCH_CHECK(bench_bus.fake.trans == 4 + 2, "first arm %u transactions", (unsigned)bench_bus.fake.trans);
+    BENCH_CHECK(bench_chip.ram_bytes == sizeof(wave) + 4, "first arm %u RAM bytes", (unsigned)bench_chip.ram_bytes);
+
+    /* resident and selected: nothing goes out */
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_ram_arm(dev, wave, sizeof(wave), 0x80, BOOST_VOUT_850) == 0, "second arm");
+    BENCH_CHECK(bench_bus.fake.trans == 0, "second arm %u transactions", (unsigned)bench_bus.fake.trans);
+
+    /* an armed press is the GO write alone */
+    bool was_armed = false;
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_ram_trigger(dev, wave, sizeof(wave), 0x80, BOOST_VOUT_850, &was_armed) == 0, "trigger");
+    BENCH_CHECK(was_armed && bench_bus.fake.trans == 1, "trigger %u transactions", (unsigned)bench_bus.fake.trans);
+    rt903x_go(dev, 0);
+    BENCH_CHECK(rt903x_play_transient(dev, 0xffff, 0x80, 1) < 0, "transient index past the wave list");
+    printf("ram: %u RAM bytes uploaded once, armed press 1 transaction\n", (unsigned)sizeof(wave));
+}
+
+/* BEMF zero-cross stamps into f0: a bad readout must leave the calibration alone */
+static void bench_f0(rt903x_dev_t *dev)
+{
+    const uint16_t cz[5] = {100, 700, 1300, 1900, 2500};     /* 1200 ticks of 192 kHz, 160 Hz */
+    uint8_t *regs = bench_chip.fake->regs;
+
+    dev->config.f0 = 150;
+    memset(&regs[REG_BEMF_CZ1_VAL1], 0, 2 * ARRAY_SIZE(cz));
+    BENCH_CHECK(rt903x_calc_f0(dev) < 0, "f0 from empty stamps");
+    BENCH_CHECK(dev->config.f0 == 150, "failed readout changed f0 to %u", dev->config.f0);
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(cz); i++)
+    {
+        regs[REG_BEMF_CZ1_VAL1 + 2 * i] = (uint8_t)cz[i];
+        regs[REG_BEMF_CZ1_VAL1 + 2 * i + 1] = (uint8_t)(cz[i] >> 8);
+    }
+    BENCH_CHECK(rt903x_calc_f0(dev) == 0, "f0 readout");
+    BENCH_CHECK(dev->config.f0 == 160 && dev->config.f0_quality == 100, "f0 %u Hz quality %u",
+                dev->config.f0, dev->config.f0_quality);
+    printf("f0: %u Hz, failed readout keeps the last good value\n", dev->config.f0);
+}
+
+static uint8_t bench_stream_data[BENCH_STREAM_LEN];
+
+/* the stream loop that polls INT_STATUS, engine not running */
+static void bench_stream_poll(rt903x_dev_t *dev)
+{
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_stream_play_demo(dev, bench_stream_data, sizeof(bench_stream_data)) == 0, "poll stream");
+    uint32_t writes = bench_stream_writes(dev, sizeof(bench_stream_data));
+    uint32_t refills = writes - 1;
+    uint32_t polls_per_refill = rt903x_ram_refill_size(dev) / BENCH_POLL_STEP;
+    BENCH_CHECK(bench_chip.stream_bytes == sizeof(bench_stream_data), "poll stream %u bytes", (unsigned)bench_chip.stream_bytes);
+    BENCH_CHECK(bench_chip.stream_trans == writes, "poll stream %u FIFO writes, want %u",
+                (unsigned)bench_chip.stream_trans, (unsigned)writes);
+    /* one clear before GO, then the polls until each FIFO_AE */
+    BENCH_CHECK(bench_chip.int_reads == 1 + refills * polls_per_refill, "poll stream %u INT_STATUS reads",
+                (unsigned)bench_chip.int_reads);
+    printf("poll stream: %u bytes in %u FIFO writes, %u INT_STATUS polls, %u transactions\n",
+           (unsigned)bench_chip.stream_bytes, (unsigned)bench_chip.stream_trans, (unsigned)bench_chip.int_reads,
+           (unsigned)bench_bus.fake.trans);
+
+    /* the loop returns after the last refill, let the chip play the rest */
+    pthread_mutex_lock(&bench_bus.lock);
+    while (bench_chip.fake->regs[REG_PLAY_CTRL] & BIT_GO_MASK)
+    {
+        bench_chip_play(&bench_chip, BENCH_POLL_STEP);
+    }
+    bench_chip.int_status = 0;
+    pthread_mutex_unlock(&bench_bus.lock);
+    dev->playing = false;
+
+    /* protection in the middle: recovered, restarted where it stopped, no byte sent twice */
+    uint32_t events = dev->prot.events;
+    uint32_t retries = dev->prot.retries;
+    bench_reset_counters();
+    bench_chip.prot_at = sizeof(bench_stream_data) / 2;
+    BENCH_CHECK(rt903x_stream_play_demo(dev, bench_stream_data, sizeof(bench_stream_data)) == 0, "poll stream after protection");
+    BENCH_CHECK(dev->prot.events == events + 1 && dev->prot.retries == retries + 1, "protection events %u retries %u",
+                (unsigned)(dev->prot.events - events), (unsigned)(dev->prot.retries - retries));
+    BENCH_CHECK(bench_chip.stream_bytes == sizeof(bench_stream_data), "poll stream after protection %u bytes",
+                (unsigned)bench_chip.stream_bytes);
+    BENCH_CHECK(rt903x_stream_play_effect(dev, 0xff) < 0, "effect index past the table");
+    pthread_mutex_lock(&bench_bus.lock);
+    while (bench_chip.fake->regs[REG_PLAY_CTRL] & BIT_GO_MASK)
+    {
+        bench_chip_play(&bench_chip, BENCH_POLL_STEP);
+    }
+    bench_chip.int_status = 0;
+    pthread_mutex_unlock(&bench_bus.lock);
+    dev->prot.gain_cap = 0;
+    dev->playing = false;
+    printf("poll stream protection: recovered, %u bytes after one retry\n", (unsigned)bench_chip.stream_bytes);
+}
+
+static volatile bool bench_tick_run;
+
+/* the chip's playback clock while the engine streams */
+static void *bench_tick_thread(void *arg)
+{
+    while (bench_tick_run)
+    {
+        pthread_mutex_lock(&bench_bus.lock);
+        bench_chip_play(&bench_chip, BENCH_TICK_STEP);
+        bench_chip_line(&bench_chip);
+        pthread_mutex_unlock(&bench_bus.lock);
+        rt903x_sleep_ms(1);
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    uint32_t left;
+    uint8_t val;
+    rt903x_dev_t *dev;
+    uint32_t stall_left;        /*!< when left gets down to this, stall once until a FIFO_AE found the ring empty */
+    bool stall_out;             /*!< and on until the chip has played its FIFO out */
+} bench_fill_t;
+
+static bool bench_chip_stopped(void)
+{
+    pthread_mutex_lock(&bench_bus.lock);
+    bool stopped = (bench_chip.fake->regs[REG_PLAY_CTRL] & BIT_GO_MASK) == 0;
+    pthread_mutex_unlock(&bench_bus.lock);
+    return stopped;
+}
+
+static void bench_fill_stall(bench_fill_t *fill)
+{
+    rt903x_pipe_stats_t stats;
+    rt903x_stream_pipe_stats(fill->dev, &stats);
+    uint32_t underrun = stats.underrun;
+    for (uint32_t ms = 0; ms < BENCH_STALL_MAX_MS; ms++)
+    {
+        rt903x_stream_pipe_stats(fill->dev, &stats);
+        if (stats.underrun != underrun && (!fill->stall_out || bench_chip_stopped()))
+        {
+            return;
+        }
+        rt903x_sleep_ms(1);
+    }
+}
+
+static int32_t bench_fill(void *ctx, uint8_t *buf, int32_t size)
+{
+    bench_fill_t *fill = (bench_fill_t *)ctx;
+    if (fill->stall_left > 0 && fill->left <= fill->stall_left)
+    {
+        bench_fill_stall(fill);
+        fill->stall_left = 0;
+    }
+    int32_t n = min((int32_t)fill->left, size);
+    for (int32_t i = 0; i < n; i++)
+    {
+        buf[i] = fill->val++;
+    }
+    fill->left -= n;
+    return n;
+}
+
+static rt903x_sem_t bench_done;
+static volatile int32_t bench_done_status;
+
+static void bench_stream_done(rt903x_dev_t *dev, int32_t status, void *arg)
+{
+    bench_done_status = status;
+    rt903x_sem_give(&bench_done);
+}
+
+/* an arm must not rewrite RAM or stop the chip under a stream, the background one waits for its end */
+static void bench_stream_arm(rt903x_dev_t *dev)
+{
+    static uint8_t wave[RT903X_WAVE_HDR_LEN + 32] = {0x02, 0x24, 0x00, 32};
+    rt903x_sem_init(&bench_done, 1, 0);
+    BENCH_CHECK(rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850) == 0, "stream setup");
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_stream_start(dev, bench_stream_data, sizeof(bench_stream_data), bench_stream_done, NULL) == 0,
+                "stream start");
+    BENCH_CHECK(rt903x_ram_arm(dev, wave, sizeof(wave), 0x80, BOOST_VOUT_850) < 0, "armed under a stream");
+    BENCH_CHECK(rt903x_ram_arm_async(dev, wave, sizeof(wave), 0x80, BOOST_VOUT_850) == 0, "arm async");
+    rt903x_sleep_ms(RT903X_ARM_RETRY_MS);
+    BENCH_CHECK(rt903x_stream_busy(dev) && bench_chip.ram_bytes == 0, "background arm wrote %u RAM bytes under a stream",
+                (unsigned)bench_chip.ram_bytes);
+    BENCH_CHECK(rt903x_sem_take(&bench_done, RT903X_STREAM_WAIT_MS) && bench_done_status == 0, "stream status %d",
+                (int)bench_done_status);
+    BENCH_CHECK(bench_chip.stream_bytes == sizeof(bench_stream_data), "stream %u bytes", (unsigned)bench_chip.stream_bytes);
+    for (uint32_t ms = 0; ms < RT903X_ARM_WAIT_MS && !rt903x_ram_armed(dev, wave, 0x80, BOOST_VOUT_850); ms++)
+    {
+        rt903x_sleep_ms(1);
+    }
+    BENCH_CHECK(rt903x_ram_armed(dev, wave, 0x80, BOOST_VOUT_850), "background arm not done after the stream");
+    rt903x_sem_deinit(&bench_done);
+    printf("arm under stream: refused, background arm after PLAYDONE\n");
+}
+
+/* long buzz without a chip loop streams from the generator in the background, a stop cuts it */
+static void bench_stream_long(rt903x_dev_t *dev)
+{
+    const uint16_t duration = 2000;
+    uint16_t f0 = dev->config.f0;
+    rt903x_sem_init(&bench_done, 1, 0);
+    dev->config.f0 = 0;         /* no loop block in RAM */
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_play_long_start(dev, 0, 0x80, duration, bench_stream_done, NULL) == 1, "long start");
+    BENCH_CHECK(rt903x_stream_busy(dev), "long buzz not streaming");
+    rt903x_sleep_ms(50);
+    BENCH_CHECK(rt903x_stream_stop(dev) == 0, "long stop");
+    /* the producer sees the cancel on its next block and drops the generator then */
+    for (uint32_t ms = 0; ms < RT903X_STREAM_WAIT_MS && rt903x_stream_busy(dev); ms++)
+    {
+        rt903x_sleep_ms(1);
+    }
+    BENCH_CHECK(!rt903x_stream_busy(dev), "long buzz producer still running after the stop");
+    BENCH_CHECK(!rt903x_sem_take(&bench_done, 100), "stopped long buzz reported %d", (int)bench_done_status);
+    BENCH_CHECK(bench_chip.stream_bytes < duration * 6, "stopped long buzz streamed all %u bytes",
+                (unsigned)bench_chip.stream_bytes);
+    dev->config.f0 = f0;
+    rt903x_sem_deinit(&bench_done);
+    printf("long buzz: streamed, cut after %u bytes\n", (unsigned)bench_chip.stream_bytes);
+}
+
+/*
+ * The scheduler's RAM clicks. The demo effect tables are keyed by board pins, so the bench stands
+ * in for them: every trigger is logged in play order, BENCH_CLICK_LONG plays long enough for
+ * requests to queue up behind it, every other click ends at once.
+ */
+#define BENCH_CLICK_LONG        0x7f
+#define BENCH_CLICK_LONG_MS     300
+#define BENCH_SCHED_LOG_MAX     32
+#define BENCH_SCHED_WAIT_MS     1000
+
+static uint8_t bench_sched_log[BENCH_SCHED_LOG_MAX];
+static uint8_t bench_sched_cnt;
+static uint8_t bench_click_armed = 0xff;
+
+int32_t rt903x_Ram_effect_ms(uint8_t number, uint8_t int_number)
+{
+    return (number == BENCH_CLICK_LONG) ? BENCH_CLICK_LONG_MS : 0;
+}
+
+int16_t rt903x_Ram_trigger(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number, bool *was_armed)
+{
+    uint8_t cnt = __atomic_load_n(&bench_sched_cnt, __ATOMIC_RELAXED);
+    if (was_armed != NULL)
+    {
+        *was_armed = (number == bench_click_armed);
+    }
+    if (cnt < BENCH_SCHED_LOG_MAX)
+    {
+        bench_sched_log[cnt] = number;
+    }
+    __atomic_store_n(&bench_sched_cnt, cnt + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int16_t rt903x_Ram_arm(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number)
+{
+    bench_click_armed = number;
+    return 0;
+}
+
+static int32_t bench_click(rt903x_dev_t *dev, RT903X_SCHED_PRIO prio, uint8_t effect)
+{
+    rt903x_sched_req_t req = {RT903X_SCHED_CLICK, prio, effect, 0, 0x80, 0};
+    return rt903x_sched_submit(dev, &req);
+}
+
+static uint8_t bench_sched_count(void)
+{
+    return __atomic_load_n(&bench_sched_cnt, __ATOMIC_ACQUIRE);
+}
+
+/* until the worker has triggered cnt clicks in all */
+static bool bench_sched_played(uint8_t cnt)
+{
+    for (uint32_t ms = 0; ms < BENCH_SCHED_WAIT_MS; ms++)
+    {
+        if (bench_sched_count() >= cnt)
+        {
+            return true;
+        }
+        rt903x_sleep_ms(1);
+    }
+    return false;
+}
+
+/* priorities, coalescing, the victim of a full queue, cancel and hold, all against one worker */
+static void bench_sched(rt903x_dev_t *dev)
+{
+    static const uint8_t order[] = {
+        BENCH_CLICK_LONG, 1,                    /* equal priority cuts the long click */
+        BENCH_CLICK_LONG, 2, 3,                 /* lower ones wait for it, two 3s merged into one */
+        3,                                      /* armed by the 3 before it */
+        BENCH_CLICK_LONG, 18, 12, 13, 14, 15, 16, 17, 19,   /* full queue: 10 and 11 given up */
+        BENCH_CLICK_LONG,                       /* cancelled with 20..27 still queued */
+        BENCH_CLICK_LONG, 30,                   /* hold cut it and refused 29 */
+        31,                                     /* cut the stream effect */
+    };
+    rt903x_sched_stats_t stats;
+    uint8_t played = 0;
+    BENCH_CHECK(rt903x_sched_add(dev, 0) == 0, "sched add");
+
+    /* preempt: the same or a higher priority cuts what plays, a lower one waits for its end */
+    bench_click(dev, RT903X_SCHED_PRIO_NORMAL, BENCH_CLICK_LONG);
+    BENCH_CHECK(bench_sched_played(++played), "long click not started");
+    bench_click(dev, RT903X_SCHED_PRIO_NORMAL, 1);
+    BENCH_CHECK(bench_sched_played(++played), "equal priority did not cut the long click");
+    bench_click(dev, RT903X_SCHED_PRIO_CLICK, BENCH_CLICK_LONG);
+    BENCH_CHECK(bench_sched_played(++played), "long click not started");
+    bench_click(dev, RT903X_SCHED_PRIO_LOW, 2);
+    bench_click(dev, RT903X_SCHED_PRIO_LOW, 3);
+    bench_click(dev, RT903X_SCHED_PRIO_LOW, 3);
+    rt903x_sleep_ms(BENCH_CLICK_LONG_MS / 4);
+    BENCH_CHECK(bench_sched_count() == played, "lower priority cut the long click");
+    played += 2;
+    BENCH_CHECK(bench_sched_played(played), "queued clicks not played");
+    bench_click(dev, RT903X_SCHED_PRIO_NORMAL, 3);
+    BENCH_CHECK(bench_sched_played(++played), "click not played");
+    rt903x_sched_stats(dev, &stats);
+    BENCH_CHECK(stats.preempted == 1 && stats.coalesced == 1, "preempted %u coalesced %u",
+                (unsigned)stats.preempted, (unsigned)stats.coalesced);
+    BENCH_CHECK(stats.click_armed == 1 && stats.click_cold == played - 1, "clicks armed %u cold %u",
+                (unsigned)stats.click_armed, (unsigned)stats.click_cold);
+
+    /* full queue: the oldest of the lowest priority is given up, unless it outranks the new one */
+    bench_click(dev, RT903X_SCHED_PRIO_CLICK, BENCH_CLICK_LONG);
+    BENCH_CHECK(bench_sched_played(++played), "long click not started");
+    for (uint8_t i = 0; i < RT903X_SCHED_QUEUE_LEN; i++)
+    {
+        BENCH_CHECK(bench_click(dev, RT903X_SCHED_PRIO_LOW, 10 + i) == 0, "queue click %u", 10 + i);
+    }
+    BENCH_CHECK(bench_click(dev, RT903X_SCHED_PRIO_NORMAL, 18) == 0, "higher priority into a full queue");
+    BENCH_CHECK(bench_click(dev, RT903X_SCHED_PRIO_LOW, 19) == 0, "same priority into a full queue");
+    played += RT903X_SCHED_QUEUE_LEN;
+    BENCH_CHECK(bench_sched_played(played), "queue not played out");
+    rt903x_sched_stats(dev, &stats);
+    BENCH_CHECK(stats.dropped == 2 && stats.queued_max == RT903X_SCHED_QUEUE_LEN, "dropped %u queued_max %u",
+                (unsigned)stats.dropped, stats.queued_max);
+
+    bench_click(dev, RT903X_SCHED_PRIO_CLICK, BENCH_CLICK_LONG);
+    BENCH_CHECK(bench_sched_played(++played), "long click not started");
+    for (uint8_t i = 0; i < RT903X_SCHED_QUEUE_LEN; i++)
+    {
+        bench_click(dev, RT903X_SCHED_PRIO_NORMAL, 20 + i);
+    }
+    BENCH_CHECK(bench_click(dev, RT903X_SCHED_PRIO_LOW, 28) < 0, "lower priority into a full queue of higher ones");
+    BENCH_CHECK(rt903x_sched_cancel(dev) == 0, "cancel");
+    rt903x_sleep_ms(BENCH_CLICK_LONG_MS / 4);
+    BENCH_CHECK(bench_sched_count() == played, "cancelled clicks played");
+
+    /* hold: returns once the worker let go of the chip, submits refused until released */
+    bench_click(dev, RT903X_SCHED_PRIO_CLICK, BENCH_CLICK_LONG);
+    BENCH_CHECK(bench_sched_played(++played), "long click not started");
+    uint32_t begin = rt903x_time_ms();
+    BENCH_CHECK(rt903x_sched_hold(dev, true) == 0, "hold");
+    BENCH_CHECK(rt903x_time_ms() - begin < BENCH_CLICK_LONG_MS / 2, "hold waited for the long click to end");
+    BENCH_CHECK(bench_click(dev, RT903X_SCHED_PRIO_CLICK, 29) < 0, "submit while held");
+    rt903x_sched_hold(dev, false);
+    bench_click(dev, RT903X_SCHED_PRIO_NORMAL, 30);
+    BENCH_CHECK(bench_sched_played(++played), "click after the hold not played");
+
+    /* a click cuts a stream effect through the engine */
+    rt903x_sched_req_t req = {RT903X_SCHED_STREAM, RT903X_SCHED_PRIO_NORMAL, 0, 0, 0x80, 0};
+    BENCH_CHECK(rt903x_sched_submit(dev, &req) == 0, "stream effect");
+    for (uint32_t ms = 0; ms < BENCH_SCHED_WAIT_MS && !rt903x_stream_busy(dev); ms++)
+    {
+        rt903x_sleep_ms(1);
+    }
+    BENCH_CHECK(rt903x_stream_busy(dev), "stream effect not started");
+    bench_click(dev, RT903X_SCHED_PRIO_CLICK, 31);
+    BENCH_CHECK(bench_sched_played(++played), "click did not cut the stream effect");
+    for (uint32_t ms = 0; ms < BENCH_SCHED_WAIT_MS && rt903x_stream_busy(dev); ms++)
+    {
+        rt903x_sleep_ms(1);
+    }
+    BENCH_CHECK(!rt903x_stream_busy(dev), "cut stream effect still busy");
+
+    BENCH_CHECK(played == ARRAY_SIZE(order) && memcmp(bench_sched_log, order, sizeof(order)) == 0, "play order");
+    for (uint8_t i = 0; i < played && i < BENCH_SCHED_LOG_MAX; i++)
+    {
+        if (bench_sched_log[i] != order[i])
+        {
+            printf("  click %u: played %u, want %u\n", i, bench_sched_log[i], order[i]);
+        }
+    }
+    rt903x_sleep_ms(10);
+    rt903x_sched_stats(dev, &stats);
+    BENCH_CHECK(stats.preempted == 2 && stats.dropped == 4 && stats.failed == 0, "preempted %u dropped %u failed %u",
+                (unsigned)stats.preempted, (unsigned)stats.dropped, (unsigned)stats.failed);
+    BENCH_CHECK(stats.played == played + 1u, "played %u, want %u", (unsigned)stats.played, played + 1u);
+    printf("sched: %u played in order, preempted %u, coalesced %u, dropped %u, clicks armed %u cold %u\n",
+           (unsigned)stats.played, (unsigned)stats.preempted, (unsigned)stats.coalesced, (unsigned)stats.dropped,
+           (unsigned)stats.click_armed, (unsigned)stats.click_cold);
+}
+
+/* INT line, FIFO_AE refills by the engine task, buffer and producer pipe */
+static void bench_stream_engine(rt903x_dev_t *dev)
+{
+    pthread_t tick;
+    BENCH_CHECK(rt903x_stream_engine_init(BENCH_INT_GPIO, 1) == 0, "engine init");
+    BENCH_CHECK(rt903x_stream_engine_add(dev) == 0, "engine add");
+    bench_chip.ticking = true;
+    bench_tick_run = true;
+    pthread_create(&tick, NULL, bench_tick_thread, NULL);
+
+    uint32_t writes = bench_stream_writes(dev, sizeof(bench_stream_data));
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_stream_play_demo(dev, bench_stream_data, sizeof(bench_stream_data)) == 0, "engine stream");
+    BENCH_CHECK(bench_chip.stream_bytes == sizeof(bench_stream_data), "engine stream %u bytes", (unsigned)bench_chip.stream_bytes);
+    BENCH_CHECK(bench_chip.stream_trans == writes, "engine stream %u FIFO writes, want %u",
+                (unsigned)bench_chip.stream_trans, (unsigned)writes);
+    printf("engine stream: %u bytes in %u FIFO writes, %u INT_STATUS reads, %u transactions\n",
+           (unsigned)bench_chip.stream_bytes, (unsigned)bench_chip.stream_trans, (unsigned)bench_chip.int_reads,
+           (unsigned)bench_bus.fake.trans);
+
+    bench_fill_t fill = {.left = BENCH_STREAM_LEN};
+    rt903x_pipe_stats_t stats;
+    BENCH_CHECK(rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850) == 0, "pipe setup");
+    bench_reset_counters();
+    BENCH_CHECK(rt903x_stream_run_pipe(dev, bench_fill, &fill, 0) == 0, "pipe stream");
+    rt903x_stream_pipe_stats(dev, &stats);
+    BENCH_CHECK(fill.left == 0 && stats.consumed == BENCH_STREAM_LEN, "pipe stream consumed %u", (unsigned)stats.consumed);
+    BENCH_CHECK(bench_chip.stream_bytes == BENCH_STREAM_LEN, "pipe stream %u bytes", (unsigned)bench_chip.stream_bytes);
+    BENCH_CHECK(!rt903x_stream_busy(dev), "pipe stream still busy");
+    printf("pipe stream: %u bytes in %u FIFO writes, underruns %u\n", (unsigned)bench_chip.stream_bytes,
+           (unsigned)bench_chip.stream_trans, (unsigned)stats.underrun);
+
+    /* producer stalls after the 4 blocks of the prime: the first FIFO_AE finds the ring empty and
+     * the FIFO stays below the threshold, so the blocks that come after must go out without one */
+    uint32_t underrun = stats.underrun;
+    fill = (bench_fill_t){.left = BENCH_STREAM_LEN, .dev = dev, .stall_left = BENCH_STREAM_LEN - 4 * RT903X_PIPE_BLOCK_SIZE};
+    BENCH_CHECK(rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850) == 0, "pipe setup");
+    bench_reset_counters();
+    int32_t res = rt903x_stream_run_pipe(dev, bench_fill, &fill, 0);
+    rt903x_stream_pipe_stats(dev, &stats);
+    BENCH_CHECK(res == 0, "stalled stream status %d", (int)res);
+    BENCH_CHECK(bench_chip.stream_bytes == BENCH_STREAM_LEN, "stalled stream %u bytes", (unsigned)bench_chip.stream_bytes);
+    BENCH_CHECK(stats.underrun > underrun, "stalled stream never ran short");
+    printf("stalled pipe stream: %u bytes in %u FIFO writes, underruns %u\n", (unsigned)bench_chip.stream_bytes,
+           (unsigned)bench_chip.stream_trans, (unsigned)(stats.underrun - underrun));
+
+    /* stall until the FIFO is empty: PLAYDONE with the producer still running is a failure, not the end */
+    fill = (bench_fill_t){.left = BENCH_STREAM_LEN, .dev = dev, .stall_left = BENCH_STREAM_LEN - 4 * RT903X_PIPE_BLOCK_SIZE,
+                          .stall_out = true};
+    BENCH_CHECK(rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850) == 0, "pipe setup");
+    bench_reset_counters();
+    res = rt903x_stream_run_pipe(dev, bench_fill, &fill, 0);
+    BENCH_CHECK(res < 0, "starved stream reported %d", (int)res);
+    BENCH_CHECK(!rt903x_stream_busy(dev), "starved stream still busy");
+
+    bench_stream_arm(dev);
+    bench_stream_long(dev);
+    bench_sched(dev);
+
+    bench_tick_run = false;
+    pthread_join(tick, NULL);
+    bench_chip.ticking = false;
+}
+
+int main(void)
+{
+    rt903x_dev_t dev;
+
+    i2c_fake_bus_init(&bench_bus.fake, 0, 400000);
+    pthread_mutex_init(&bench_bus.lock, NULL);
+    bench_bus.bus.ops = &bench_bus_ops;
+    bench_bus.bus.port = 0;
+    bench_bus.bus.ctx = &bench_bus;
+
+    memset(&bench_chip, 0, sizeof(bench_chip));
+    bench_chip.fake = i2c_fake_bus_add(&bench_bus.fake, RT903_I2C_1_ADDRESS);
+    bench_chip.fake->xfer = bench_chip_xfer;
+    bench_chip.fake->model = &bench_chip;
+    bench_chip.fake->regs[REG_DEV_ID] = CHIP_ID;
+    const uint8_t efuse[4] = {0x5A, 0x3C, 0x91, 0x40};
+    memcpy(bench_chip.efuse, efuse, sizeof(efuse));
+    for (uint32_t i = 0; i < sizeof(bench_stream_data); i++)
+    {
+        bench_stream_data[i] = (uint8_t)i;
+    }
+
+    bench_init(&dev);
+    bench_ram(&dev);
+    bench_f0(&dev);
+    bench_stream_poll(&dev);
+    bench_stream_engine(&dev);
+    BENCH_CHECK(bench_bus.fake.errors == 0, "%u bus errors", (unsigned)bench_bus.fake.errors);
+
+    printf("%s\n", bench_failed ? "FAILED" : "PASSED");
+    return bench_failed ? 1 : 0;
+}
@@ -5,19 +5,82 @@
  *      Author: 60057363
  */
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <esp_err.h>
 #include <string.h>
-//#include <freertos/FreeRTOS.h>
-//#include <freertos/task.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
 #include "i2c_adapter.h"
+#include "ics_util.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_rom_sys.h"
 #include "driver/i2c.h"
 #include "sdkconfig.h"
 
 
 static const char *TAG = "i2c_adapter";
 
+typedef struct {
+    QueueHandle_t queue;
+    TaskHandle_t owner;
+    TickType_t timeout_ticks;   /* deadline of the transaction being run */
+    /* command link storage, only touched by the port owner (or the single boot-time caller) */
+    uint8_t cmd_buf[I2C_CMD_LINK_BUF_SIZE];
+    /* reg + payload staging for batch bursts, at most one reg byte per value */
+    uint8_t batch_buf[2 * I2C_BATCH_MAX_REGS];
+} i2c_executor_t;
+
+typedef struct {
+    uint16_t dev_addr;
+    uint32_t max_freq_hz;
+    i2c_speed_check_t check;
+    void *arg;
+} i2c_speed_dev_t;
+
+typedef struct {
+    def_i2c_config_t cfg;       /* pins and limits from i2c_master_init */
+    uint32_t freq_hz;           /* current SCL */
+    uint8_t err_run;            /* consecutive failures on registered devices */
+    bool negotiating;           /* no fallback while the probe itself is failing on purpose */
+    uint8_t dev_cnt;
+    i2c_speed_dev_t dev[I2C_SPEED_DEV_MAX];
+} i2c_speed_t;
+
+typedef struct {
+    portMUX_TYPE lock;          /* snapshots are taken from other tasks */
+    i2c_port_stats_t stats;
+    uint32_t slot_epoch[I2C_STATS_SLOTS];
+    uint32_t slot_busy_us[I2C_STATS_SLOTS];
+} i2c_stats_t;
+
+/* fault state of one device, a quarantined device fails fast instead of holding the bus */
+typedef struct {
+    uint16_t dev_addr;
+    uint8_t fails;              /* consecutive failed transactions */
+    uint32_t backoff_ms;        /* current quarantine period, doubles on every failed re-probe */
+    int64_t until_us;           /* 0 when not quarantined */
+} i2c_dev_health_t;
+
+typedef struct {
+    uint32_t recoveries;
+    uint8_t dev_cnt;
+    i2c_dev_health_t dev[I2C_QUARANTINE_DEV_MAX];
+} i2c_health_t;
+
+static i2c_executor_t i2c_executor[I2C_PORT_NUM_MAX];
+static i2c_health_t i2c_health[I2C_PORT_NUM_MAX];
+static i2c_stats_t i2c_stats[I2C_PORT_NUM_MAX] = {
+    {.lock = portMUX_INITIALIZER_UNLOCKED},
+    {.lock = portMUX_INITIALIZER_UNLOCKED},
+};
+static const uint32_t i2c_stats_lat_bound_us[I2C_STATS_LAT_BUCKETS - 1] = {50, 100, 200, 500, 1000, 2000, 5000};
+static i2c_speed_t i2c_speed[I2C_PORT_NUM_MAX];
+static const uint32_t i2c_speed_ladder[] = {I2C_SPEED_FAST_PLUS_HZ, I2C_SPEED_FAST_HZ, I2C_SPEED_STANDARD_HZ};
+
 /**
  * @brief i2c master initialization
  */
@@ -37,26 +100,588 @@ esp_err_t i2c_master_init(def_i2c_config_t i2cConfig)
     if (err != ESP_OK) {
         return err;
     }
+    if (i2c_master_port < I2C_PORT_NUM_MAX) {
+        i2c_speed[i2c_master_port].cfg = i2cConfig;
+        i2c_speed[i2c_master_port].freq_hz = i2cConfig.i2c_master_freq_hz;
+    }
     return i2c_driver_install(i2c_master_port, conf.mode, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
 }
 
 
 
+/*
+ * Command links live in the fixed cmd_buf. Once it is full the link calls fail with ESP_ERR_NO_MEM,
+ * so every step is checked and a link that was not built in full never reaches the bus.
+ */
+#define I2C_LINK_ADD(err, op)   do { if ((err) == ESP_OK) { (err) = (op); } } while (0)
+
+static i2c_cmd_handle_t i2c_link_create(uint8_t i2c_master_num, esp_err_t *err) {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(i2c_executor[i2c_master_num].cmd_buf, I2C_CMD_LINK_BUF_SIZE);
+    *err = (cmd == NULL) ? ESP_ERR_NO_MEM : ESP_OK;
+    return cmd;
+}
+
+static esp_err_t i2c_link_run(uint8_t i2c_master_num, i2c_cmd_handle_t cmd, esp_err_t err, TickType_t ticks) {
+    if (err == ESP_OK) {
+        err = i2c_master_cmd_begin(i2c_master_num, cmd, ticks);
+    } else {
+        ESP_LOGE(TAG, "port %d: command link build failed: %s", i2c_master_num, esp_err_to_name(err));
+    }
+    if (cmd != NULL) {
+        i2c_cmd_link_delete_static(cmd);
+    }
+    return err;
+}
+
+static esp_err_t i2c_read_reg_run(uint8_t i2c_master_num, uint16_t devAddr, uint16_t ReadAddr, uint8_t *data_wr, uint16_t len) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, ReadAddr, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | READ_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_read(cmd, data_wr, len, I2C_MASTER_LAST_NACK));
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_write_reg_run(uint8_t i2c_master_num, uint16_t devAddr, uint16_t WriteAddr, uint8_t *data_wr, uint16_t length) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, WriteAddr, ACK_CHECK_EN));
+    if (length > 0) {
+        /* one bulk write command for the whole payload, not one node per byte */
+        I2C_LINK_ADD(err, i2c_master_write(cmd, data_wr, length, ACK_CHECK_EN));
+    }
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_raw_write_run(uint8_t i2c_master_num, uint16_t devAddr, uint8_t *data_wr, uint16_t length) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_write(cmd, data_wr, length, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_raw_read_run(uint8_t i2c_master_num, uint16_t devAddr, uint8_t *data_rd, uint16_t len) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | READ_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_read(cmd, data_rd, len, I2C_MASTER_LAST_NACK));
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_write_read_run(uint8_t i2c_master_num, uint16_t devAddr, const uint8_t *wr_buf, uint16_t wr_len,
+                                    uint8_t *data_rd, uint16_t len) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    if (wr_len > 0) {
+        I2C_LINK_ADD(err, i2c_master_write(cmd, wr_buf, wr_len, ACK_CHECK_EN));
+    }
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | READ_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_read(cmd, data_rd, len, I2C_MASTER_LAST_NACK));
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_writev_run(uint8_t i2c_master_num, uint16_t devAddr, const i2c_iovec_t *iov, uint16_t iovcnt) {
+    if (iovcnt > I2C_IOV_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    for (uint16_t i = 0; i < iovcnt; i++) {
+        if (iov[i].len > 0) {
+            I2C_LINK_ADD(err, i2c_master_write(cmd, iov[i].buf, iov[i].len, ACK_CHECK_EN));
+        }
+    }
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+}
+
+static esp_err_t i2c_write_batch_run(uint8_t i2c_master_num, uint16_t devAddr, const i2c_reg_val_t *regs, uint16_t count,
+                                     i2c_batch_stats_t *stats) {
+    i2c_executor_t *exec = &i2c_executor[i2c_master_num];
+    esp_err_t ret = ESP_OK;
+    uint16_t i = 0;
+    if (count > I2C_BATCH_MAX_REGS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (i < count && ret == ESP_OK) {
+        esp_err_t err;
+        i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+        uint16_t pos = 0, bursts = 0;
+        while (i < count && bursts < I2C_CMD_LINK_TRANS_MAX) {
+            /* extend the burst while the next register follows on, the chip auto-increments */
+            uint8_t *burst = &exec->batch_buf[pos];
+            uint16_t n = 0;
+            burst[0] = regs[i].reg;
+            do {
+                burst[1 + n++] = regs[i++].val;
+            } while (i < count && regs[i].reg == (uint8_t)(regs[i - 1].reg + 1));
+            I2C_LINK_ADD(err, i2c_master_start(cmd));
+            I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+            I2C_LINK_ADD(err, i2c_master_write(cmd, burst, n + 1, ACK_CHECK_EN));
+            I2C_LINK_ADD(err, i2c_master_stop(cmd));
+            pos += n + 1;
+            bursts++;
+            if (stats != NULL) {
+                stats->regs += n;
+                stats->bursts++;
+                stats->wire_bytes += n + 2;
+                stats->single_bytes += 3 * n;
+            }
+        }
+        ret = i2c_link_run(i2c_master_num, cmd, err, i2c_executor[i2c_master_num].timeout_ticks);
+    }
+    return ret;
+}
+
+/* pins and pull-ups as configured at init, only the clock changes */
+static esp_err_t i2c_port_config(uint8_t i2c_master_num, uint32_t freq_hz) {
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = speed->cfg.i2c_master_sda_io,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_io_num = speed->cfg.i2c_master_scl_io,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = freq_hz,
+    };
+    return i2c_param_config(i2c_master_num, &conf);
+}
+
+/* re-run the timing setup of an installed port */
+static esp_err_t i2c_set_clock_run(uint8_t i2c_master_num, uint32_t freq_hz) {
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    esp_err_t ret = i2c_port_config(i2c_master_num, freq_hz);
+    if (ret == ESP_OK) {
+        speed->freq_hz = freq_hz;
+        speed->err_run = 0;
+    }
+    return ret;
+}
+
+static bool i2c_speed_is_registered(i2c_speed_t *speed, uint16_t devAddr)
+{
+    for (uint8_t i = 0; i < speed->dev_cnt; i++) {
+        if (speed->dev[i].dev_addr == devAddr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* step a port down one profile after repeated errors on a device that passed at the current clock */
+static void i2c_speed_account(i2c_trans_t *trans, esp_err_t ret)
+{
+    i2c_speed_t *speed = &i2c_speed[trans->i2c_master_num];
+    if (trans->op == I2C_TRANS_SET_CLOCK || speed->negotiating || ret == ESP_ERR_INVALID_STATE || ret == ESP_ERR_NO_MEM
+        || !i2c_speed_is_registered(speed, trans->dev_addr)) {
+        return;
+    }
+    if (ret == ESP_OK) {
+        speed->err_run = 0;
+        return;
+    }
+    if (++speed->err_run < I2C_SPEED_FALLBACK_ERRS) {
+        return;
+    }
+    for (uint8_t i = 0; i < ARRAY_SIZE(i2c_speed_ladder); i++) {
+        if (i2c_speed_ladder[i] < speed->freq_hz) {
+            ESP_LOGW(TAG, "port %d: %d errors at %d Hz, falling back to %d Hz", trans->i2c_master_num,
+                     speed->err_run, (int)speed->freq_hz, (int)i2c_speed_ladder[i]);
+            i2c_set_clock_run(trans->i2c_master_num, i2c_speed_ladder[i]);
+            return;
+        }
+    }
+    speed->err_run = 0;
+}
+
+static esp_err_t i2c_trans_op_run(i2c_trans_t *trans)
+{
+    if (trans->len == 0 && trans->op != I2C_TRANS_WRITE && trans->op != I2C_TRANS_BATCH && trans->op != I2C_TRANS_SET_CLOCK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    switch (trans->op) {
+        case I2C_TRANS_WRITE:
+            return i2c_write_reg_run(trans->i2c_master_num, trans->dev_addr, trans->reg, trans->data, trans->len);
+        case I2C_TRANS_READ:
+            return i2c_read_reg_run(trans->i2c_master_num, trans->dev_addr, trans->reg, trans->data, trans->len);
+        case I2C_TRANS_RAW_WRITE:
+            return i2c_raw_write_run(trans->i2c_master_num, trans->dev_addr, trans->data, trans->len);
+        case I2C_TRANS_RAW_READ:
+            return i2c_raw_read_run(trans->i2c_master_num, trans->dev_addr, trans->data, trans->len);
+        case I2C_TRANS_BATCH:
+            return i2c_write_batch_run(trans->i2c_master_num, trans->dev_addr, trans->regs, trans->len, trans->stats);
+        case I2C_TRANS_WRITEV:
+            return i2c_writev_run(trans->i2c_master_num, trans->dev_addr, trans->iov, trans->len);
+        case I2C_TRANS_WRITE_READ:
+            return i2c_write_read_run(trans->i2c_master_num, trans->dev_addr, trans->wr_buf, trans->wr_len, trans->data, trans->len);
+        case I2C_TRANS_SET_CLOCK:
+            return i2c_set_clock_run(trans->i2c_master_num, trans->freq_hz);
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+
+/* payload bytes a transaction clocks out or in, address bytes excluded */
+static uint32_t i2c_trans_bytes(const i2c_trans_t *trans)
+{
+    uint32_t bytes = 0;
+    switch (trans->op) {
+        case I2C_TRANS_WRITE:
+        case I2C_TRANS_READ:
+            return trans->len + 1;
+        case I2C_TRANS_RAW_WRITE:
+        case I2C_TRANS_RAW_READ:
+            return trans->len;
+        case I2C_TRANS_BATCH:
+            return trans->len * 2;
+        case I2C_TRANS_WRITEV:
+            for (uint16_t i = 0; i < trans->len && i < I2C_IOV_MAX; i++) {
+                bytes += trans->iov[i].len;
+            }
+            return bytes;
+        case I2C_TRANS_WRITE_READ:
+            return trans->wr_len + trans->len;
+        default:
+            return 0;
+    }
+}
+
+/* device entry for an address, allocated on first use, NULL once the table is full */
+static i2c_dev_stats_t *i2c_stats_dev(i2c_port_stats_t *stats, uint16_t devAddr)
+{
+    for (uint8_t i = 0; i < stats->dev_cnt; i++) {
+        if (stats->dev[i].dev_addr == devAddr) {
+            return &stats->dev[i];
+        }
+    }
+    if (stats->dev_cnt >= I2C_STATS_DEV_MAX) {
+        return NULL;
+    }
+    i2c_dev_stats_t *dev = &stats->dev[stats->dev_cnt++];
+    memset(dev, 0, sizeof(i2c_dev_stats_t));
+    dev->dev_addr = devAddr;
+    return dev;
+}
+
+static void i2c_stats_add(i2c_dev_stats_t *dev, uint32_t bytes, bool err, uint8_t bucket, uint32_t lat_us, uint32_t busy_us)
+{
+    dev->trans++;
+    dev->bytes += bytes;
+    dev->errors += err ? 1 : 0;
+    dev->lat_hist[bucket]++;
+    if (lat_us > dev->lat_max_us) {
+        dev->lat_max_us = lat_us;
+    }
+    dev->busy_us += busy_us;
+}
+
+static void i2c_stats_record(i2c_trans_t *trans, esp_err_t ret, int64_t start_us, int64_t end_us)
+{
+    if (trans->op == I2C_TRANS_SET_CLOCK) {
+        return;
+    }
+    i2c_stats_t *st = &i2c_stats[trans->i2c_master_num];
+    uint32_t busy_us = (uint32_t)(end_us - start_us);
+    uint32_t lat_us = (uint32_t)(end_us - (trans->submit_us ? trans->submit_us : start_us));
+    uint32_t bytes = i2c_trans_bytes(trans);
+    uint32_t epoch = (uint32_t)(end_us / I2C_STATS_SLOT_US);
+    uint8_t slot = epoch % I2C_STATS_SLOTS;
+    uint8_t bucket = 0;
+    while (bucket < I2C_STATS_LAT_BUCKETS - 1 && lat_us >= i2c_stats_lat_bound_us[bucket]) {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&st->lock);
+    i2c_stats_add(&st->stats.total, bytes, ret != ESP_OK, bucket, lat_us, busy_us);
+    i2c_dev_stats_t *dev = i2c_stats_dev(&st->stats, trans->dev_addr);
+    if (dev != NULL) {
+        i2c_stats_add(dev, bytes, ret != ESP_OK, bucket, lat_us, busy_us);
+    }
+    if (st->slot_epoch[slot] != epoch) {
+        st->slot_epoch[slot] = epoch;
+        st->slot_busy_us[slot] = 0;
+    }
+    st->slot_busy_us[slot] += busy_us;
+    portEXIT_CRITICAL(&st->lock);
+}
+
+/* pdMS_TO_TICKS truncates, at 100 Hz 5 ms would be 0 ticks: round up, then keep a floor and a margin */
+static TickType_t i2c_deadline_ticks(uint32_t timeout_ms)
+{
+    TickType_t ticks = (TickType_t)(((uint64_t)timeout_ms * configTICK_RATE_HZ + 999) / 1000);
+    if (ticks < I2C_TRANS_MIN_TICKS) {
+        ticks = I2C_TRANS_MIN_TICKS;
+    }
+    return ticks + I2C_TRANS_MARGIN_TICKS;
+}
+
+/* deadline of one transaction: fixed overhead plus the time its bytes take at the current clock */
+static TickType_t i2c_trans_deadline(const i2c_trans_t *trans)
+{
+    uint32_t timeout_ms = trans->timeout_ms;
+    if (timeout_ms == 0) {
+        uint32_t freq_hz = i2c_speed[trans->i2c_master_num].freq_hz;
+        uint32_t bits = (i2c_trans_bytes(trans) + 2) * 9;
+        timeout_ms = I2C_TRANS_TIMEOUT_MS + (freq_hz ? (bits * 1000 + freq_hz - 1) / freq_hz : 0);
+    }
+    return i2c_deadline_ticks(timeout_ms);
+}
+
+/* address-only write, the device ACKs when it is back */
+static esp_err_t i2c_probe_run(uint8_t i2c_master_num, uint16_t devAddr) {
+    esp_err_t err;
+    i2c_cmd_handle_t cmd = i2c_link_create(i2c_master_num, &err);
+    I2C_LINK_ADD(err, i2c_master_start(cmd));
+    I2C_LINK_ADD(err, i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN));
+    I2C_LINK_ADD(err, i2c_master_stop(cmd));
+    return i2c_link_run(i2c_master_num, cmd, err, i2c_deadline_ticks(I2C_TRANS_TIMEOUT_MS));
+}
+
+/*
+ * A slave holding SDA low survives a controller reset. Take the pins as GPIO, clock SCL
+ * until SDA is released (at most 9 pulses finish any byte in flight), send a STOP and
+ * reinstall the driver at the current clock.
+ */
+static esp_err_t i2c_bus_recover(uint8_t i2c_master_num) {
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    gpio_num_t scl = speed->cfg.i2c_master_scl_io;
+    gpio_num_t sda = speed->cfg.i2c_master_sda_io;
+
+    i2c_driver_delete(i2c_master_num);
+    gpio_set_level(sda, 1);
+    gpio_set_level(scl, 1);
+    gpio_set_direction(sda, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_direction(scl, GPIO_MODE_INPUT_OUTPUT_OD);
+    esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+    for (int i = 0; i < 9 && gpio_get_level(sda) == 0; i++) {
+        gpio_set_level(scl, 0);
+        esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+        gpio_set_level(scl, 1);
+        esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+    }
+    /* STOP: SDA rises while SCL is high */
+    gpio_set_level(scl, 0);
+    esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+    gpio_set_level(sda, 0);
+    esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+    gpio_set_level(scl, 1);
+    esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+    gpio_set_level(sda, 1);
+    esp_rom_delay_us(I2C_RECOVER_HALF_PERIOD_US);
+
+    i2c_health[i2c_master_num].recoveries++;
+    esp_err_t ret = i2c_port_config(i2c_master_num, speed->freq_hz);
+    if (ret == ESP_OK) {
+        ret = i2c_driver_install(i2c_master_num, I2C_MODE_MASTER, I2C_MASTER_RX_BUF_DISABLE, I2C_MASTER_TX_BUF_DISABLE, 0);
+    }
+    ESP_LOGW(TAG, "port %d: bus recovered (sda:%d), reinit ret:%d", i2c_master_num, gpio_get_level(sda), ret);
+    return ret;
+}
+
+/* a transaction that ended leaves both lines released, one still held low is a hung slave or a stuck bus */
+static bool i2c_bus_stuck(uint8_t i2c_master_num) {
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    return gpio_get_level(speed->cfg.i2c_master_sda_io) == 0 || gpio_get_level(speed->cfg.i2c_master_scl_io) == 0;
+}
+
+static i2c_dev_health_t *i2c_health_dev(uint8_t i2c_master_num, uint16_t devAddr)
+{
+    i2c_health_t *health = &i2c_health[i2c_master_num];
+    for (uint8_t i = 0; i < health->dev_cnt; i++) {
+        if (health->dev[i].dev_addr == devAddr) {
+            return &health->dev[i];
+        }
+    }
+    if (health->dev_cnt >= I2C_QUARANTINE_DEV_MAX) {
+        return NULL;
+    }
+    i2c_dev_health_t *dev = &health->dev[health->dev_cnt++];
+    memset(dev, 0, sizeof(i2c_dev_health_t));
+    dev->dev_addr = devAddr;
+    return dev;
+}
+
+/* false while the device sits out its backoff, or when the re-probe after it fails */
+static bool i2c_health_admit(uint8_t i2c_master_num, i2c_dev_health_t *dev)
+{
+    if (dev == NULL || dev->until_us == 0) {
+        return true;
+    }
+    int64_t now_us = esp_timer_get_time();
+    if (now_us < dev->until_us) {
+        return false;
+    }
+    if (i2c_probe_run(i2c_master_num, dev->dev_addr) != ESP_OK) {
+        dev->backoff_ms = dev->backoff_ms * 2 > I2C_QUARANTINE_MAX_MS ? I2C_QUARANTINE_MAX_MS : dev->backoff_ms * 2;
+        dev->until_us = now_us + (int64_t)dev->backoff_ms * 1000;
+        return false;
+    }
+    ESP_LOGI(TAG, "port %d: device 0x%x answers again, leaving quarantine", i2c_master_num, dev->dev_addr);
+    dev->until_us = 0;
+    return true;
+}
+
+static void i2c_health_account(uint8_t i2c_master_num, i2c_dev_health_t *dev, esp_err_t ret)
+{
+    if (dev == NULL || i2c_speed[i2c_master_num].negotiating || ret == ESP_ERR_NO_MEM) {
+        return;
+    }
+    if (ret == ESP_OK) {
+        dev->fails = 0;
+        dev->backoff_ms = 0;
+        return;
+    }
+    if (++dev->fails < I2C_QUARANTINE_ERRS) {
+        return;
+    }
+    /* keeps doubling when the device fails again right after leaving quarantine */
+    dev->backoff_ms = dev->backoff_ms == 0 ? I2C_QUARANTINE_MIN_MS
+                    : (dev->backoff_ms * 2 > I2C_QUARANTINE_MAX_MS ? I2C_QUARANTINE_MAX_MS : dev->backoff_ms * 2);
+    dev->until_us = esp_timer_get_time() + (int64_t)dev->backoff_ms * 1000;
+    dev->fails = 0;
+    ESP_LOGW(TAG, "port %d: device 0x%x quarantined for %d ms", i2c_master_num, dev->dev_addr, (int)dev->backoff_ms);
+}
+
+static esp_err_t i2c_trans_run(i2c_trans_t *trans)
+{
+    i2c_dev_health_t *dev = NULL;
+    esp_err_t ret;
+    int64_t start_us = esp_timer_get_time();
+    i2c_executor[trans->i2c_master_num].timeout_ticks = i2c_trans_deadline(trans);
+    if (trans->op != I2C_TRANS_SET_CLOCK) {
+        dev = i2c_health_dev(trans->i2c_master_num, trans->dev_addr);
+    }
+    if (!i2c_health_admit(trans->i2c_master_num, dev)) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        ret = i2c_trans_op_run(trans);
+        /* a missed deadline alone (slow clock stretch, preempted executor) only fails this transaction,
+         * the driver resets its own state machine; clock the bus free only when a line is stuck */
+        if (ret == ESP_ERR_TIMEOUT && i2c_bus_stuck(trans->i2c_master_num)) {
+            i2c_bus_recover(trans->i2c_master_num);
+        }
+        i2c_health_account(trans->i2c_master_num, dev, ret);
+    }
+    i2c_stats_record(trans, ret, start_us, esp_timer_get_time());
+    i2c_speed_account(trans, ret);
+    return ret;
+}
+
+static void i2c_executor_task(void *arg)
+{
+    i2c_executor_t *exec = (i2c_executor_t *)arg;
+    i2c_trans_t *trans = NULL;
+    for (;;) {
+        if (xQueueReceive(exec->queue, &trans, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+        trans->result = i2c_trans_run(trans);
+        if (trans->cb != NULL) {
+            trans->cb(trans, trans->cb_arg);
+        }
+        xSemaphoreGive(trans->done);
+    }
+}
+
+/**
+ * @brief start the owner task of one i2c port, i2c_master_init must be called before
+ */
+esp_err_t i2c_executor_start(uint8_t i2c_master_num, BaseType_t core_id)
+{
+    static const char *task_name[I2C_PORT_NUM_MAX] = {"i2c_exec_0", "i2c_exec_1"};
+    if (i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_executor_t *exec = &i2c_executor[i2c_master_num];
+    if (exec->owner != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    exec->queue = xQueueCreate(I2C_EXECUTOR_QUEUE_LEN, sizeof(i2c_trans_t *));
+    if (exec->queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(i2c_executor_task, task_name[i2c_master_num], I2C_EXECUTOR_TASK_STACK,
+                                exec, I2C_EXECUTOR_TASK_PRIO, &exec->owner, core_id) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void i2c_trans_init(i2c_trans_t *trans, i2c_trans_op_t op, uint8_t i2c_master_num, uint16_t devAddr,
+                    uint16_t reg, uint8_t *data, uint16_t len)
+{
+    memset(trans, 0, sizeof(i2c_trans_t));
+    trans->op = op;
+    trans->i2c_master_num = i2c_master_num;
+    trans->dev_addr = devAddr;
+    trans->reg = reg;
+    trans->data = data;
+    trans->len = len;
+    trans->done = xSemaphoreCreateBinaryStatic(&trans->done_buf);
+}
+
+/**
+ * @brief queue a transaction on its port, completion is reported through trans->cb and trans->done.
+ *        Without a started executor (early boot) the transaction runs inline in the caller.
+ */
+esp_err_t i2c_executor_submit(i2c_trans_t *trans)
+{
+    if (trans->i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_executor_t *exec = &i2c_executor[trans->i2c_master_num];
+    trans->submit_us = esp_timer_get_time();
+    if (exec->owner == NULL || exec->owner == xTaskGetCurrentTaskHandle()) {
+        trans->result = i2c_trans_run(trans);
+        if (trans->cb != NULL) {
+            trans->cb(trans, trans->cb_arg);
+        }
+        xSemaphoreGive(trans->done);
+        return ESP_OK;
+    }
+    if (xQueueSend(exec->queue, &trans, portMAX_DELAY) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief block until a submitted transaction completes, returns its bus result
+ */
+esp_err_t i2c_executor_wait(i2c_trans_t *trans, TickType_t ticks_to_wait)
+{
+    if (xSemaphoreTake(trans->done, ticks_to_wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return trans->result;
+}
+
 int16_t I2CReadReg(uint8_t i2c_master_num, uint16_t devAddr, uint16_t ReadAddr, uint8_t *data_wr, uint16_t len) {
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, ReadAddr, ACK_CHECK_EN);
-    i2c_master_start(cmd);
-
-    i2c_master_write_byte(cmd, devAddr << 1 | READ_BIT, ACK_CHECK_EN);
-    if (len > 1) {
-        i2c_master_read(cmd, data_wr, len - 1, ACK_VAL);
-    }
-    i2c_master_read_byte(cmd, data_wr + len - 1, NACK_VAL);
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(i2c_master_num, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+    i2c_trans_t trans;
+    i2c_trans_init(&trans, I2C_TRANS_READ, i2c_master_num, devAddr, ReadAddr, data_wr, len);
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
 	if (0 != ret){
 		ESP_LOGI(TAG, "I2CReadReg,ret:%d",ret);
         return -1;
@@ -65,23 +690,261 @@ int16_t I2CReadReg(uint8_t i2c_master_num, uint16_t devAddr, uint16_t ReadAddr,
 }
 
 int16_t I2CWriteReg(uint8_t i2c_master_num, uint16_t devAddr, uint16_t WriteAddr, uint8_t *data_wr, uint16_t length) {
-	esp_err_t ret = 0;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    ret = i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, devAddr << 1 | WRITE_BIT, ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, WriteAddr, ACK_CHECK_EN);
-    for (int i = 0; i < length; i++) {
-        ret = i2c_master_write_byte(cmd, data_wr[i], ACK_CHECK_EN);
-    }
-    ret = i2c_master_stop(cmd);
-    ret = i2c_master_cmd_begin(i2c_master_num, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+    i2c_trans_t trans;
+    i2c_trans_init(&trans, I2C_TRANS_WRITE, i2c_master_num, devAddr, WriteAddr, data_wr, length);
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
 	if (0 != ret){
 		ESP_LOGI(TAG, "I2CWriteReg,ret:%d",ret);
         return -1;
 	}
     return 0;
+}
 
+/**
+ * @brief write then read with a repeated start in between, one transaction instead of two
+ */
+int16_t I2CWriteRead(uint8_t i2c_master_num, uint16_t devAddr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len) {
+    i2c_trans_t trans;
+    i2c_trans_init(&trans, I2C_TRANS_WRITE_READ, i2c_master_num, devAddr, 0, rd_buf, rd_len);
+    trans.wr_buf = wr_buf;
+    trans.wr_len = wr_len;
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
+	if (0 != ret){
+		ESP_LOGI(TAG, "I2CWriteRead,ret:%d",ret);
+        return -1;
+	}
+    return 0;
+}
 
+/**
+ * @brief scatter-gather write, the segments (e.g. header + payload) go out in one transaction
+ */
+int16_t I2CWriteV(uint8_t i2c_master_num, uint16_t devAddr, const i2c_iovec_t *iov, uint8_t iovcnt) {
+    i2c_trans_t trans;
+    i2c_trans_init(&trans, I2C_TRANS_WRITEV, i2c_master_num, devAddr, 0, NULL, iovcnt);
+    trans.iov = iov;
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
+	if (0 != ret){
+		ESP_LOGI(TAG, "I2CWriteV,ret:%d",ret);
+        return -1;
+	}
+    return 0;
 }
 
+/**
+ * @brief write a list of (reg, value) pairs in one command link. Runs of consecutive register
+ *        addresses become a single auto-increment burst, the rest go back to back.
+ * @param stats optional, accumulates burst and byte counts so the saving can be checked
+ */
+int16_t I2CWriteRegBatch(uint8_t i2c_master_num, uint16_t devAddr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats) {
+    i2c_trans_t trans;
+    i2c_trans_init(&trans, I2C_TRANS_BATCH, i2c_master_num, devAddr, 0, NULL, count);
+    trans.regs = regs;
+    trans.stats = stats;
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
+	if (0 != ret){
+		ESP_LOGI(TAG, "I2CWriteRegBatch,ret:%d",ret);
+        return -1;
+	}
+    return 0;
+}
+
+/**
+ * @brief change the SCL clock of a port, queued behind the transfers already submitted
+ */
+esp_err_t i2c_set_clock(uint8_t i2c_master_num, uint32_t freq_hz) {
+    i2c_trans_t trans;
+    if (i2c_master_num >= I2C_PORT_NUM_MAX || freq_hz == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_trans_init(&trans, I2C_TRANS_SET_CLOCK, i2c_master_num, 0, 0, NULL, 0);
+    trans.freq_hz = freq_hz;
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
+    return ret;
+}
+
+uint32_t i2c_get_clock(uint8_t i2c_master_num) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return 0;
+    }
+    return i2c_speed[i2c_master_num].freq_hz;
+}
+
+/**
+ * @brief add a device to the speed negotiation of its port. The check runs once at the current
+ *        clock, a device that does not answer is not registered and does not limit the port.
+ */
+esp_err_t i2c_speed_register(uint8_t i2c_master_num, uint16_t devAddr, uint32_t max_freq_hz, i2c_speed_check_t check, void *arg) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX || check == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    if (speed->dev_cnt >= I2C_SPEED_DEV_MAX) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (check(i2c_master_num, devAddr, arg) != 0) {
+        ESP_LOGI(TAG, "port %d: device 0x%x failed its check at %d Hz, not registered", i2c_master_num, devAddr, (int)speed->freq_hz);
+        return ESP_ERR_NOT_FOUND;
+    }
+    i2c_speed_dev_t *dev = &speed->dev[speed->dev_cnt];
+    dev->dev_addr = devAddr;
+    dev->max_freq_hz = max_freq_hz;
+    dev->check = check;
+    dev->arg = arg;
+    speed->dev_cnt++;
+    return ESP_OK;
+}
+
+/**
+ * @brief move a port to the fastest profile where every registered device passes its check,
+ *        bounded by the port limit and the slowest device rating. Falls back to the boot clock.
+ * @return the clock the port runs at afterwards
+ */
+uint32_t i2c_speed_negotiate(uint8_t i2c_master_num) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return 0;
+    }
+    i2c_speed_t *speed = &i2c_speed[i2c_master_num];
+    uint32_t ceiling = speed->cfg.i2c_master_max_freq_hz;
+    for (uint8_t i = 0; i < speed->dev_cnt; i++) {
+        if (speed->dev[i].max_freq_hz < ceiling) {
+            ceiling = speed->dev[i].max_freq_hz;
+        }
+    }
+    speed->negotiating = true;
+    for (uint8_t step = 0; step < ARRAY_SIZE(i2c_speed_ladder); step++) {
+        uint32_t freq_hz = i2c_speed_ladder[step];
+        if (freq_hz > ceiling || freq_hz < speed->cfg.i2c_master_freq_hz) {
+            continue;
+        }
+        if (i2c_set_clock(i2c_master_num, freq_hz) != ESP_OK) {
+            continue;
+        }
+        uint8_t i = 0;
+        while (i < speed->dev_cnt && speed->dev[i].check(i2c_master_num, speed->dev[i].dev_addr, speed->dev[i].arg) == 0) {
+            i++;
+        }
+        if (i == speed->dev_cnt) {
+            speed->negotiating = false;
+            ESP_LOGI(TAG, "port %d: %d devices pass at %d Hz", i2c_master_num, speed->dev_cnt, (int)freq_hz);
+            return freq_hz;
+        }
+        ESP_LOGI(TAG, "port %d: device 0x%x fails at %d Hz", i2c_master_num, speed->dev[i].dev_addr, (int)freq_hz);
+    }
+    i2c_set_clock(i2c_master_num, speed->cfg.i2c_master_freq_hz);
+    speed->negotiating = false;
+    return speed->freq_hz;
+}
+
+/**
+ * @brief copy the counters of a port, occupancy is computed over the last complete window
+ */
+esp_err_t i2c_stats_snapshot(uint8_t i2c_master_num, i2c_port_stats_t *out) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    i2c_stats_t *st = &i2c_stats[i2c_master_num];
+    uint32_t now_epoch = (uint32_t)(esp_timer_get_time() / I2C_STATS_SLOT_US);
+    uint64_t busy_us = 0;
+
+    portENTER_CRITICAL(&st->lock);
+    memcpy(out, &st->stats, sizeof(i2c_port_stats_t));
+    for (uint8_t i = 0; i < I2C_STATS_SLOTS; i++) {
+        /* the current slot is still filling, the window is the complete slots before it */
+        if (st->slot_epoch[i] != now_epoch && now_epoch - st->slot_epoch[i] < I2C_STATS_SLOTS) {
+            busy_us += st->slot_busy_us[i];
+        }
+    }
+    portEXIT_CRITICAL(&st->lock);
+    busy_us = busy_us * 100 / ((uint64_t)I2C_STATS_SLOT_US * (I2C_STATS_SLOTS - 1));
+    out->occupancy_pct = busy_us > 100 ? 100 : (uint8_t)busy_us;
+    return ESP_OK;
+}
+
+void i2c_stats_reset(uint8_t i2c_master_num) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return;
+    }
+    i2c_stats_t *st = &i2c_stats[i2c_master_num];
+    portENTER_CRITICAL(&st->lock);
+    memset(&st->stats, 0, sizeof(i2c_port_stats_t));
+    memset(st->slot_epoch, 0, sizeof(st->slot_epoch));
+    memset(st->slot_busy_us, 0, sizeof(st->slot_busy_us));
+    portEXIT_CRITICAL(&st->lock);
+}
+
+/**
+ * @brief count a retry a driver made after a failed transaction (the adapter itself does not retry)
+ */
+void i2c_stats_note_retry(uint8_t i2c_master_num, uint16_t devAddr) {
+    if (i2c_master_num >= I2C_PORT_NUM_MAX) {
+        return;
+    }
+    i2c_stats_t *st = &i2c_stats[i2c_master_num];
+    portENTER_CRITICAL(&st->lock);
+    st->stats.total.retries++;
+    i2c_dev_stats_t *dev = i2c_stats_dev(&st->stats, devAddr);
+    if (dev != NULL) {
+        dev->retries++;
+    }
+    portEXIT_CRITICAL(&st->lock);
+}
+
+static void i2c_stats_print(const char *name, const i2c_dev_stats_t *dev)
+{
+    printf("  %-6s trans:%u bytes:%u err:%u retry:%u busy:%llums max:%uus |",
+           name, (unsigned)dev->trans, (unsigned)dev->bytes, (unsigned)dev->errors, (unsigned)dev->retries,
+           (unsigned long long)(dev->busy_us / 1000), (unsigned)dev->lat_max_us);
+    for (uint8_t i = 0; i < I2C_STATS_LAT_BUCKETS; i++) {
+        printf(" %u", (unsigned)dev->lat_hist[i]);
+    }
+    printf("\n");
+}
+
+/* console: i2cstat [reset] */
+static int i2c_stats_cmd(int argc, char **argv)
+{
+    i2c_port_stats_t stats;
+    char name[8];
+    for (uint8_t port = 0; port < I2C_PORT_NUM_MAX; port++) {
+        if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+            i2c_stats_reset(port);
+            continue;
+        }
+        i2c_stats_snapshot(port, &stats);
+        printf("i2c%d: %u Hz, occupancy %d%%, latency <50us <100us <200us <500us <1ms <2ms <5ms >=5ms\n",
+               port, (unsigned)i2c_get_clock(port), stats.occupancy_pct);
+        printf("  bus recoveries:%u\n", (unsigned)i2c_health[port].recoveries);
+        i2c_stats_print("total", &stats.total);
+        for (uint8_t i = 0; i < stats.dev_cnt; i++) {
+            snprintf(name, sizeof(name), "0x%02x", stats.dev[i].dev_addr);
+            i2c_stats_print(name, &stats.dev[i]);
+        }
+    }
+    return 0;
+}
+
+esp_err_t i2c_stats_register_cmd(void) {
+    const esp_console_cmd_t cmd = {
+        .command = "i2cstat",
+        .help = "I2C per-port/per-device counters, latency histogram and bus occupancy, 'i2cstat reset' clears them",
+        .hint = NULL,
+        .func = &i2c_stats_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
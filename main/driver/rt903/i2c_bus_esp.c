@@ -0,0 +1,95 @@
+/*
+ * i2c_bus_esp.c
+ *
+ * ESP-IDF implementation of the i2c_bus transport, every op is one transaction
+ * on the per-port executor of i2c_adapter.c.
+ */
+#include <stdint.h>
+#include <esp_err.h>
+#include "i2c_bus.h"
+#include "i2c_adapter.h"
+#include "esp_log.h"
+
+static const char *TAG = "i2c_bus_esp";
+
+static int i2c_bus_esp_write_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, const uint8_t *data, uint16_t len)
+{
+    return I2CWriteReg(bus->port, addr, reg, (uint8_t *)data, len) == 0 ? 0 : -1;
+}
+
+static int i2c_bus_esp_read_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    return I2CReadReg(bus->port, addr, reg, data, len) == 0 ? 0 : -1;
+}
+
+static int i2c_bus_esp_write_regs(i2c_bus_t *bus, uint16_t addr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats)
+{
+    return I2CWriteRegBatch(bus->port, addr, regs, count, stats) == 0 ? 0 : -1;
+}
+
+static int i2c_bus_esp_raw(i2c_bus_t *bus, i2c_trans_op_t op, uint16_t addr, uint8_t *data, uint16_t len)
+{
+    i2c_trans_t trans;
+    if (len == 0) {
+        return 0;
+    }
+    i2c_trans_init(&trans, op, bus->port, addr, 0, data, len);
+    esp_err_t ret = i2c_executor_submit(&trans);
+    if (ret == ESP_OK) {
+        ret = i2c_executor_wait(&trans, portMAX_DELAY);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGI(TAG, "raw %s 0x%x,ret:%d", op == I2C_TRANS_RAW_READ ? "read" : "write", addr, ret);
+        return -1;
+    }
+    return 0;
+}
+
+static int i2c_bus_esp_write(i2c_bus_t *bus, uint16_t addr, const uint8_t *data, uint16_t len)
+{
+    return i2c_bus_esp_raw(bus, I2C_TRANS_RAW_WRITE, addr, (uint8_t *)data, len);
+}
+
+static int i2c_bus_esp_read(i2c_bus_t *bus, uint16_t addr, uint8_t *data, uint16_t len)
+{
+    return i2c_bus_esp_raw(bus, I2C_TRANS_RAW_READ, addr, data, len);
+}
+
+static int i2c_bus_esp_writev(i2c_bus_t *bus, uint16_t addr, const i2c_iovec_t *iov, uint8_t iovcnt)
+{
+    return I2CWriteV(bus->port, addr, iov, iovcnt) == 0 ? 0 : -1;
+}
+
+static int i2c_bus_esp_write_read(i2c_bus_t *bus, uint16_t addr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len)
+{
+    if (rd_len == 0) {
+        return i2c_bus_esp_write(bus, addr, wr_buf, wr_len);
+    }
+    return I2CWriteRead(bus->port, addr, wr_buf, wr_len, rd_buf, rd_len) == 0 ? 0 : -1;
+}
+
+static const i2c_bus_ops_t i2c_bus_esp_ops = {
+    .write_reg  = i2c_bus_esp_write_reg,
+    .read_reg   = i2c_bus_esp_read_reg,
+    .write_regs = i2c_bus_esp_write_regs,
+    .write      = i2c_bus_esp_write,
+    .read       = i2c_bus_esp_read,
+    .writev     = i2c_bus_esp_writev,
+    .write_read = i2c_bus_esp_write_read,
+};
+
+static i2c_bus_t i2c_bus_esp[I2C_BUS_PORT_MAX] = {
+    {&i2c_bus_esp_ops, 0, NULL},
+    {&i2c_bus_esp_ops, 1, NULL},
+};
+
+/**
+ * @brief transport of one hardware port, i2c_master_init must be called before it is used
+ */
+i2c_bus_t *i2c_bus_esp_get(uint8_t i2c_master_num)
+{
+    if (i2c_master_num >= I2C_BUS_PORT_MAX) {
+        return NULL;
+    }
+    return &i2c_bus_esp[i2c_master_num];
+}
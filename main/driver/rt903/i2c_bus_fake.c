@@ -0,0 +1,207 @@
+/*
+ * i2c_bus_fake.c
+ *
+ * In-memory i2c_bus implementation, see i2c_bus_fake.h. Only used by host builds and
+ * benches, the firmware links the ESP implementation.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "i2c_bus_fake.h"
+
+static i2c_fake_dev_t *i2c_fake_find(i2c_fake_bus_t *fake, uint16_t addr)
+{
+    for (uint8_t i = 0; i < fake->dev_cnt; i++) {
+        if (fake->dev[i].addr == addr) {
+            return &fake->dev[i];
+        }
+    }
+    return NULL;
+}
+
+static void i2c_fake_advance(i2c_fake_dev_t *dev)
+{
+    if ((dev->no_inc[dev->ptr >> 3] & (1 << (dev->ptr & 7))) == 0) {
+        dev->ptr++;
+    }
+}
+
+/*
+ * one START..STOP transaction: the write segments go out back to back, then rd_len bytes
+ * are read after a repeated start (or straight away when nothing is written)
+ */
+static int i2c_fake_transfer(i2c_fake_bus_t *fake, uint16_t addr, const i2c_iovec_t *wr, uint8_t wrcnt, uint8_t *rd, uint16_t rd_len)
+{
+    uint32_t wr_len = 0;
+    uint8_t starts = 0;
+    for (uint8_t i = 0; i < wrcnt; i++) {
+        wr_len += wr[i].len;
+    }
+    starts = (wr_len > 0 ? 1 : 0) + (rd_len > 0 ? 1 : 0);
+    fake->trans++;
+    fake->bytes += wr_len + rd_len + starts;
+    fake->wire_us += ((uint64_t)(wr_len + rd_len + starts) * 9 * 1000000 + fake->freq_hz - 1) / fake->freq_hz;
+
+    i2c_fake_dev_t *dev = i2c_fake_find(fake, addr);
+    if (dev == NULL) {
+        fake->errors++;
+        return -1;
+    }
+    dev->trans++;
+    if (dev->fail_next > 0) {
+        dev->fail_next--;
+        dev->errors++;
+        fake->errors++;
+        return -1;
+    }
+    dev->wr_bytes += wr_len;
+    dev->rd_bytes += rd_len;
+
+    if (dev->xfer != NULL) {
+        uint32_t pos = 0;
+        if (wr_len > I2C_FAKE_SCRATCH_SIZE) {
+            fake->errors++;
+            return -1;
+        }
+        for (uint8_t i = 0; i < wrcnt; i++) {
+            memcpy(&fake->scratch[pos], wr[i].buf, wr[i].len);
+            pos += wr[i].len;
+        }
+        if (dev->xfer(dev, fake->scratch, (uint16_t)wr_len, rd, rd_len) != 0) {
+            dev->errors++;
+            fake->errors++;
+            return -1;
+        }
+        return 0;
+    }
+
+    bool first = true;
+    for (uint8_t i = 0; i < wrcnt; i++) {
+        for (uint16_t j = 0; j < wr[i].len; j++) {
+            if (first) {
+                dev->ptr = wr[i].buf[j];
+                first = false;
+            } else {
+                dev->regs[dev->ptr] = wr[i].buf[j];
+                i2c_fake_advance(dev);
+            }
+        }
+    }
+    for (uint16_t j = 0; j < rd_len; j++) {
+        rd[j] = dev->regs[dev->ptr];
+        i2c_fake_advance(dev);
+    }
+    return 0;
+}
+
+static int i2c_fake_write_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, const uint8_t *data, uint16_t len)
+{
+    i2c_iovec_t iov[] = {{&reg, 1}, {data, len}};
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, 2, NULL, 0);
+}
+
+static int i2c_fake_read_reg(i2c_bus_t *bus, uint16_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    i2c_iovec_t iov[] = {{&reg, 1}};
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, 1, data, len);
+}
+
+/* same burst merging and accounting as the ESP batch op */
+static int i2c_fake_write_regs(i2c_bus_t *bus, uint16_t addr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats)
+{
+    uint8_t burst[1 + I2C_FAKE_REG_NUM];
+    uint16_t i = 0;
+    while (i < count) {
+        uint16_t n = 0;
+        burst[0] = regs[i].reg;
+        do {
+            burst[1 + n++] = regs[i++].val;
+        } while (i < count && n < I2C_FAKE_REG_NUM && regs[i].reg == (uint8_t)(regs[i - 1].reg + 1));
+        i2c_iovec_t iov[] = {{burst, n + 1}};
+        if (i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, 1, NULL, 0) != 0) {
+            return -1;
+        }
+        if (stats != NULL) {
+            stats->regs += n;
+            stats->bursts++;
+            stats->wire_bytes += n + 2;
+            stats->single_bytes += 3 * n;
+        }
+    }
+    return 0;
+}
+
+static int i2c_fake_write(i2c_bus_t *bus, uint16_t addr, const uint8_t *data, uint16_t len)
+{
+    i2c_iovec_t iov[] = {{data, len}};
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, 1, NULL, 0);
+}
+
+static int i2c_fake_read(i2c_bus_t *bus, uint16_t addr, uint8_t *data, uint16_t len)
+{
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, NULL, 0, data, len);
+}
+
+static int i2c_fake_writev(i2c_bus_t *bus, uint16_t addr, const i2c_iovec_t *iov, uint8_t iovcnt)
+{
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, iovcnt, NULL, 0);
+}
+
+static int i2c_fake_write_read(i2c_bus_t *bus, uint16_t addr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len)
+{
+    i2c_iovec_t iov[] = {{wr_buf, wr_len}};
+    return i2c_fake_transfer((i2c_fake_bus_t *)bus->ctx, addr, iov, 1, rd_buf, rd_len);
+}
+
+static const i2c_bus_ops_t i2c_fake_ops = {
+    .write_reg  = i2c_fake_write_reg,
+    .read_reg   = i2c_fake_read_reg,
+    .write_regs = i2c_fake_write_regs,
+    .write      = i2c_fake_write,
+    .read       = i2c_fake_read,
+    .writev     = i2c_fake_writev,
+    .write_read = i2c_fake_write_read,
+};
+
+void i2c_fake_bus_init(i2c_fake_bus_t *fake, uint8_t port, uint32_t freq_hz)
+{
+    memset(fake, 0, sizeof(i2c_fake_bus_t));
+    fake->bus.ops = &i2c_fake_ops;
+    fake->bus.port = port;
+    fake->bus.ctx = fake;
+    fake->freq_hz = freq_hz ? freq_hz : 400000;
+}
+
+/**
+ * @brief attach a device with all registers zero, NULL when the bus is full or the address is taken
+ */
+i2c_fake_dev_t *i2c_fake_bus_add(i2c_fake_bus_t *fake, uint16_t addr)
+{
+    if (fake->dev_cnt >= I2C_FAKE_DEV_MAX || i2c_fake_find(fake, addr) != NULL) {
+        return NULL;
+    }
+    i2c_fake_dev_t *dev = &fake->dev[fake->dev_cnt++];
+    memset(dev, 0, sizeof(i2c_fake_dev_t));
+    dev->addr = addr;
+    return dev;
+}
+
+/* FIFO / RAM data registers do not move the register pointer */
+void i2c_fake_dev_set_data_port(i2c_fake_dev_t *dev, uint8_t reg)
+{
+    dev->no_inc[reg >> 3] |= (1 << (reg & 7));
+}
+
+void i2c_fake_bus_reset_counters(i2c_fake_bus_t *fake)
+{
+    fake->trans = 0;
+    fake->bytes = 0;
+    fake->errors = 0;
+    fake->wire_us = 0;
+    for (uint8_t i = 0; i < fake->dev_cnt; i++) {
+        fake->dev[i].trans = 0;
+        fake->dev[i].wr_bytes = 0;
+        fake->dev[i].rd_bytes = 0;
+        fake->dev[i].errors = 0;
+    }
+}
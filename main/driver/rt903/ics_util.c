@@ -2,8 +2,7 @@
 #include "math.h"
 #include <stdint.h>
 #include <stdlib.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
+#include "rt903x_port.h"
 
 const float PI = 3.1415926f;
 static const float lpf_coef[7] =
@@ -16,19 +15,17 @@ static const float lpf_coef[7] =
     0.389661f,
     0.350919f,
 };
-static struct GENERATION_CONFIG generation_config;
-static struct RESAMPLE_CONFIG resample_config;
 
-static void gen_sine_waveform(uint8_t* buf, int16_t size)
+static void gen_sine_waveform(struct GENERATION_CONFIG* gen, uint8_t* buf, int16_t size)
 {
-    double phase_step = 2 * PI * generation_config.frequency / generation_config.sample_rate;
+    double phase_step = 2 * PI * gen->frequency / gen->sample_rate;
     for (int16_t i = 0; i < size; i++)
     {
-        double phase = generation_config.start_phase + phase_step * i;
-        double point_val = sin(phase) * generation_config.amplitude;
+        double phase = gen->start_phase + phase_step * i;
+        double point_val = sin(phase) * gen->amplitude;
         buf[i] = (int8_t)point_val;
     }
-    generation_config.start_phase += phase_step * size;
+    gen->start_phase += phase_step * size;
 }
 
 static void low_pass_filter(float* src_buf, float* dst_buf, int16_t size, enum LOWPASS_FILTER lpf)
@@ -41,18 +38,18 @@ static void low_pass_filter(float* src_buf, float* dst_buf, int16_t size, enum L
     }
 }
 
-static void gen_square_waveform(uint8_t* buf, int16_t size)
+static void gen_square_waveform(struct GENERATION_CONFIG* gen, uint8_t* buf, int16_t size)
 {
-    double phase_step = 2 * PI * generation_config.frequency / generation_config.sample_rate;
+    double phase_step = 2 * PI * gen->frequency / gen->sample_rate;
     for (int16_t i = 0; i < size; i++)
     {
-        double phase = generation_config.start_phase + phase_step * i;
+        double phase = gen->start_phase + phase_step * i;
         int32_t square_val = ((int32_t)floor(phase / PI) % 2) == 0 ? 1 : -1;
-        double point_val = square_val * generation_config.amplitude;
+        double point_val = square_val * gen->amplitude;
         buf[i] = (int8_t)point_val;
     }
-    generation_config.start_phase += phase_step * size;
-    if (generation_config.lpf != LPF_NONE)
+    gen->start_phase += phase_step * size;
+    if (gen->lpf != LPF_NONE)
     {
         float* buf1 = (float*)malloc(sizeof(float) * size);
         float* buf2 = (float*)malloc(sizeof(float) * size);
@@ -60,14 +57,14 @@ static void gen_square_waveform(uint8_t* buf, int16_t size)
         {
             buf1[i] = (float)buf[i];
         }
-        low_pass_filter(buf1, buf2, size, generation_config.lpf);
+        low_pass_filter(buf1, buf2, size, gen->lpf);
         for (int16_t i = 0; i < size/2; i++)
         {
             float t = buf2[i];
             buf2[i] = buf2[size - 1 - i];
             buf2[size - 1 -i] = t;
         }
-        low_pass_filter(buf2, buf1, size, generation_config.lpf);
+        low_pass_filter(buf2, buf1, size, gen->lpf);
         for (int16_t i = 0; i < size/2; i++)
         {
             float t = buf1[i];
@@ -83,35 +80,28 @@ static void gen_square_waveform(uint8_t* buf, int16_t size)
     }
 }
 
-int16_t ics_generation_reset(const struct GENERATION_CONFIG* config)
+/* gen is the generator state: start_phase moves on, so consecutive calls continue the waveform */
+int16_t ics_generation_waveform(struct GENERATION_CONFIG* gen, uint8_t* buf, int16_t size)
 {
-    generation_config = *config;
-    return 0;
-}
-
-int16_t ics_generation_waveform(uint8_t* buf, int16_t size)
-{
-    switch(generation_config.waveform_type)
+    switch(gen->waveform_type)
     {
         case WAVEFORM_SINE:
-            gen_sine_waveform(buf, size);
+            gen_sine_waveform(gen, buf, size);
             break;
         case WAVEFORM_SQUARE:
-            gen_square_waveform(buf, size);
+            gen_square_waveform(gen, buf, size);
             break;
     }
     return 0;
 }
 
-int16_t ics_resample_reset(const struct RESAMPLE_CONFIG* config)
+int16_t ics_resample_waveform(const struct RESAMPLE_CONFIG* config, const uint8_t* src_buf, int16_t src_size, uint8_t* dst_buf, int16_t* dst_size)
 {
-    resample_config = *config;
-    return 0;
-}
-
-int16_t ics_resample_waveform(const uint8_t* src_buf, int16_t src_size, uint8_t* dst_buf, int16_t* dst_size)
-{
-    float g = resample_config.src_f0 / resample_config.dest_f0;
+    if (config->src_f0 <= 0 || config->dest_f0 <= 0)
+    {
+        return -1;
+    }
+    float g = config->src_f0 / config->dest_f0;
     int16_t count = (int16_t)floor((src_size - 1) * g) + 1;
     if (*dst_size < count)
     {
@@ -131,7 +121,6 @@ int16_t ics_resample_waveform(const uint8_t* src_buf, int16_t src_size, uint8_t*
 
 void ics_delay_ms(int16_t ms)
 {
-    // TODO: Following code depends on platform.
-    // Replace it with your platform specific delay implementation.
-	vTaskDelay(pdMS_TO_TICKS(ms));
+    // platform specific part lives in rt903x_port_*.c
+    rt903x_delay_ms((uint32_t)ms);
 }
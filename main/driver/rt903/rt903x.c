@@ -1,18 +1,47 @@
 
 #include "rt903x.h"
 #include "rt903x_reg.h"
+#include "rt903x_stream.h"
 #include "ics_util.h"
-#include <i2c_adapter.h>
+#include "i2c_bus.h"
+#include "rt903x_port.h"
 #include <stdint.h>
+#include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
-#include "esp_log.h"
-#include "esp_err.h"
+#include <string.h>
 
 
 
 static const char *TAG = "rt903-driver";
 
+static int32_t rt903x_bus_write(rt903x_dev_t *dev, uint8_t reg, const void *data, uint16_t len)
+{
+    if (dev->bus == NULL)
+    {
+        return -1;
+    }
+    return dev->bus->ops->write_reg(dev->bus, dev->info.i2c_address, reg, (const uint8_t *)data, len);
+}
+
+static int32_t rt903x_bus_read(rt903x_dev_t *dev, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    if (dev->bus == NULL)
+    {
+        return -1;
+    }
+    return dev->bus->ops->read_reg(dev->bus, dev->info.i2c_address, reg, data, len);
+}
+
+static int32_t rt903x_bus_write_regs(rt903x_dev_t *dev, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats)
+{
+    if (dev->bus == NULL)
+    {
+        return -1;
+    }
+    return dev->bus->ops->write_regs(dev->bus, dev->info.i2c_address, regs, count, stats);
+}
+
 struct FirmwareVersion g_firmwareVersion =
 {
     .major = 1,
@@ -22,10 +51,11 @@ struct FirmwareVersion g_firmwareVersion =
 
 uint32_t g_efuse_v = 0;
 
-struct RT903X_CONFIG rt903x_config =
+/* RAM partition every chip starts with: list at 0x200, waveforms at 0x220, FIFO AE 0x80 / AF 0x180,
+ * see rt903x_ram_partition */
+static const struct RAM_PARAM rt903x_default_ram_param =
 {
-    0, 0, 0, 0, 0, 0,
-    {0x00,0x02,0x20,0x02,0x80,0x00,0x80,0x01}
+    0x00,0x02,0x20,0x02,0x80,0x00,0x80,0x01
 };
 
 const int8_t f0_wave_data[] =
@@ -91,382 +121,2405 @@ wave_des wave_data_list[10]=
 #define F0_LIST_DATA_LEN        sizeof(f0_list_data)
 #define RL_WAVE_DATA_LEN        sizeof(rl_wave_data)
 #define RL_LIST_DATA_LEN        sizeof(rl_list_data)
-#define MAX_RAM_SIZE            0x600    // 1.5K Bytes
+#define MAX_RAM_SIZE            RT903X_RAM_SIZE    // 1.5K Bytes
 #define EFS_BYTE_NUM            4
 
-int32_t rt903x_soft_reset(DEF_RT903_INFO i2c_config)
+/*
+ * Write-through shadow of the writable configuration registers, kept in each rt903x_dev_t.
+ * Writes of an unchanged value are skipped and read-modify-write uses the shadow
+ * instead of the bus. Status, data port, self-clearing and efuse registers are
+ * never cached.
+ * The engine, scheduler, arm and console tasks all reach the same chip, so lookup, bus
+ * access and store of a cacheable register happen under dev->reg_lock; otherwise a write
+ * could be skipped against a value another task is about to replace.
+ */
+static bool rt903x_reg_cacheable(uint8_t reg)
 {
-    uint8_t reg_val = 0x01;
-    return I2CWriteReg(i2c_config.i2c_master_num,  i2c_config.i2c_address, REG_SOFT_RESET, &reg_val, 1);
+    if (reg >= RT903X_SHADOW_REG_NUM)
+    {
+        return false;
+    }
+    switch (reg)
+    {
+        case REG_DEV_ID:
+        case REG_REV_ID:
+        case REG_SOFT_RESET:
+        case REG_SYS_STATUS1:
+        case REG_SYS_STATUS2:
+        case REG_INT_STATUS:
+        case REG_RAM_ADDR_L:        // auto-increments with every RAM_DATA byte
+        case REG_RAM_ADDR_H:
+        case REG_RAM_DATA:
+        case REG_STREAM_DATA:
+        case REG_PLAY_CTRL:         // GO clears itself when playback ends
+        case REG_GPIO_STATUS:
+        case REG_PROTECTION_STATUS1:
+        case REG_PROTECTION_STATUS2:
+        case REG_ERROR_CODE:
+        case REG_TRACK_F0_VAL1:
+        case REG_TRACK_F0_VAL2:
+        case REG_ADC_DATA1:
+        case REG_ADC_DATA2:
+        case REG_EFS_WR_DATA:
+        case REG_EFS_RD_DATA:
+        case REG_EFS_ADDR_INDEX:
+        case REG_EFS_MODE_CTRL:
+            return false;
+        default:
+            return (reg < REG_BEMF_CZ1_VAL1) || (reg > REG_BEMF_CZ5_VAL2);
+    }
 }
 
-int32_t rt903x_init(DEF_RT903_INFO i2c_config)
+static bool rt903x_shadow_lookup(struct RT903X_SHADOW *shadow, uint8_t reg, uint8_t *val)
 {
-    int32_t res = 0;
-    uint8_t reg_val;
-    struct RAM_PARAM *ram_param;
-
-    //check chip id
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_DEV_ID, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    if(CHIP_ID != reg_val){
-    	ESP_LOGI(TAG, "rt903x_init,got a wrong chipid ,please check i2c read & write interface.get chip id :0x%x",reg_val); // rt903 is 0x60
-        ESP_LOGI(TAG, "i2c_config, i2c_config.i2c_master_num:0x%x,i2c_config.i2c_address:0x%x",i2c_config.i2c_master_num, i2c_config.i2c_address);
-    	return -1;
+    if (shadow == NULL || !rt903x_reg_cacheable(reg) || (shadow->valid[reg >> 3] & (1 << (reg & 7))) == 0)
+    {
+        return false;
     }
+    *val = shadow->val[reg];
+    return true;
+}
 
-    rt903x_apply_trim(i2c_config);
-    ram_param = (struct RAM_PARAM*)&rt903x_config.ram_param;
-    reg_val = ram_param->ListBaseAddrL;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_LIST_BASE_ADDR_L, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->ListBaseAddrH;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_LIST_BASE_ADDR_H, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->WaveBaseAddrL;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_WAVE_BASE_ADDR_L, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->WaveBaseAddrH;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_WAVE_BASE_ADDR_H, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->FifoAEL;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_FIFO_AE_L, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->FifoAEH;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_FIFO_AE_H, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->FifoAFL;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_FIFO_AF_L, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = ram_param->FifoAFH;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_FIFO_AF_H, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x08;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x2B;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_LRA_F0_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x05;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_LRA_F0_CFG2, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-
-    ics_delay_ms(1);
+static void rt903x_shadow_store(struct RT903X_SHADOW *shadow, uint8_t reg, uint8_t val)
+{
+    if (shadow == NULL || !rt903x_reg_cacheable(reg))
+    {
+        return;
+    }
+    shadow->val[reg] = val;
+    shadow->valid[reg >> 3] |= (1 << (reg & 7));
+}
 
-    return 0;
+static void rt903x_shadow_forget(struct RT903X_SHADOW *shadow, uint8_t reg)
+{
+    if (shadow == NULL || reg >= RT903X_SHADOW_REG_NUM)
+    {
+        return;
+    }
+    shadow->valid[reg >> 3] &= ~(1 << (reg & 7));
 }
 
-int32_t rt903x_playlist_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size)
+/* drop every cached value, the chip registers are unknown again (reset, protection) */
+void rt903x_shadow_invalidate(rt903x_dev_t *dev)
 {
-    int32_t res = 0;
-    uint8_t reg_val;
-    reg_val = 0x02;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &reg_val, 1);
-    struct RAM_PARAM *ram_param;
-    ram_param = (struct RAM_PARAM*)&rt903x_config.ram_param;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_ADDR_L, &ram_param->ListBaseAddrL, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_ADDR_H, &ram_param->ListBaseAddrH, 1);
-    CHECK_ERROR_RETURN(res);
-    uint32_t copySize = min(size,MAX_RAM_SIZE);
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_DATA, (uint8_t*)buf, copySize);
-    CHECK_ERROR_RETURN(res);
-    return 0;
+    rt903x_mutex_lock(&dev->reg_lock);
+    memset(dev->shadow.valid, 0, sizeof(dev->shadow.valid));
+    rt903x_mutex_unlock(&dev->reg_lock);
 }
 
-int32_t rt903x_waveform_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size)
+int32_t rt903x_read_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t *val)
 {
+    struct RT903X_SHADOW *shadow = &dev->shadow;
+    if (!rt903x_reg_cacheable(reg))
+    {
+        return (rt903x_bus_read(dev, reg, val, 1) < 0) ? -1 : 0;
+    }
+    rt903x_mutex_lock(&dev->reg_lock);
     int32_t res = 0;
-    uint8_t reg_val;
-    reg_val = 0x04;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    struct RAM_PARAM *ram_param;
-    ram_param = (struct RAM_PARAM*)&rt903x_config.ram_param;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_ADDR_L, &ram_param->WaveBaseAddrL, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_ADDR_H, &ram_param->WaveBaseAddrH, 1);
-    CHECK_ERROR_RETURN(res);
-    uint32_t copySize = min(size,MAX_RAM_SIZE);
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_DATA, (uint8_t*)buf, copySize);
-    CHECK_ERROR_RETURN(res);
-    return 0;
+    if (!rt903x_shadow_lookup(shadow, reg, val))
+    {
+        res = rt903x_bus_read(dev, reg, val, 1);
+        if (res >= 0)
+        {
+            rt903x_shadow_store(shadow, reg, *val);
+        }
+    }
+    rt903x_mutex_unlock(&dev->reg_lock);
+    return (res < 0) ? -1 : 0;
 }
 
-int32_t rt903x_stream_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size)
+/* consecutive registers in one auto-increment read, refreshes the shadow of the cacheable ones */
+int32_t rt903x_read_block(rt903x_dev_t *dev, uint8_t reg, uint8_t *buf, uint16_t len)
 {
-    return I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_STREAM_DATA, (uint8_t*)buf, size);
+    if (buf == NULL || len == 0 || (uint16_t)reg + len > 0x100)
+    {
+        return -1;
+    }
+    rt903x_mutex_lock(&dev->reg_lock);
+    int32_t res = rt903x_bus_read(dev, reg, buf, len);
+    for (uint16_t i = 0; res >= 0 && i < len; i++)
+    {
+        rt903x_shadow_store(&dev->shadow, (uint8_t)(reg + i), buf[i]);
+    }
+    rt903x_mutex_unlock(&dev->reg_lock);
+    return (res < 0) ? -1 : 0;
 }
 
-int32_t rt903x_chip_id(DEF_RT903_INFO i2c_config)
+int32_t rt903x_write_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t val)
 {
+    struct RT903X_SHADOW *shadow = &dev->shadow;
+    uint8_t cached;
+    if (!rt903x_reg_cacheable(reg))
+    {
+        return (rt903x_bus_write(dev, reg, &val, 1) < 0) ? -1 : 0;
+    }
+    rt903x_mutex_lock(&dev->reg_lock);
     int32_t res = 0;
-    uint8_t reg_val;
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, 0, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    rt903x_config.chip_id = reg_val;
-    if(CHIP_ID != reg_val)
+    if (!rt903x_shadow_lookup(shadow, reg, &cached) || cached != val)
     {
-        return -2;
+        res = rt903x_bus_write(dev, reg, &val, 1);
+        if (res < 0)
+        {
+            rt903x_shadow_forget(shadow, reg);
+        }
+        else
+        {
+            rt903x_shadow_store(shadow, reg, val);
+        }
     }
-    return 0;
+    rt903x_mutex_unlock(&dev->reg_lock);
+    return (res < 0) ? -1 : 0;
 }
 
-int32_t rt903x_clear_int(DEF_RT903_INFO i2c_config)
+/* read-modify-write as one step, the recursive lock spans the read and the write */
+int32_t rt903x_update_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t mask, uint8_t val)
 {
     uint8_t reg_val;
-    return I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_INT_STATUS, &reg_val, 1);
+    rt903x_mutex_lock(&dev->reg_lock);
+    int32_t res = rt903x_read_reg(dev, reg, &reg_val);
+    if (res >= 0)
+    {
+        reg_val = (reg_val & ~mask) | (val & mask);
+        res = rt903x_write_reg(dev, reg, reg_val);
+    }
+    rt903x_mutex_unlock(&dev->reg_lock);
+    return res;
+}
+
+/* flush the dirty entries as one batched command link, the shadow follows what reached the chip */
+static int32_t rt903x_write_regs_flush(rt903x_dev_t *dev, const i2c_reg_val_t *dirty, uint16_t dirty_cnt,
+                                       i2c_batch_stats_t *stats)
+{
+    int32_t res = rt903x_bus_write_regs(dev, dirty, dirty_cnt, stats);
+    for (uint16_t i = 0; i < dirty_cnt; i++)
+    {
+        if (res < 0)
+        {
+            rt903x_shadow_forget(&dev->shadow, dirty[i].reg);
+        }
+        else
+        {
+            rt903x_shadow_store(&dev->shadow, dirty[i].reg, dirty[i].val);
+        }
+    }
+    return res;
 }
 
-int32_t rt903x_clear_protection(DEF_RT903_INFO i2c_config)
+/* write a register sequence as batched command links of up to I2C_BATCH_MAX_REGS and report
+ * its bus cost, entries already holding the requested value are dropped from the batch */
+static int32_t rt903x_write_regs(rt903x_dev_t *dev, const char *seq_name, const i2c_reg_val_t *regs, uint16_t count)
 {
+    struct RT903X_SHADOW *shadow = &dev->shadow;
+    i2c_reg_val_t dirty[I2C_BATCH_MAX_REGS];
+    i2c_batch_stats_t stats = {0};
+    uint16_t dirty_cnt = 0;
+    uint8_t cached;
     int32_t res = 0;
-    uint8_t reg_val = 0;
 
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG2, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val |= 0x02;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG2, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val &= 0xfd;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG2, &reg_val, 1);
+    rt903x_mutex_lock(&dev->reg_lock);
+    for (uint16_t i = 0; i < count && res >= 0; i++)
+    {
+        if (rt903x_shadow_lookup(shadow, regs[i].reg, &cached) && cached == regs[i].val)
+        {
+            continue;
+        }
+        dirty[dirty_cnt++] = regs[i];
+        if (dirty_cnt == I2C_BATCH_MAX_REGS)
+        {
+            // 超过一个 batch 的序列分段写，一段失败就停，后面的不再写
+            res = rt903x_write_regs_flush(dev, dirty, dirty_cnt, &stats);
+            dirty_cnt = 0;
+        }
+    }
+    if (res >= 0 && dirty_cnt > 0)
+    {
+        res = rt903x_write_regs_flush(dev, dirty, dirty_cnt, &stats);
+    }
+    rt903x_mutex_unlock(&dev->reg_lock);
     CHECK_ERROR_RETURN(res);
-
+    RT903X_LOGD(TAG, "%s(0x%x): %d/%d regs in %d bursts, %d bytes on the wire (%d as single writes)", seq_name,
+             dev->info.i2c_address, stats.regs, count, stats.bursts, (int)stats.wire_bytes, (int)stats.single_bytes);
     return 0;
 }
 
-int32_t rt903x_boost_voltage(DEF_RT903_INFO i2c_config, RT903X_BOOST_VOLTAGE vout)
+/*
+ * bus speed probe: chip id plus a write/readback of complementary patterns on GAIN_CFG,
+ * the original value is restored so the shadow stays valid
+ */
+int rt903x_speed_check(uint8_t i2c_master_num, uint16_t devAddr, void *arg)
 {
+    static const uint8_t pattern[] = {0xA5, 0x5A};
+    rt903x_dev_t *dev = (rt903x_dev_t *)arg;
+    uint8_t reg_val = 0, orig = 0;
     int32_t res = 0;
-    uint8_t reg_val;
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG3, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = (reg_val & 0xF0) | ((uint8_t)vout & 0x0F);
-    return I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG3, &reg_val, 1);
+
+    res = rt903x_bus_read(dev, REG_DEV_ID, &reg_val, 1);
+    if (res < 0 || reg_val != CHIP_ID)
+    {
+        return -1;
+    }
+    rt903x_mutex_lock(&dev->reg_lock);
+    res = rt903x_bus_read(dev, REG_GAIN_CFG, &orig, 1);
+    if (res < 0)
+    {
+        rt903x_mutex_unlock(&dev->reg_lock);
+        return -1;
+    }
+    for (uint8_t i = 0; i < ARRAY_SIZE(pattern) && res == 0; i++)
+    {
+        reg_val = pattern[i];
+        res = rt903x_bus_write(dev, REG_GAIN_CFG, &reg_val, 1);
+        if (res == 0)
+        {
+            res = rt903x_bus_read(dev, REG_GAIN_CFG, &reg_val, 1);
+        }
+        if (res == 0 && reg_val != pattern[i])
+        {
+            res = -1;
+        }
+    }
+    if (rt903x_bus_write(dev, REG_GAIN_CFG, &orig, 1) < 0)
+    {
+        rt903x_shadow_forget(&dev->shadow, REG_GAIN_CFG);
+        res = -1;
+    }
+    rt903x_mutex_unlock(&dev->reg_lock);
+    return res;
 }
 
-int32_t rt903x_gain(DEF_RT903_INFO i2c_config, uint8_t gain)
+/**
+ * @brief bind a chip handle to its bus, every other rt903x_* call takes the handle.
+ *        f0, trims, RAM layout, shadow and play state are per chip, so chips can be
+ *        calibrated and played from different tasks.
+ */
+void rt903x_dev_init(rt903x_dev_t *dev, DEF_RT903_INFO info, i2c_bus_t *bus)
 {
-    return I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_GAIN_CFG, &gain, 1);
+    memset(dev, 0, sizeof(rt903x_dev_t));
+    dev->info = info;
+    dev->bus = bus;
+    dev->config.ram_param = rt903x_default_ram_param;
+    rt903x_mutex_init(&dev->arm_lock, false);
+    rt903x_mutex_init(&dev->reg_lock, true);
 }
 
-int32_t rt903x_play_mode(DEF_RT903_INFO i2c_config, RT903X_PLAY_MODE mode)
+int32_t rt903x_soft_reset(rt903x_dev_t *dev)
 {
-    uint8_t reg_val = (uint8_t)mode;
-    return I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PLAY_MODE, &reg_val, 1);
+    rt903x_shadow_invalidate(dev);
+    rt903x_ram_forget(dev);
+    memset(&dev->gpio_trig, 0, sizeof(dev->gpio_trig));
+    return rt903x_write_reg(dev, REG_SOFT_RESET, 0x01);
 }
 
-static int32_t rt903x_efuse_read(DEF_RT903_INFO i2c_config, uint8_t index, uint8_t *data)
+int32_t rt903x_init(rt903x_dev_t *dev)
 {
     int32_t res = 0;
     uint8_t reg_val;
-    reg_val = index;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_EFS_ADDR_INDEX, &reg_val, 1);
+    struct RAM_PARAM *ram_param;
+
+    //check chip id
+    res = rt903x_bus_read(dev, REG_DEV_ID, &reg_val, 1);
     CHECK_ERROR_RETURN(res);
-    reg_val = BIT_EFS_READ;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_EFS_MODE_CTRL, &reg_val, 1);
+    if(CHIP_ID != reg_val){
+    	RT903X_LOGI(TAG, "rt903x_init,got a wrong chipid ,please check i2c read & write interface.get chip id :0x%x",reg_val); // rt903 is 0x60
+        RT903X_LOGI(TAG, "dev, i2c_master_num:0x%x,i2c_address:0x%x",dev->info.i2c_master_num, dev->info.i2c_address);
+    	return -1;
+    }
+
+    rt903x_apply_trim(dev);
+    ram_param = (struct RAM_PARAM*)&dev->config.ram_param;
+    const i2c_reg_val_t init_regs[] =
+    {
+        {REG_RAM_CFG,           0x08},
+        {REG_FIFO_AE_L,         ram_param->FifoAEL},
+        {REG_FIFO_AE_H,         ram_param->FifoAEH},
+        {REG_FIFO_AF_L,         ram_param->FifoAFL},
+        {REG_FIFO_AF_H,         ram_param->FifoAFH},
+        {REG_WAVE_BASE_ADDR_L,  ram_param->WaveBaseAddrL},
+        {REG_WAVE_BASE_ADDR_H,  ram_param->WaveBaseAddrH},
+        {REG_LIST_BASE_ADDR_L,  ram_param->ListBaseAddrL},
+        {REG_LIST_BASE_ADDR_H,  ram_param->ListBaseAddrH},
+        {REG_LRA_F0_CFG1,       0x2B},
+        {REG_LRA_F0_CFG2,       0x05},
+    };
+    res = rt903x_write_regs(dev, "init", init_regs, ARRAY_SIZE(init_regs));
     CHECK_ERROR_RETURN(res);
+
     ics_delay_ms(1);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_EFS_MODE_CTRL, &reg_val, 1);
+
+    return 0;
+}
+
+int32_t rt903x_playlist_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size)
+{
+    int32_t res = 0;
+    struct RAM_PARAM *ram_param;
+    ram_param = (struct RAM_PARAM*)&dev->config.ram_param;
+    const i2c_reg_val_t addr_regs[] =
+    {
+        {REG_RAM_CFG,       0x02},
+        {REG_RAM_ADDR_L,    ram_param->ListBaseAddrL},
+        {REG_RAM_ADDR_H,    ram_param->ListBaseAddrH},
+    };
+    dev->ram.list_loaded = false;
+    res = rt903x_write_regs(dev, "playlist", addr_regs, ARRAY_SIZE(addr_regs));
     CHECK_ERROR_RETURN(res);
-    if ((reg_val & BIT_EFS_READ) == 0)
+    uint32_t copySize = min(size,MAX_RAM_SIZE - ((ram_param->ListBaseAddrH << 8) | ram_param->ListBaseAddrL));
+    res = rt903x_bus_write(dev, REG_RAM_DATA, buf, copySize);
+    CHECK_ERROR_RETURN(res);
+    return 0;
+}
+
+/* trigger inputs off and entries cleared, see rt903x_gpio_trig_bind */
+static int32_t rt903x_gpio_trig_release(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    for (uint8_t i = 0; i < RT903X_GPIO_TRIG_NUM; i++)
     {
-        res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_EFS_RD_DATA, &reg_val, 1);
+        const i2c_reg_val_t gpio_regs[] =
+        {
+            {REG_GPIO_CFG1 + i,             0x00},
+            {REG_GPIO1_POS_ENTRY + 2 * i,   GPIO_ENTRY_NONE},
+            {REG_GPIO1_NEG_ENTRY + 2 * i,   GPIO_ENTRY_NONE},
+        };
+        res = rt903x_write_regs(dev, "gpio_unbind", gpio_regs, ARRAY_SIZE(gpio_regs));
         CHECK_ERROR_RETURN(res);
-        *data = (uint8_t)reg_val;
-        return 1;
     }
+    memset(&dev->gpio_trig, 0, sizeof(dev->gpio_trig));
     return 0;
 }
 
-int32_t rt903x_apply_trim(DEF_RT903_INFO i2c_config)
+int32_t rt903x_waveform_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size)
 {
     int32_t res = 0;
-    uint8_t reg_val;
-    uint32_t efs_data;
-    uint8_t trim_val, *efs_data_p;
-    /* soft reset */
-    reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_SOFT_RESET, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    /* read out trim data from efuse */
-    efs_data_p = (uint8_t*)&efs_data;
-    for(int32_t i = 0; i < 4; ++i)
+    struct RAM_PARAM *ram_param;
+    ram_param = (struct RAM_PARAM*)&dev->config.ram_param;
+    // 覆盖波形区，常驻的效果全部失效，WAVE_BASE 指回区首；触发脚绑定的表也被覆盖，先解绑
+    rt903x_ram_forget(dev);
+    if (dev->gpio_trig.bound)
     {
-        res = rt903x_efuse_read(i2c_config, i, efs_data_p + i);
+        RT903X_LOGW(TAG, "waveform_data: overwriting the gpio trigger table, inputs unbound");
+        res = rt903x_gpio_trig_release(dev);
         CHECK_ERROR_RETURN(res);
     }
-    /* apply trim data */
-    trim_val = (efs_data & EFS_OSC_LDO_TRIM_MASK) >> EFS_OSC_LDO_TRIM_OFFSET;
-    reg_val = trim_val << 6;
-    trim_val = (efs_data & EFS_PMU_LDO_TRIM_MASK) >> EFS_PMU_LDO_TRIM_OFFSET;
-    reg_val |= (trim_val << 4);
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PMU_CFG3, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    trim_val = (efs_data & EFS_BIAS_1P2V_TRIM_MASK) >> EFS_BIAS_1P2V_TRIM_OFFSET;
-    reg_val = trim_val << 4;
-    trim_val = (efs_data & EFS_BIAS_I_TRIM_MASK) >> EFS_BIAS_I_TRIM_OFFSET;
-    reg_val |= trim_val;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PMU_CFG4, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    trim_val = (efs_data & EFS_OSC_TRIM_MASK) >> EFS_OSC_TRIM_OFFSET;
-    trim_val ^= 0x80;
-    reg_val = trim_val;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_OSC_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x0F;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, 0x2A, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x00;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG2, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x05;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG2, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x0A;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG3, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x50;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG4, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x1C;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BOOST_CFG5, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x2C;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PA_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x03;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PA_CFG2, &reg_val, 1);
+    const i2c_reg_val_t addr_regs[] =
+    {
+        {REG_WAVE_BASE_ADDR_L,  ram_param->WaveBaseAddrL},
+        {REG_WAVE_BASE_ADDR_H,  ram_param->WaveBaseAddrH},
+        {REG_RAM_CFG,           0x04},
+        {REG_RAM_ADDR_L,        ram_param->WaveBaseAddrL},
+        {REG_RAM_ADDR_H,        ram_param->WaveBaseAddrH},
+    };
+    res = rt903x_write_regs(dev, "waveform", addr_regs, ARRAY_SIZE(addr_regs));
     CHECK_ERROR_RETURN(res);
-    reg_val = 0x1C;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PMU_CFG2, &reg_val, 1);
+    uint32_t copySize = min(size,MAX_RAM_SIZE - ((ram_param->WaveBaseAddrH << 8) | ram_param->WaveBaseAddrL));
+    res = rt903x_bus_write(dev, REG_RAM_DATA, buf, copySize);
     CHECK_ERROR_RETURN(res);
-//    trim_val = (efs_data & EFS_VBAT_DET_TRIM_MASK) >> EFS_VBAT_DET_TRIM_OFFSET;
-//    int32_t offset_val = (trim_val & 0x0F) * 313;
-//    if ((trim_val & 0x10) != 0)
-//    {
-//        offset_val = 0 - offset_val;
-//    }
-//    rt903x_config.vbat_det_trim = offset_val - 1740;
-//    rt903x_config.rl_det_trim = (efs_data & EFS_RL_DET_TRIM_MASK) >> EFS_RL_DET_TRIM_OFFSET;
+    return 0;
+}
 
+/*
+ * Waveform residency. Each effect keeps its 4 byte header + samples at its own address in
+ * the waveform area (WAVE_BASE .. end of RAM), with the header start address patched to
+ * match. The playlist always plays table entry 1 at WAVE_BASE, so selecting an effect is
+ * a WAVE_BASE write, skipped by the shadow when it is already selected. Effects are
+ * packed first fit, the least recently used ones are evicted when nothing fits.
+ */
+static const uint8_t rt903x_ram_list_data[] = {1,0,1,0};
 
-    return 0;
+void rt903x_ram_forget(rt903x_dev_t *dev)
+{
+    memset(&dev->ram, 0, sizeof(dev->ram));
 }
 
-int32_t rt903x_go(DEF_RT903_INFO i2c_config, uint8_t val)
+static uint16_t rt903x_ram_wave_base(rt903x_dev_t *dev)
 {
-    return I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PLAY_CTRL, &val, 1);
+    return (dev->config.ram_param.WaveBaseAddrH << 8) | dev->config.ram_param.WaveBaseAddrL;
 }
 
-int32_t rt903x_calc_f0(DEF_RT903_INFO i2c_config)
+/* the FIFO ends where the playlist starts */
+uint16_t rt903x_ram_fifo_size(rt903x_dev_t *dev)
 {
-    int32_t res = 0;
-    uint8_t reg_val1, reg_val2;
-    uint16_t cz_val1 = 0, cz_val2 = 0, cz_val3 = 0, cz_val4 = 0, cz_val5 = 0;
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ1_VAL1, &reg_val1, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ1_VAL2, &reg_val2, 1);
-    CHECK_ERROR_RETURN(res);
-    cz_val1 = (uint16_t)(reg_val2 & 0x3F);
-    cz_val1 = (uint16_t)((cz_val1 << 8) | reg_val1);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ2_VAL1, &reg_val1, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ2_VAL2, &reg_val2, 1);
-    CHECK_ERROR_RETURN(res);
-    cz_val2 = (uint16_t)(reg_val2 & 0x3F);
-    cz_val2 = (uint16_t)((cz_val2 << 8) | reg_val1);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ3_VAL1, &reg_val1, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ3_VAL2, &reg_val2, 1);
-    CHECK_ERROR_RETURN(res);
-    cz_val3 = (uint16_t)(reg_val2 & 0x3F);
-    cz_val3 = (uint16_t)((cz_val3 << 8) | reg_val1);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ4_VAL1, &reg_val1, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ4_VAL2, &reg_val2, 1);
-    CHECK_ERROR_RETURN(res);
-    cz_val4 = (uint16_t)(reg_val2 & 0x3F);
-    cz_val4 = (uint16_t)((cz_val4 << 8) | reg_val1);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ5_VAL1, &reg_val1, 1);
-    CHECK_ERROR_RETURN(res);
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CZ5_VAL2, &reg_val2, 1);
-    CHECK_ERROR_RETURN(res);
-    cz_val5 = (uint16_t)(reg_val2 & 0x3F);
-    cz_val5 = (uint16_t)((cz_val5 << 8) | reg_val1);
-    rt903x_config.f0 = ((cz_val4 - cz_val2) + (cz_val5 - cz_val3)) >> 1;
-    rt903x_config.f0 = 192000 / rt903x_config.f0;
+    return (dev->config.ram_param.ListBaseAddrH << 8) | dev->config.ram_param.ListBaseAddrL;
+}
 
-    return res;
+uint16_t rt903x_ram_refill_size(rt903x_dev_t *dev)
+{
+    return rt903x_ram_fifo_size(dev) - ((dev->config.ram_param.FifoAEH << 8) | dev->config.ram_param.FifoAEL);
 }
 
-int32_t rt903x_detect_f0(DEF_RT903_INFO i2c_config)
+/* a stream owns FIFO mode and GO until it ends and claims the chip under arm_lock,
+ * so a check made under that lock holds until the lock is released */
+static bool rt903x_ram_streaming(rt903x_dev_t *dev, const char *what)
 {
-    int32_t res = 0;
-    uint8_t reg_val;
-    // Clear all interruptions
-    res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_INT_STATUS, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    // Fill the list data and waveform data
-    res = rt903x_playlist_data(i2c_config, f0_list_data,F0_LIST_DATA_LEN);
-    CHECK_ERROR_RETURN(res)
-    res = rt903x_waveform_data(i2c_config, (const uint8_t*)f0_wave_data,F0_WAVE_DATA_LEN);
-    CHECK_ERROR_RETURN(res)
-    reg_val = 0x20;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_GAIN_CFG, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x00;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BRAKE_CFG1, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x1;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_DETECT_F0_CFG, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x26;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG3, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x20;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_BEMF_CFG4, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PLAY_MODE, &reg_val, 1);
-    CHECK_ERROR_RETURN(res);
-    res = rt903x_go(i2c_config, 1);
-    CHECK_ERROR_RETURN(res);
-    //  这里存在死循环，需要加retry count来 break
-    while (1)
+    if (!rt903x_stream_busy(dev))
     {
-        res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PLAY_CTRL, &reg_val, 1);
-        CHECK_ERROR_RETURN(res);
-        if (reg_val == 0)
-        {
-            break;
-        }
-        ics_delay_ms(1);
+        return false;
     }
+    RT903X_LOGW(TAG, "%s: i2c%d 0x%02x is streaming", what, dev->info.i2c_master_num, dev->info.i2c_address);
+    return true;
+}
 
-    ics_delay_ms(20);
-    res = rt903x_calc_f0(i2c_config);
-    CHECK_ERROR_RETURN(res);
+/**
+ * @brief move the FIFO / playlist / waveform boundaries of one chip.
+ *        Resident effects and the trigger table sit at addresses that move, so they are
+ *        dropped and come back on their next load; the new split lives in ram_param and
+ *        every size computed from it (FIFO prime and refill, list capacity, waveform fit)
+ *        follows at once.
+ */
+int32_t rt903x_ram_partition(rt903x_dev_t *dev, uint16_t fifo_size, uint16_t fifo_ae, uint16_t fifo_af)
+{
+    int32_t res = 0;
+    if (fifo_ae == 0 && fifo_af == 0)
+    {
+        fifo_ae = fifo_size / 4;
+        fifo_af = fifo_size / 4 * 3;
+    }
+    if (fifo_size % RT903X_RAM_ALIGN != 0 || fifo_size < RT903X_FIFO_SIZE_MIN
+        || fifo_size > RT903X_RAM_SIZE - RT903X_LIST_AREA_SIZE - RT903X_WAVE_AREA_MIN
+        || fifo_ae == 0 || fifo_ae >= fifo_af || fifo_af >= fifo_size)
+    {
+        RT903X_LOGE(TAG, "ram_partition: fifo 0x%x ae 0x%x af 0x%x rejected", fifo_size, fifo_ae, fifo_af);
+        return -1;
+    }
+    uint16_t list_base = fifo_size;
+    uint16_t wave_base = fifo_size + RT903X_LIST_AREA_SIZE;
+    struct RAM_PARAM ram_param =
+    {
+        (uint8_t)(list_base & 0xFF), (uint8_t)(list_base >> 8),
+        (uint8_t)(wave_base & 0xFF), (uint8_t)(wave_base >> 8),
+        (uint8_t)(fifo_ae & 0xFF), (uint8_t)(fifo_ae >> 8),
+        (uint8_t)(fifo_af & 0xFF), (uint8_t)(fifo_af >> 8),
+    };
+    const i2c_reg_val_t part_regs[] =
+    {
+        {REG_FIFO_AE_L,         ram_param.FifoAEL},
+        {REG_FIFO_AE_H,         ram_param.FifoAEH},
+        {REG_FIFO_AF_L,         ram_param.FifoAFL},
+        {REG_FIFO_AF_H,         ram_param.FifoAFH},
+        {REG_WAVE_BASE_ADDR_L,  ram_param.WaveBaseAddrL},
+        {REG_WAVE_BASE_ADDR_H,  ram_param.WaveBaseAddrH},
+        {REG_LIST_BASE_ADDR_L,  ram_param.ListBaseAddrL},
+        {REG_LIST_BASE_ADDR_H,  ram_param.ListBaseAddrH},
+    };
 
-    return 0;
+    rt903x_mutex_lock(&dev->arm_lock);
+    if (rt903x_ram_streaming(dev, "ram_partition"))
+    {
+        rt903x_mutex_unlock(&dev->arm_lock);
+        return -1;
+    }
+    res = rt903x_go(dev, 0);
+    if (res >= 0 && dev->gpio_trig.bound)
+    {
+        RT903X_LOGW(TAG, "ram_partition: gpio trigger table moved, inputs unbound");
+        res = rt903x_gpio_trig_release(dev);
+    }
+    if (res >= 0)
+    {
+        rt903x_ram_forget(dev);
+        res = rt903x_write_regs(dev, "ram_partition", part_regs, ARRAY_SIZE(part_regs));
+    }
+    if (res >= 0)
+    {
+        dev->config.ram_param = ram_param;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return (res < 0) ? -1 : 0;
 }
 
-static int32_t check_stream_play_status(DEF_RT903_INFO i2c_config)
+static struct RT903X_RAM_SLOT *rt903x_ram_find(rt903x_dev_t *dev, const uint8_t *wave)
 {
-    uint8_t reg_val = 0;
-    while (1)
+    for (uint8_t i = 0; i < dev->ram.cnt; i++)
     {
-        int16_t res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_INT_STATUS, &reg_val, 1);
-        CHECK_ERROR_RETURN(res);
-        if ((reg_val & BIT_INTS_PLAYDONE) > 0)
+        if (dev->ram.slot[i].wave == wave)
         {
-            return 1;
+            return &dev->ram.slot[i];
+        }
+    }
+    return NULL;
+}
+
+static void rt903x_ram_evict_lru(rt903x_dev_t *dev)
+{
+    uint8_t lru = 0;
+    for (uint8_t i = 1; i < dev->ram.cnt; i++)
+    {
+        if (dev->ram.slot[i].last_use < dev->ram.slot[lru].last_use)
+        {
+            lru = i;
+        }
+    }
+    dev->ram.slot[lru] = dev->ram.slot[--dev->ram.cnt];
+    dev->ram.evictions++;
+}
+
+/* first gap of len bytes between the resident effects, -1 if none */
+static int32_t rt903x_ram_fit(rt903x_dev_t *dev, uint16_t len)
+{
+    uint16_t start = rt903x_ram_wave_base(dev);
+    while (start + len <= MAX_RAM_SIZE)
+    {
+        uint16_t next = start;
+        for (uint8_t i = 0; i < dev->ram.cnt; i++)
+        {
+            struct RT903X_RAM_SLOT *slot = &dev->ram.slot[i];
+            if (slot->addr < start + len && start < slot->addr + slot->len)
+            {
+                next = slot->addr + slot->len;
+                break;
+            }
+        }
+        if (next == start)
+        {
+            return start;
+        }
+        start = next;
+    }
+    return -1;
+}
+
+/* room for len bytes, evicting the least recently used effects; playback is stopped before RAM is rewritten */
+static int32_t rt903x_ram_reserve(rt903x_dev_t *dev, uint16_t len)
+{
+    int32_t addr;
+    if (rt903x_ram_streaming(dev, "ram_reserve"))
+    {
+        return -1;
+    }
+    while (((addr = rt903x_ram_fit(dev, len)) < 0 || dev->ram.cnt >= RT903X_RAM_SLOT_MAX)
+           && dev->ram.cnt > 0)
+    {
+        rt903x_ram_evict_lru(dev);
+    }
+    if (addr < 0)
+    {
+        return -1;
+    }
+    if (dev->playing)
+    {
+        rt903x_go(dev, 0);
+    }
+    return addr;
+}
+
+static struct RT903X_RAM_SLOT *rt903x_ram_add(rt903x_dev_t *dev, const uint8_t *wave, uint16_t len, uint16_t addr)
+{
+    struct RT903X_RAM_SLOT *slot = &dev->ram.slot[dev->ram.cnt++];
+    slot->wave = wave;
+    slot->len = len;
+    slot->addr = addr;
+    dev->ram.uploads++;
+    return slot;
+}
+
+static int32_t rt903x_ram_upload(rt903x_dev_t *dev, const uint8_t *wave, uint16_t len, uint16_t addr)
+{
+    static const uint8_t ram_reg = REG_RAM_DATA;
+    uint16_t sample_addr = addr + RT903X_WAVE_HDR_LEN;
+    uint8_t hdr[RT903X_WAVE_HDR_LEN] = {(uint8_t)(sample_addr >> 8), (uint8_t)sample_addr, wave[2], wave[3]};
+    const i2c_reg_val_t addr_regs[] =
+    {
+        {REG_RAM_CFG,       0x04},
+        {REG_RAM_ADDR_L,    (uint8_t)addr},
+        {REG_RAM_ADDR_H,    (uint8_t)(addr >> 8)},
+    };
+    int32_t res = rt903x_write_regs(dev, "ram_upload", addr_regs, ARRAY_SIZE(addr_regs));
+    CHECK_ERROR_RETURN(res);
+    const i2c_iovec_t seg[] =
+    {
+        {&ram_reg, 1},
+        {hdr, RT903X_WAVE_HDR_LEN},
+        {wave + RT903X_WAVE_HDR_LEN, (uint16_t)(len - RT903X_WAVE_HDR_LEN)},
+    };
+    if (dev->bus == NULL)
+    {
+        return -1;
+    }
+    return dev->bus->ops->writev(dev->bus, dev->info.i2c_address, seg, ARRAY_SIZE(seg));
+}
+
+/**
+ * @brief make an effect resident and select it for the next RAM play
+ * @param wave effect data including its 4 byte header, identified by this pointer
+ * @return 1 the effect was uploaded, 0 it was already resident, -1 error
+ */
+int32_t rt903x_ram_load(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len)
+{
+    int32_t res = 0;
+    int32_t uploaded = 0;
+    if (wave == NULL || len <= RT903X_WAVE_HDR_LEN || rt903x_ram_streaming(dev, "ram_load"))
+    {
+        return -1;
+    }
+    if (dev->gpio_trig.bound)
+    {
+        RT903X_LOGW(TAG, "ram_load: waveform area holds the gpio trigger table, unbind first");
+        return -1;
+    }
+    struct RT903X_RAM_SLOT *slot = rt903x_ram_find(dev, wave);
+    uint16_t wave_base = rt903x_ram_wave_base(dev);
+    if (slot == NULL && len > MAX_RAM_SIZE - wave_base)
+    {
+        // 比整个波形区还大，按原来的方式从区首覆盖写
+        if (dev->playing)
+        {
+            rt903x_go(dev, 0);
+        }
+        res = rt903x_waveform_data(dev, wave, len);
+        CHECK_ERROR_RETURN(res);
+        res = rt903x_playlist_data(dev, rt903x_ram_list_data, sizeof(rt903x_ram_list_data));
+        CHECK_ERROR_RETURN(res);
+        dev->ram.list_loaded = true;
+        return 1;
+    }
+    if (slot == NULL)
+    {
+        int32_t addr = rt903x_ram_reserve(dev, (uint16_t)len);
+        CHECK_ERROR_RETURN(addr);
+        res = rt903x_ram_upload(dev, wave, (uint16_t)len, (uint16_t)addr);
+        CHECK_ERROR_RETURN(res);
+        slot = rt903x_ram_add(dev, wave, (uint16_t)len, (uint16_t)addr);
+        uploaded = 1;
+    }
+    else
+    {
+        dev->ram.hits++;
+    }
+    slot->last_use = ++dev->ram.tick;
+
+    if (!dev->ram.list_loaded)
+    {
+        res = rt903x_playlist_data(dev, rt903x_ram_list_data, sizeof(rt903x_ram_list_data));
+        CHECK_ERROR_RETURN(res);
+        dev->ram.list_loaded = true;
+    }
+    uint8_t base_l = 0, base_h = 0;
+    if (dev->playing && (rt903x_read_reg(dev, REG_WAVE_BASE_ADDR_L, &base_l) < 0
+                         || rt903x_read_reg(dev, REG_WAVE_BASE_ADDR_H, &base_h) < 0
+                         || ((base_h << 8) | base_l) != slot->addr))
+    {
+        // 换波形前先停，重复播放同一个效果不需要
+        rt903x_go(dev, 0);
+    }
+    const i2c_reg_val_t select_regs[] =
+    {
+        {REG_WAVE_BASE_ADDR_L,  (uint8_t)slot->addr},
+        {REG_WAVE_BASE_ADDR_H,  (uint8_t)(slot->addr >> 8)},
+    };
+    res = rt903x_write_regs(dev, "ram_select", select_regs, ARRAY_SIZE(select_regs));
+    CHECK_ERROR_RETURN(res);
+    return uploaded;
+}
+
+bool rt903x_ram_armed(rt903x_dev_t *dev, const uint8_t *wave, uint8_t gain, RT903X_BOOST_VOLTAGE vout)
+{
+    struct RT903X_RAM_SLOT *slot = rt903x_ram_find(dev, wave);
+    uint8_t base_l, base_h, mode, cur_gain, boost_cfg3;
+    if (slot == NULL || !dev->ram.list_loaded
+        || !rt903x_shadow_lookup(&dev->shadow, REG_WAVE_BASE_ADDR_L, &base_l)
+        || !rt903x_shadow_lookup(&dev->shadow, REG_WAVE_BASE_ADDR_H, &base_h)
+        || !rt903x_shadow_lookup(&dev->shadow, REG_PLAY_MODE, &mode)
+        || !rt903x_shadow_lookup(&dev->shadow, REG_GAIN_CFG, &cur_gain)
+        || !rt903x_shadow_lookup(&dev->shadow, REG_BOOST_CFG3, &boost_cfg3))
+    {
+        return false;
+    }
+    return ((base_h << 8) | base_l) == slot->addr
+        && mode == (uint8_t)MODE_RAM_PLAY
+        && cur_gain == rt903x_prot_gain(dev, gain)
+        && (boost_cfg3 & 0x0F) == ((uint8_t)vout & 0x0F);
+}
+
+static int32_t rt903x_ram_arm_locked(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain,
+                                     RT903X_BOOST_VOLTAGE vout)
+{
+    int32_t loaded = rt903x_ram_load(dev, wave, len);
+    CHECK_ERROR_RETURN(loaded);
+    int32_t res = rt903x_play_setup(dev, MODE_RAM_PLAY, gain, vout);
+    CHECK_ERROR_RETURN(res);
+    if (loaded > 0)
+    {
+        ics_delay_ms(1);
+    }
+    return loaded;
+}
+
+/**
+ * @brief prepare an effect so the next press is a single GO write
+ * @return 1 uploaded, 0 already resident, -1 error
+ */
+int32_t rt903x_ram_arm(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain, RT903X_BOOST_VOLTAGE vout)
+{
+    rt903x_mutex_lock(&dev->arm_lock);
+    int32_t res = rt903x_ram_arm_locked(dev, wave, len, gain, vout);
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+int32_t rt903x_ram_trigger(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain,
+                           RT903X_BOOST_VOLTAGE vout, bool *was_armed)
+{
+    int32_t res = 0;
+    rt903x_mutex_lock(&dev->arm_lock);
+    bool armed = rt903x_ram_armed(dev, wave, gain, vout);
+    if (!armed)
+    {
+        res = rt903x_ram_arm_locked(dev, wave, len, gain, vout);
+    }
+    if (res >= 0)
+    {
+        res = rt903x_go(dev, 1);
+    }
+    if (armed)
+    {
+        dev->trig_armed++;
+    }
+    else
+    {
+        dev->trig_cold++;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    if (was_armed != NULL)
+    {
+        *was_armed = armed;
+    }
+    return (res < 0) ? -1 : 0;
+}
+
+#define RT903X_ARM_EVT_REQ      (1 << 0)
+
+static rt903x_task_t rt903x_arm_task_handle = NULL;
+static bool rt903x_arm_task_started = false;
+static rt903x_dev_t *rt903x_arm_devs[RT903X_ARM_DEV_MAX];
+static rt903x_spin_t rt903x_arm_lock = RT903X_SPIN_INIT;
+
+/* wait for the effect that is playing to end, switching waveform would cut it off.
+ * false while the chip still plays or streams, the arm is retried later */
+static bool rt903x_arm_wait_idle(rt903x_dev_t *dev)
+{
+    if (rt903x_stream_busy(dev))
+    {
+        return false;
+    }
+    if (!dev->playing)
+    {
+        return true;
+    }
+    int64_t deadline_us = rt903x_time_us() + (int64_t)RT903X_ARM_WAIT_MS * 1000;
+    while (rt903x_time_us() < deadline_us)
+    {
+        uint8_t reg_val;
+        if (rt903x_bus_read(dev, REG_PLAY_CTRL, &reg_val, 1) < 0)
+        {
+            return false;
+        }
+        if ((reg_val & BIT_GO_MASK) == 0)
+        {
+            dev->playing = false;
+            return true;
+        }
+        rt903x_sleep_ms(RT903X_ARM_POLL_MS);
+    }
+    return false;
+}
+
+static void rt903x_arm_task(void *arg)
+{
+    uint32_t wait_ms = RT903X_WAIT_FOREVER;
+    for (;;)
+    {
+        rt903x_task_wait(wait_ms);
+        wait_ms = RT903X_WAIT_FOREVER;
+        for (uint8_t i = 0; i < RT903X_ARM_DEV_MAX; i++)
+        {
+            rt903x_dev_t *dev = rt903x_arm_devs[i];
+            if (dev == NULL || !dev->arm_req.pending)
+            {
+                continue;
+            }
+            bool idle = rt903x_arm_wait_idle(dev);
+            rt903x_mutex_lock(&dev->arm_lock);
+            // 还在播或者流播放占着芯片：请求留着，过一会儿再来，不在它底下换波形
+            if (!idle || dev->playing || rt903x_stream_busy(dev))
+            {
+                rt903x_mutex_unlock(&dev->arm_lock);
+                wait_ms = RT903X_ARM_RETRY_MS;
+                continue;
+            }
+            struct RT903X_ARM_REQ req = dev->arm_req;
+            dev->arm_req.pending = false;
+            // 等待期间如果已经被按下触发过，就不用再准备
+            if (req.pending && !rt903x_ram_armed(dev, req.wave, req.gain, req.vout))
+            {
+                rt903x_ram_arm_locked(dev, req.wave, req.len, req.gain, req.vout);
+            }
+            rt903x_mutex_unlock(&dev->arm_lock);
+        }
+    }
+}
+
+int32_t rt903x_ram_arm_async(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain, RT903X_BOOST_VOLTAGE vout)
+{
+    if (wave == NULL)
+    {
+        return -1;
+    }
+    rt903x_spin_lock(&rt903x_arm_lock);
+    int8_t free_idx = -1;
+    bool known = false;
+    for (uint8_t i = 0; i < RT903X_ARM_DEV_MAX; i++)
+    {
+        if (rt903x_arm_devs[i] == dev)
+        {
+            known = true;
+        }
+        else if (rt903x_arm_devs[i] == NULL && free_idx < 0)
+        {
+            free_idx = i;
+        }
+    }
+    if (!known && free_idx >= 0)
+    {
+        rt903x_arm_devs[free_idx] = dev;
+        known = true;
+    }
+    rt903x_spin_unlock(&rt903x_arm_lock);
+    if (!known)
+    {
+        return -1;
+    }
+    bool create = false;
+    rt903x_spin_lock(&rt903x_arm_lock);
+    if (!rt903x_arm_task_started)
+    {
+        rt903x_arm_task_started = true;
+        create = true;
+    }
+    rt903x_spin_unlock(&rt903x_arm_lock);
+    if (create && rt903x_task_create(rt903x_arm_task, "rt903_arm", RT903X_ARM_TASK_STACK, NULL,
+                                     RT903X_ARM_TASK_PRIO, RT903X_CORE_ANY, &rt903x_arm_task_handle) < 0)
+    {
+        RT903X_LOGE(TAG, "arm task create failed");
+        return -1;
+    }
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    bool held = dev->arm_req.held;
+    if (!held)
+    {
+        dev->arm_req.wave = wave;
+        dev->arm_req.len = len;
+        dev->arm_req.gain = gain;
+        dev->arm_req.vout = vout;
+        dev->arm_req.pending = true;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    if (held || rt903x_arm_task_handle == NULL)
+    {
+        return -1;
+    }
+    rt903x_task_notify(rt903x_arm_task_handle, RT903X_ARM_EVT_REQ);
+    return 0;
+}
+
+void rt903x_ram_arm_hold(rt903x_dev_t *dev, bool hold)
+{
+    // 拿到 arm_lock 说明正在做的准备已经做完，之后 arm 任务只会看到 pending 为 false
+    rt903x_mutex_lock(&dev->arm_lock);
+    dev->arm_req.held = hold;
+    if (hold)
+    {
+        dev->arm_req.pending = false;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+}
+
+/*
+ * Hardware trigger inputs. The bound effects are packed behind one wave table at WAVE_BASE
+ * (4 byte entries pointing at the samples), GPIOx_POS/NEG_ENTRY pick the entry an edge
+ * plays and GPIO_CFGx enables the input; after that a press starts the chip without any
+ * I2C traffic. The table owns the waveform area, so RAM uploads from the MCU are refused
+ * until unbind; stream play still works.
+ * The enable bit (BIT_GPIO_CFG_TRIG_EN) and 1-based entries (GPIO_ENTRY_NONE) are unconfirmed
+ * assumptions, see rt903x_reg.h.
+ */
+static bool rt903x_gpio_trig_same(rt903x_dev_t *dev, const struct RT903X_GPIO_TRIG *trig)
+{
+    return dev->gpio_trig.bound && dev->gpio_trig.wave_cnt == trig->wave_cnt
+        && memcmp(dev->gpio_trig.wave, trig->wave, trig->wave_cnt * sizeof(trig->wave[0])) == 0;
+}
+
+/**
+ * @brief bind the chip's trigger inputs to effects, the table is only uploaded when the set changes
+ * @return 0 bound, -1 error or the effects do not fit in the waveform area
+ */
+int32_t rt903x_gpio_trig_bind(rt903x_dev_t *dev, const struct RT903X_GPIO_BIND bind[RT903X_GPIO_TRIG_NUM],
+                              uint8_t gain, RT903X_BOOST_VOLTAGE vout)
+{
+    static const uint8_t ram_reg = REG_RAM_DATA;
+    struct RT903X_GPIO_TRIG trig;
+    uint32_t wave_len[RT903X_GPIO_WAVE_MAX];
+    uint8_t entry[RT903X_GPIO_WAVE_MAX];
+    uint8_t table[RT903X_GPIO_WAVE_MAX * RT903X_WAVE_HDR_LEN];
+    i2c_iovec_t seg[2 + RT903X_GPIO_WAVE_MAX];
+    int32_t res = 0;
+
+    if (bind == NULL)
+    {
+        return -1;
+    }
+    memset(&trig, 0, sizeof(trig));
+    for (uint8_t i = 0; i < RT903X_GPIO_WAVE_MAX; i++)
+    {
+        const uint8_t *wave = (i & 1) ? bind[i / 2].neg_wave : bind[i / 2].pos_wave;
+        uint32_t len = (i & 1) ? bind[i / 2].neg_len : bind[i / 2].pos_len;
+        uint8_t k = 0;
+        entry[i] = GPIO_ENTRY_NONE;
+        if (wave == NULL)
+        {
+            continue;
+        }
+        if (len <= RT903X_WAVE_HDR_LEN)
+        {
+            return -1;
+        }
+        while (k < trig.wave_cnt && trig.wave[k] != wave)
+        {
+            k++;
+        }
+        if (k == trig.wave_cnt)
+        {
+            trig.wave[k] = wave;
+            wave_len[k] = len;
+            trig.wave_cnt++;
+        }
+        entry[i] = k + 1;
+    }
+    if (trig.wave_cnt == 0)
+    {
+        return rt903x_gpio_trig_unbind(dev);
+    }
+
+    // 表项在前，样本紧跟其后依次排开
+    uint16_t wave_base = rt903x_ram_wave_base(dev);
+    uint16_t table_len = trig.wave_cnt * RT903X_WAVE_HDR_LEN;
+    uint32_t addr = wave_base + table_len;
+    seg[0].buf = &ram_reg;
+    seg[0].len = 1;
+    seg[1].buf = table;
+    seg[1].len = table_len;
+    for (uint8_t k = 0; k < trig.wave_cnt; k++)
+    {
+        uint8_t *hdr = &table[k * RT903X_WAVE_HDR_LEN];
+        hdr[0] = (uint8_t)(addr >> 8);
+        hdr[1] = (uint8_t)addr;
+        hdr[2] = trig.wave[k][2];
+        hdr[3] = trig.wave[k][3];
+        seg[2 + k].buf = trig.wave[k] + RT903X_WAVE_HDR_LEN;
+        seg[2 + k].len = (uint16_t)(wave_len[k] - RT903X_WAVE_HDR_LEN);
+        addr += wave_len[k] - RT903X_WAVE_HDR_LEN;
+    }
+    if (addr > MAX_RAM_SIZE)
+    {
+        RT903X_LOGE(TAG, "gpio_trig_bind: %u effects need 0x%lx bytes, waveform area ends at 0x%x",
+                 trig.wave_cnt, (unsigned long)(addr - wave_base), MAX_RAM_SIZE);
+        return -1;
+    }
+    trig.end = (uint16_t)addr;
+    trig.bound = true;
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    if (rt903x_ram_streaming(dev, "gpio_trig_bind"))
+    {
+        res = -1;
+    }
+    else if (!rt903x_gpio_trig_same(dev, &trig))
+    {
+        if (dev->playing)
+        {
+            rt903x_go(dev, 0);
+        }
+        // 上传期间先关掉触发脚，免得按下去播到写了一半的表
+        for (uint8_t i = 0; i < RT903X_GPIO_TRIG_NUM && res >= 0; i++)
+        {
+            res = rt903x_write_reg(dev, REG_GPIO_CFG1 + i, 0x00);
+        }
+        rt903x_ram_forget(dev);
+        dev->gpio_trig.bound = false;
+        const i2c_reg_val_t addr_regs[] =
+        {
+            {REG_WAVE_BASE_ADDR_L,  (uint8_t)wave_base},
+            {REG_WAVE_BASE_ADDR_H,  (uint8_t)(wave_base >> 8)},
+            {REG_RAM_CFG,           0x04},
+            {REG_RAM_ADDR_L,        (uint8_t)wave_base},
+            {REG_RAM_ADDR_H,        (uint8_t)(wave_base >> 8)},
+        };
+        if (res >= 0)
+        {
+            res = rt903x_write_regs(dev, "gpio_table", addr_regs, ARRAY_SIZE(addr_regs));
+        }
+        if (res >= 0)
+        {
+            res = (dev->bus == NULL) ? -1
+                : dev->bus->ops->writev(dev->bus, dev->info.i2c_address, seg, 2 + trig.wave_cnt);
+        }
+    }
+    if (res >= 0)
+    {
+        res = rt903x_play_setup(dev, MODE_RAM_PLAY, gain, vout);
+    }
+    for (uint8_t i = 0; i < RT903X_GPIO_TRIG_NUM && res >= 0; i++)
+    {
+        uint8_t pos = entry[2 * i], neg = entry[2 * i + 1];
+        const i2c_reg_val_t gpio_regs[] =
+        {
+            {REG_GPIO1_POS_ENTRY + 2 * i,   pos},
+            {REG_GPIO1_NEG_ENTRY + 2 * i,   neg},
+            {REG_GPIO_CFG1 + i,             (pos != GPIO_ENTRY_NONE || neg != GPIO_ENTRY_NONE) ? BIT_GPIO_CFG_TRIG_EN : 0x00},
+        };
+        res = rt903x_write_regs(dev, "gpio_bind", gpio_regs, ARRAY_SIZE(gpio_regs));
+    }
+    if (res >= 0)
+    {
+        dev->gpio_trig = trig;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    CHECK_ERROR_RETURN(res);
+    RT903X_LOGI(TAG, "gpio_trig_bind: %u effects 0x%x..0x%x, entries %u/%u %u/%u %u/%u", trig.wave_cnt,
+             wave_base, trig.end, entry[0], entry[1], entry[2], entry[3], entry[4], entry[5]);
+    return 0;
+}
+
+int32_t rt903x_gpio_trig_unbind(rt903x_dev_t *dev)
+{
+    rt903x_mutex_lock(&dev->arm_lock);
+    int32_t res = rt903x_gpio_trig_release(dev);
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+int32_t rt903x_gpio_trig_status(rt903x_dev_t *dev, uint8_t *level)
+{
+    return rt903x_read_reg(dev, REG_GPIO_STATUS, level);
+}
+
+/*
+ * Chip-looped effects. A loop block (whole f0 periods of a sine, or one resampled
+ * transient) is made resident once under the key &dev->loop, behind two wave table
+ * entries: entry 1 is the whole block, entry 2 its first period. The playlist repeats
+ * them, RT903X_LIST_REPEAT_MAX plays per entry, so a long buzz costs a few list bytes
+ * and GO instead of streaming every sample.
+ */
+#define RT903X_LOOP_ENTRY_MAX   15
+
+static struct RT903X_RAM_SLOT *rt903x_loop_find(rt903x_dev_t *dev, const struct RT903X_LOOP *desc, bool *same)
+{
+    struct RT903X_RAM_SLOT *slot = rt903x_ram_find(dev, (const uint8_t *)&dev->loop);
+    *same = slot != NULL && dev->loop.kind == desc->kind && dev->loop.index == desc->index
+        && dev->loop.f0 == desc->f0;
+    return slot;
+}
+
+static int32_t rt903x_loop_upload(rt903x_dev_t *dev, const struct RT903X_LOOP *desc, const uint8_t *samples,
+                                  struct RT903X_RAM_SLOT **slot)
+{
+    static const uint8_t ram_reg = REG_RAM_DATA;
+    uint16_t len = RT903X_LOOP_HDR_LEN + desc->block;
+    int32_t res = 0;
+
+    if (dev->gpio_trig.bound)
+    {
+        return -1;
+    }
+    if (*slot != NULL)
+    {
+        // 旧的循环块（别的 f0 或别的波形）直接让出位置
+        **slot = dev->ram.slot[--dev->ram.cnt];
+        *slot = NULL;
+    }
+    int32_t addr = rt903x_ram_reserve(dev, len);
+    CHECK_ERROR_RETURN(addr);
+    uint16_t sample_addr = (uint16_t)addr + RT903X_LOOP_HDR_LEN;
+    const uint8_t hdr[RT903X_LOOP_HDR_LEN] =
+    {
+        (uint8_t)(sample_addr >> 8), (uint8_t)sample_addr, (uint8_t)(desc->block >> 8), (uint8_t)desc->block,
+        (uint8_t)(sample_addr >> 8), (uint8_t)sample_addr, (uint8_t)(desc->period >> 8), (uint8_t)desc->period,
+    };
+    const i2c_reg_val_t addr_regs[] =
+    {
+        {REG_RAM_CFG,       0x04},
+        {REG_RAM_ADDR_L,    (uint8_t)addr},
+        {REG_RAM_ADDR_H,    (uint8_t)(addr >> 8)},
+    };
+    res = rt903x_write_regs(dev, "loop_upload", addr_regs, ARRAY_SIZE(addr_regs));
+    CHECK_ERROR_RETURN(res);
+    const i2c_iovec_t seg[] =
+    {
+        {&ram_reg, 1},
+        {hdr, RT903X_LOOP_HDR_LEN},
+        {samples, desc->block},
+    };
+    if (dev->bus == NULL)
+    {
+        return -1;
+    }
+    res = dev->bus->ops->writev(dev->bus, dev->info.i2c_address, seg, ARRAY_SIZE(seg));
+    CHECK_ERROR_RETURN(res);
+    *slot = rt903x_ram_add(dev, (const uint8_t *)&dev->loop, len, (uint16_t)addr);
+    dev->loop = *desc;
+    return 0;
+}
+
+/* playlist of blocks x entry 1 then periods x entry 2, select the loop block and GO */
+static int32_t rt903x_loop_go(rt903x_dev_t *dev, struct RT903X_RAM_SLOT *slot, uint32_t blocks, uint16_t periods,
+                              uint8_t gain, RT903X_PLAY_MODE mode)
+{
+    uint8_t list[RT903X_LIST_HDR_LEN + RT903X_LOOP_ENTRY_MAX * RT903X_LIST_ENTRY_LEN];
+    uint16_t list_base = rt903x_ram_fifo_size(dev);
+    int32_t cap = ((int32_t)rt903x_ram_wave_base(dev) - list_base - RT903X_LIST_HDR_LEN) / RT903X_LIST_ENTRY_LEN;
+    uint8_t entries = 0;
+    int32_t res = 0;
+
+    cap = min(cap, RT903X_LOOP_ENTRY_MAX);
+    if (periods > 0)
+    {
+        cap--;      // 尾巴那一项
+    }
+    while (blocks > 0 && entries < cap)
+    {
+        uint32_t plays = min(blocks, RT903X_LIST_REPEAT_MAX);
+        list[RT903X_LIST_HDR_LEN + entries * RT903X_LIST_ENTRY_LEN] = 1;
+        list[RT903X_LIST_HDR_LEN + entries * RT903X_LIST_ENTRY_LEN + 1] = (uint8_t)(plays - 1);
+        entries++;
+        blocks -= plays;
+    }
+    if (blocks > 0)
+    {
+        RT903X_LOGW(TAG, "loop: playlist full, %lu blocks cut", (unsigned long)blocks);
+    }
+    if (periods > 0 && cap >= 0)
+    {
+        list[RT903X_LIST_HDR_LEN + entries * RT903X_LIST_ENTRY_LEN] = 2;
+        list[RT903X_LIST_HDR_LEN + entries * RT903X_LIST_ENTRY_LEN + 1] = (uint8_t)(periods - 1);
+        entries++;
+    }
+    if (entries == 0 || rt903x_ram_streaming(dev, "loop"))
+    {
+        return -1;
+    }
+    list[0] = entries;
+    list[1] = 0;
+
+    if (dev->playing)
+    {
+        rt903x_go(dev, 0);
+    }
+    res = rt903x_playlist_data(dev, list, RT903X_LIST_HDR_LEN + entries * RT903X_LIST_ENTRY_LEN);
+    CHECK_ERROR_RETURN(res);
+    slot->last_use = ++dev->ram.tick;
+    const i2c_reg_val_t select_regs[] =
+    {
+        {REG_WAVE_BASE_ADDR_L,  (uint8_t)slot->addr},
+        {REG_WAVE_BASE_ADDR_H,  (uint8_t)(slot->addr >> 8)},
+        {REG_GAIN_CFG,          rt903x_prot_gain(dev, gain)},
+        {REG_PLAY_MODE,         (uint8_t)mode},
+    };
+    res = rt903x_write_regs(dev, "loop_select", select_regs, ARRAY_SIZE(select_regs));
+    CHECK_ERROR_RETURN(res);
+    dev->play_mode = mode;
+    res = rt903x_clear_int(dev);
+    CHECK_ERROR_RETURN(res);
+    return rt903x_go(dev, 1);
+}
+
+int32_t rt903x_loop_long(rt903x_dev_t *dev, uint8_t gain, uint16_t duration)
+{
+    uint16_t f0 = dev->config.f0;
+    int32_t res = 0;
+    bool same;
+
+    if (f0 < RT903X_F0_MIN_HZ || f0 > RT903X_F0_MAX_HZ || duration == 0)
+    {
+        return -1;
+    }
+    float period = (float)RT903X_LOOP_SAMPLE_RATE / f0;
+    uint16_t k = (uint16_t)ceilf(RT903X_LOOP_BLOCK_MIN / period);
+    struct RT903X_LOOP desc = {LOOP_SINE, 0, f0, (uint16_t)lroundf(k * period), (uint16_t)lroundf(period)};
+    uint32_t periods = (uint32_t)lroundf((float)duration * f0 / 1000.0f);
+    if (periods == 0)
+    {
+        periods = 1;
+    }
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    struct RT903X_RAM_SLOT *slot = rt903x_loop_find(dev, &desc, &same);
+    if (!same)
+    {
+        uint8_t *buf = (uint8_t *)malloc(desc.block);
+        // 频率微调到正好 k 个周期铺满 block，首尾相接不跳变
+        struct GENERATION_CONFIG gen_config =
+        {
+            WAVEFORM_SINE,
+            (float)k * RT903X_LOOP_SAMPLE_RATE / desc.block,
+            0,
+            64,
+            RT903X_LOOP_SAMPLE_RATE,
+            LPF_NONE
+        };
+        res = -1;
+        if (buf != NULL)
+        {
+            ics_generation_waveform(&gen_config, buf, desc.block);
+            res = rt903x_loop_upload(dev, &desc, buf, &slot);
+            free(buf);
+        }
+    }
+    if (res >= 0)
+    {
+        res = rt903x_loop_go(dev, slot, periods / k, (uint16_t)(periods % k), gain, MODE_RAM_PLAY);
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+int32_t rt903x_loop_transient(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t loop)
+{
+    uint16_t f0 = dev->config.f0;
+    int32_t res = 0;
+    bool same;
+
+    if (index >= ARRAY_SIZE(wave_data_list) || wave_data_list[index].wave == NULL || wave_data_list[index].len < 2
+        || f0 < RT903X_F0_MIN_HZ || f0 > RT903X_F0_MAX_HZ || loop == 0)
+    {
+        return -1;
+    }
+    struct RESAMPLE_CONFIG resample_config =
+    {
+        130.0f,
+        f0
+    };
+    float g = resample_config.src_f0 / resample_config.dest_f0;
+    int16_t resample_size = (int16_t)floor((wave_data_list[index].len - 1) * g) + 1;
+    if (RT903X_LOOP_HDR_LEN + resample_size > MAX_RAM_SIZE - rt903x_ram_wave_base(dev))
+    {
+        return -1;
+    }
+    struct RT903X_LOOP desc = {LOOP_TRANSIENT, index, f0, (uint16_t)resample_size, (uint16_t)resample_size};
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    struct RT903X_RAM_SLOT *slot = rt903x_loop_find(dev, &desc, &same);
+    if (!same)
+    {
+        uint8_t *buf = (uint8_t *)malloc(resample_size);
+        res = -1;
+        if (buf != NULL)
+        {
+            ics_resample_waveform(&resample_config, (const uint8_t*)wave_data_list[index].wave, wave_data_list[index].len,
+                                  buf, &resample_size);
+            desc.block = desc.period = (uint16_t)resample_size;
+            res = rt903x_loop_upload(dev, &desc, buf, &slot);
+            free(buf);
+        }
+    }
+    if (res >= 0)
+    {
+        res = rt903x_loop_go(dev, slot, loop, 0, gain, MODE_RAM_PLAY);
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+int32_t rt903x_loop_stop(rt903x_dev_t *dev)
+{
+    return rt903x_go(dev, 0);
+}
+
+/*
+ * Auto-track. The chip is told the nominal f0 and drives one resident sine cycle per list
+ * play, stretching each cycle to the BEMF zero crossings it measures, so the buzz stays on
+ * the actuator's resonance without host resampling or streaming. The tracked f0 can be read
+ * back afterwards and becomes the nominal f0 of the next play.
+ * The f0 register scale and the enable bit are unverified, so play_long only takes this
+ * path on chips where rt903x_track_enable turned it on.
+ */
+void rt903x_track_enable(rt903x_dev_t *dev, bool enable)
+{
+    dev->auto_track = enable;
+}
+
+int32_t rt903x_track_config(rt903x_dev_t *dev, uint16_t f0)
+{
+    if (f0 < RT903X_F0_MIN_HZ || f0 > RT903X_F0_MAX_HZ)
+    {
+        return -1;
+    }
+    uint16_t f0_cfg = f0 * LRA_F0_CFG_SCALE;
+    const i2c_reg_val_t track_regs[] =
+    {
+        {REG_LRA_F0_CFG1,   (uint8_t)f0_cfg},
+        {REG_LRA_F0_CFG2,   (uint8_t)(f0_cfg >> 8)},
+        {REG_TRACK_CFG1,    BIT_TRACK_EN},
+    };
+    return rt903x_write_regs(dev, "track_config", track_regs, ARRAY_SIZE(track_regs));
+}
+
+int32_t rt903x_track_play(rt903x_dev_t *dev, uint8_t gain, uint16_t duration)
+{
+    uint16_t f0 = dev->config.f0;
+    int32_t res = 0;
+    bool same;
+
+    if (f0 < RT903X_F0_MIN_HZ || f0 > RT903X_F0_MAX_HZ)
+    {
+        f0 = RT903X_TRACK_F0_DEFAULT;
+    }
+    if (duration == 0)
+    {
+        return -1;
+    }
+    uint16_t cycle = (uint16_t)lroundf((float)RT903X_LOOP_SAMPLE_RATE / f0);
+    struct RT903X_LOOP desc = {LOOP_TRACK, 0, f0, cycle, cycle};
+    uint32_t cycles = (uint32_t)lroundf((float)duration * f0 / 1000.0f);
+    if (cycles == 0)
+    {
+        cycles = 1;
+    }
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    res = rt903x_track_config(dev, f0);
+    struct RT903X_RAM_SLOT *slot = rt903x_loop_find(dev, &desc, &same);
+    if (res >= 0 && !same)
+    {
+        uint8_t *buf = (uint8_t *)malloc(cycle);
+        struct GENERATION_CONFIG gen_config =
+        {
+            WAVEFORM_SINE,
+            (float)RT903X_LOOP_SAMPLE_RATE / cycle,
+            0,
+            64,
+            RT903X_LOOP_SAMPLE_RATE,
+            LPF_NONE
+        };
+        res = -1;
+        if (buf != NULL)
+        {
+            ics_generation_waveform(&gen_config, buf, cycle);
+            res = rt903x_loop_upload(dev, &desc, buf, &slot);
+            free(buf);
+        }
+    }
+    if (res >= 0)
+    {
+        res = rt903x_loop_go(dev, slot, cycles, 0, gain, MODE_AUTO_TRACK);
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+int32_t rt903x_track_f0(rt903x_dev_t *dev, uint16_t *f0)
+{
+    uint8_t val[2];
+    int32_t res = rt903x_read_block(dev, REG_TRACK_F0_VAL1, val, sizeof(val));
+    CHECK_ERROR_RETURN(res);
+    uint16_t tracked = (uint16_t)(((val[1] << 8) | val[0]) + LRA_F0_CFG_SCALE / 2) / LRA_F0_CFG_SCALE;
+    if (tracked < RT903X_F0_MIN_HZ || tracked > RT903X_F0_MAX_HZ)
+    {
+        return -1;
+    }
+    dev->config.f0 = tracked;
+    if (f0 != NULL)
+    {
+        *f0 = tracked;
+    }
+    return 0;
+}
+
+int32_t rt903x_stream_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size)
+{
+    return rt903x_bus_write(dev, REG_STREAM_DATA, buf, size);
+}
+
+/* several sample segments into the FIFO in one transfer, used to drain a ring without copying */
+int32_t rt903x_stream_datav(rt903x_dev_t *dev, const i2c_iovec_t *iov, uint8_t iovcnt)
+{
+    static const uint8_t stream_reg = REG_STREAM_DATA;
+    i2c_iovec_t seg[RT903X_STREAM_IOV_MAX + 1];
+    if (dev->bus == NULL || iovcnt == 0 || iovcnt > RT903X_STREAM_IOV_MAX)
+    {
+        return -1;
+    }
+    seg[0].buf = &stream_reg;
+    seg[0].len = 1;
+    memcpy(&seg[1], iov, iovcnt * sizeof(i2c_iovec_t));
+    return dev->bus->ops->writev(dev->bus, dev->info.i2c_address, seg, iovcnt + 1);
+}
+
+int32_t rt903x_chip_id(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    uint8_t reg_val;
+    res = rt903x_bus_read(dev, 0, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    dev->config.chip_id = reg_val;
+    if(CHIP_ID != reg_val)
+    {
+        return -2;
+    }
+    return 0;
+}
+
+int32_t rt903x_clear_int(rt903x_dev_t *dev)
+{
+    uint8_t reg_val;
+    return rt903x_bus_read(dev, REG_INT_STATUS, &reg_val, 1);
+}
+
+int32_t rt903x_clear_protection(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    uint8_t reg_val = 0;
+
+    /* a protection event leaves the register file in an unknown state */
+    rt903x_shadow_invalidate(dev);
+    res = rt903x_read_reg(dev, REG_BEMF_CFG2, &reg_val);
+    CHECK_ERROR_RETURN(res);
+    reg_val |= 0x02;
+    res = rt903x_write_reg(dev, REG_BEMF_CFG2, reg_val);
+    CHECK_ERROR_RETURN(res);
+    reg_val &= 0xfd;
+    res = rt903x_write_reg(dev, REG_BEMF_CFG2, reg_val);
+    CHECK_ERROR_RETURN(res);
+
+    return 0;
+}
+
+/*
+ * Protection recovery. Whoever sees BIT_INTS_PROTECTION (the stream engine, also for idle
+ * chips, or the polling stream loop) calls rt903x_prot_recover: the chip is stopped and
+ * cleared, the shadow is dropped and the gain is capped for a while so the next plays do
+ * not trip again straight away. Streams that were cut are restarted up to max_retries.
+ */
+static struct RT903X_PROT_POLICY rt903x_prot_policy =
+{
+    .max_retries = 2,
+    .gain_pct = 75,
+    .min_gain = 0x20,
+    .hold_ms = 2000,
+};
+
+void rt903x_prot_policy_set(const struct RT903X_PROT_POLICY *policy)
+{
+    rt903x_prot_policy = *policy;
+}
+
+void rt903x_prot_policy_get(struct RT903X_PROT_POLICY *policy)
+{
+    *policy = rt903x_prot_policy;
+}
+
+uint8_t rt903x_prot_gain(rt903x_dev_t *dev, uint8_t gain)
+{
+    uint8_t cap = dev->prot.gain_cap;
+    if (cap == 0)
+    {
+        return gain;
+    }
+    if (rt903x_time_us() - dev->prot.last_us > (int64_t)rt903x_prot_policy.hold_ms * 1000)
+    {
+        dev->prot.gain_cap = 0;
+        return gain;
+    }
+    return min(gain, cap);
+}
+
+int32_t rt903x_prot_recover(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    uint8_t status[2] = {0, 0};
+    uint8_t tripped = 0;
+
+    rt903x_mutex_lock(&dev->arm_lock);
+    dev->prot.events++;
+    if (!rt903x_shadow_lookup(&dev->shadow, REG_GAIN_CFG, &tripped))
+    {
+        tripped = 0x80;
+    }
+    rt903x_go(dev, 0);
+    rt903x_read_block(dev, REG_PROTECTION_STATUS1, status, sizeof(status));
+    dev->prot.status1 = status[0];
+    dev->prot.status2 = status[1];
+    res = rt903x_clear_protection(dev);
+    if (res >= 0)
+    {
+        res = rt903x_clear_int(dev);
+    }
+    if (res >= 0 && rt903x_stream_engine_owns(dev))
+    {
+        // 寄存器缓存已经作废，INT 脚输出重新打开
+        res = rt903x_write_reg(dev, REG_INT_CFG, BIT_INT_CFG_PIN_EN);
+    }
+    uint8_t cap = (uint8_t)max((uint32_t)tripped * rt903x_prot_policy.gain_pct / 100, rt903x_prot_policy.min_gain);
+    if (dev->prot.gain_cap == 0 || cap < dev->prot.gain_cap)
+    {
+        dev->prot.gain_cap = cap;
+    }
+    dev->prot.last_us = rt903x_time_us();
+    if (res >= 0)
+    {
+        dev->prot.recovered++;
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    RT903X_LOGW(TAG, "i2c%d 0x%02x: protection 0x%02x/0x%02x, gain capped at 0x%02x, %s",
+             dev->info.i2c_master_num, dev->info.i2c_address, status[0], status[1], dev->prot.gain_cap,
+             (res >= 0) ? "recovered" : "clear failed");
+    return (res < 0) ? -1 : 0;
+}
+
+bool rt903x_prot_retry(rt903x_dev_t *dev, uint8_t *tries)
+{
+    if (*tries >= rt903x_prot_policy.max_retries)
+    {
+        dev->prot.gave_up++;
+        return false;
+    }
+    (*tries)++;
+    dev->prot.retries++;
+    return true;
+}
+
+int32_t rt903x_boost_voltage(rt903x_dev_t *dev, RT903X_BOOST_VOLTAGE vout)
+{
+    return rt903x_update_reg(dev, REG_BOOST_CFG3, 0x0F, (uint8_t)vout);
+}
+
+int32_t rt903x_gain(rt903x_dev_t *dev, uint8_t gain)
+{
+    return rt903x_write_reg(dev, REG_GAIN_CFG, rt903x_prot_gain(dev, gain));
+}
+
+/* play mode, gain and boost voltage in one batched write ahead of GO */
+int32_t rt903x_play_setup(rt903x_dev_t *dev, RT903X_PLAY_MODE mode, uint8_t gain, RT903X_BOOST_VOLTAGE vout)
+{
+    int32_t res = 0;
+    uint8_t boost_cfg3;
+    res = rt903x_read_reg(dev, REG_BOOST_CFG3, &boost_cfg3);
+    CHECK_ERROR_RETURN(res);
+    boost_cfg3 = (boost_cfg3 & 0xF0) | ((uint8_t)vout & 0x0F);
+    const i2c_reg_val_t play_regs[] =
+    {
+        {REG_PLAY_MODE,     (uint8_t)mode},
+        {REG_GAIN_CFG,      rt903x_prot_gain(dev, gain)},
+        {REG_BOOST_CFG3,    boost_cfg3},
+    };
+    res = rt903x_write_regs(dev, "play_setup", play_regs, ARRAY_SIZE(play_regs));
+    CHECK_ERROR_RETURN(res);
+    dev->play_mode = mode;
+    return 0;
+}
+
+int32_t rt903x_play_mode(rt903x_dev_t *dev, RT903X_PLAY_MODE mode)
+{
+    int32_t res = rt903x_write_reg(dev, REG_PLAY_MODE, (uint8_t)mode);
+    CHECK_ERROR_RETURN(res);
+    dev->play_mode = mode;
+    return 0;
+}
+
+static int32_t rt903x_efuse_read(rt903x_dev_t *dev, uint8_t index, uint8_t *data)
+{
+    int32_t res = 0;
+    uint8_t reg_val;
+    reg_val = index;
+    res = rt903x_bus_write(dev, REG_EFS_ADDR_INDEX, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    reg_val = BIT_EFS_READ;
+    res = rt903x_bus_write(dev, REG_EFS_MODE_CTRL, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    ics_delay_ms(1);
+    res = rt903x_bus_read(dev, REG_EFS_MODE_CTRL, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    if ((reg_val & BIT_EFS_READ) == 0)
+    {
+        res = rt903x_bus_read(dev, REG_EFS_RD_DATA, &reg_val, 1);
+        CHECK_ERROR_RETURN(res);
+        *data = (uint8_t)reg_val;
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t efuse_data;        /*!< raw trim word the decoded values came from */
+    uint8_t pmu_cfg3;
+    uint8_t pmu_cfg4;
+    uint8_t osc_cfg1;
+} rt903x_trim_t;
+
+static void rt903x_trim_decode(uint32_t efs_data, rt903x_trim_t *trim)
+{
+    uint8_t trim_val;
+    memset(trim, 0, sizeof(rt903x_trim_t));
+    trim->efuse_data = efs_data;
+    trim_val = (efs_data & EFS_OSC_LDO_TRIM_MASK) >> EFS_OSC_LDO_TRIM_OFFSET;
+    trim->pmu_cfg3 = trim_val << 6;
+    trim_val = (efs_data & EFS_PMU_LDO_TRIM_MASK) >> EFS_PMU_LDO_TRIM_OFFSET;
+    trim->pmu_cfg3 |= (trim_val << 4);
+    trim_val = (efs_data & EFS_BIAS_1P2V_TRIM_MASK) >> EFS_BIAS_1P2V_TRIM_OFFSET;
+    trim->pmu_cfg4 = trim_val << 4;
+    trim_val = (efs_data & EFS_BIAS_I_TRIM_MASK) >> EFS_BIAS_I_TRIM_OFFSET;
+    trim->pmu_cfg4 |= trim_val;
+    trim_val = (efs_data & EFS_OSC_TRIM_MASK) >> EFS_OSC_TRIM_OFFSET;
+    trim_val ^= 0x80;
+    trim->osc_cfg1 = trim_val;
+}
+
+static int32_t rt903x_trim_write(rt903x_dev_t *dev, const rt903x_trim_t *trim)
+{
+    const i2c_reg_val_t trim_regs[] =
+    {
+        {REG_PMU_CFG3,      trim->pmu_cfg3},
+        {REG_PMU_CFG4,      trim->pmu_cfg4},
+        {REG_OSC_CFG1,      trim->osc_cfg1},
+        {0x2A,              0x0F},
+        {REG_BEMF_CFG1,     0x00},
+        {REG_BEMF_CFG2,     0x01},
+        {REG_BOOST_CFG1,    0x01},
+        {REG_BOOST_CFG2,    0x05},
+        {REG_BOOST_CFG3,    0x0A},
+        {REG_BOOST_CFG4,    0x50},
+        {REG_BOOST_CFG5,    0x1C},
+        {REG_PA_CFG1,       0x2C},
+        {REG_PA_CFG2,       0x03},
+        {REG_PMU_CFG2,      0x1C},
+    };
+    int32_t res = rt903x_write_regs(dev, "apply_trim", trim_regs, ARRAY_SIZE(trim_regs));
+    CHECK_ERROR_RETURN(res);
+    dev->config.efuse_data = trim->efuse_data;
+    return 0;
+}
+
+static int32_t rt903x_efuse_word(rt903x_dev_t *dev, uint32_t *efs_data)
+{
+    int32_t res = 0;
+    uint8_t *efs_data_p = (uint8_t*)efs_data;
+    for(int32_t i = 0; i < 4; ++i)
+    {
+        res = rt903x_efuse_read(dev, i, efs_data_p + i);
+        CHECK_ERROR_RETURN(res);
+    }
+    return 0;
+}
+
+/*
+ * Trim cache. The decoded trims of each chip are kept in NVS under its port/address
+ * together with the efuse word they came from, so a warm boot writes them in one batch
+ * without running the efuse protocol (4 x write, 1 ms, read). An entry only counts if
+ * it decodes from its own efuse word; rt903x_trim_verify checks it against the chip.
+ * The key says where a chip sits, not which chip it is: the rt903 has no ID of its own
+ * short of the efuse word, and reading that is the cost the cache avoids. A chip swapped
+ * in at the same port/address therefore runs on the old chip's trims until trim_verify.
+ */
+static void rt903x_trim_key(rt903x_dev_t *dev, char *key, size_t size)
+{
+    snprintf(key, size, "p%ua%02x", dev->info.i2c_master_num, dev->info.i2c_address);
+}
+
+static bool rt903x_trim_cache_load(rt903x_dev_t *dev, rt903x_trim_t *trim)
+{
+    char key[RT903X_STORE_KEY_MAX];
+    rt903x_trim_t check;
+
+    rt903x_trim_key(dev, key, sizeof(key));
+    if (rt903x_store_get(RT903X_TRIM_NVS_NAMESPACE, key, trim, sizeof(rt903x_trim_t)) < 0)
+    {
+        return false;
+    }
+    rt903x_trim_decode(trim->efuse_data, &check);
+    return check.pmu_cfg3 == trim->pmu_cfg3 && check.pmu_cfg4 == trim->pmu_cfg4 && check.osc_cfg1 == trim->osc_cfg1;
+}
+
+static void rt903x_trim_cache_store(rt903x_dev_t *dev, const rt903x_trim_t *trim)
+{
+    char key[RT903X_STORE_KEY_MAX];
+
+    rt903x_trim_key(dev, key, sizeof(key));
+    if (rt903x_store_set(RT903X_TRIM_NVS_NAMESPACE, key, trim, sizeof(rt903x_trim_t)) < 0)
+    {
+        RT903X_LOGW(TAG, "trim cache store failed for %s", key);
+    }
+}
+
+int32_t rt903x_apply_trim(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    uint32_t efs_data = 0;
+    rt903x_trim_t trim;
+    /* soft reset */
+    res = rt903x_soft_reset(dev);
+    CHECK_ERROR_RETURN(res);
+    /* warm boot: trims decoded on an earlier boot */
+    if (rt903x_trim_cache_load(dev, &trim))
+    {
+        dev->config.trim_cached = true;
+        return rt903x_trim_write(dev, &trim);
+    }
+    /* read out trim data from efuse */
+    res = rt903x_efuse_word(dev, &efs_data);
+    CHECK_ERROR_RETURN(res);
+    /* apply trim data */
+    rt903x_trim_decode(efs_data, &trim);
+    res = rt903x_trim_write(dev, &trim);
+    CHECK_ERROR_RETURN(res);
+    dev->config.trim_cached = false;
+    rt903x_trim_cache_store(dev, &trim);
+//    trim_val = (efs_data & EFS_VBAT_DET_TRIM_MASK) >> EFS_VBAT_DET_TRIM_OFFSET;
+//    int32_t offset_val = (trim_val & 0x0F) * 313;
+//    if ((trim_val & 0x10) != 0)
+//    {
+//        offset_val = 0 - offset_val;
+//    }
+//    dev->config.vbat_det_trim = offset_val - 1740;
+//    dev->config.rl_det_trim = (efs_data & EFS_RL_DET_TRIM_MASK) >> EFS_RL_DET_TRIM_OFFSET;
+
+
+    return 0;
+}
+
+/**
+ * @brief read the efuse of a chip whose trims came from the cache and fix them if it was replaced
+ * @return 1 trims corrected, 0 cache was right or not used, -1 error
+ */
+int32_t rt903x_trim_verify(rt903x_dev_t *dev)
+{
+    uint32_t efs_data = 0;
+    rt903x_trim_t trim;
+    int32_t res = 0;
+    // efuse 读写和改写 trim 都不能和 arm / 流播放的 claim 交错
+    rt903x_mutex_lock(&dev->arm_lock);
+    if (!dev->config.trim_cached)
+    {
+        rt903x_mutex_unlock(&dev->arm_lock);
+        return 0;
+    }
+    res = rt903x_efuse_word(dev, &efs_data);
+    if (res >= 0)
+    {
+        dev->config.trim_cached = false;
+        res = (efs_data == dev->config.efuse_data) ? 0 : 1;
+    }
+    if (res > 0)
+    {
+        RT903X_LOGW(TAG, "i2c%d 0x%02x: efuse 0x%08lx differs from cached 0x%08lx, trims rewritten",
+                 dev->info.i2c_master_num, dev->info.i2c_address, (unsigned long)efs_data,
+                 (unsigned long)dev->config.efuse_data);
+        rt903x_trim_decode(efs_data, &trim);
+        if (rt903x_trim_write(dev, &trim) < 0)
+        {
+            res = -1;
+        }
+        else
+        {
+            rt903x_trim_cache_store(dev, &trim);
+        }
+    }
+    rt903x_mutex_unlock(&dev->arm_lock);
+    return res;
+}
+
+typedef struct {
+    rt903x_dev_t *dev;
+    rt903x_sem_t *done;
+    int32_t res;
+} rt903x_init_worker_t;
+
+static void rt903x_init_task(void *arg)
+{
+    rt903x_init_worker_t *worker = (rt903x_init_worker_t *)arg;
+    worker->res = rt903x_init(worker->dev);
+    rt903x_sem_give(worker->done);
+    rt903x_task_exit();
+}
+
+/**
+ * @brief rt903x_init every chip on its own task, chips on different buses run at the same
+ * time and the efuse delays of chips on one bus overlap. blocks until all are done
+ * @return number of chips that came up, is_online of each dev is set
+ */
+int32_t rt903x_init_parallel(rt903x_dev_t *const *devs, uint8_t count)
+{
+    rt903x_init_worker_t worker[RT903X_INIT_MAX_CHIPS];
+    rt903x_sem_t done;
+    uint8_t started = 0;
+    int32_t online = 0;
+
+    if (devs == NULL || count == 0 || count > RT903X_INIT_MAX_CHIPS)
+    {
+        return -1;
+    }
+    rt903x_sem_init(&done, count, 0);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        worker[i].dev = devs[i];
+        worker[i].done = &done;
+        worker[i].res = -1;
+        if (rt903x_task_create(rt903x_init_task, "rt903_init", RT903X_INIT_TASK_STACK, &worker[i],
+                               RT903X_INIT_TASK_PRIO, RT903X_CORE_ANY, NULL) == 0)
+        {
+            started++;
+        }
+        else
+        {
+            worker[i].res = rt903x_init(devs[i]);
+        }
+    }
+    while (started-- > 0)
+    {
+        rt903x_sem_take(&done, RT903X_WAIT_FOREVER);
+    }
+    rt903x_sem_deinit(&done);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        devs[i]->info.is_online = (worker[i].res >= 0);
+        online += devs[i]->info.is_online ? 1 : 0;
+    }
+    return online;
+}
+
+int32_t rt903x_go(rt903x_dev_t *dev, uint8_t val)
+{
+    int32_t res = rt903x_bus_write(dev, REG_PLAY_CTRL, &val, 1);
+    CHECK_ERROR_RETURN(res);
+    dev->playing = (val != 0);
+    return 0;
+}
+
+/*
+ * Synchronised start. Chips on one bus can only be started one GO write after the other,
+ * but the two buses have their own executor on their own core. One task per bus arms its
+ * chips and waits at an event group barrier; setting the release bit unblocks both at once,
+ * so the first GO of each bus goes out together and the rest follow back to back.
+ */
+#define RT903X_SYNC_RELEASE     (1 << 0)
+#define RT903X_SYNC_READY(port) (1 << (1 + (port)))
+#define RT903X_SYNC_DONE(port)  (1 << (1 + I2C_BUS_PORT_MAX + (port)))
+
+typedef struct {
+    rt903x_sync_member_t *members;
+    uint8_t count;
+    uint8_t port;
+    RT903X_BOOST_VOLTAGE vout;
+    rt903x_event_t *group;
+} rt903x_sync_worker_t;
+
+static void rt903x_sync_task(void *arg)
+{
+    rt903x_sync_worker_t *worker = (rt903x_sync_worker_t *)arg;
+    for (uint8_t i = 0; i < worker->count; i++)
+    {
+        rt903x_sync_member_t *m = &worker->members[i];
+        if (m->dev->bus->port != worker->port || m->wave == NULL)
+        {
+            continue;
+        }
+        m->status = (rt903x_ram_arm(m->dev, m->wave, m->len, m->gain, worker->vout) < 0) ? -1 : 0;
+    }
+    rt903x_event_set(worker->group, RT903X_SYNC_READY(worker->port));
+    rt903x_event_wait_all(worker->group, RT903X_SYNC_RELEASE, RT903X_WAIT_FOREVER);
+    for (uint8_t i = 0; i < worker->count; i++)
+    {
+        rt903x_sync_member_t *m = &worker->members[i];
+        if (m->dev->bus->port != worker->port || m->status < 0)
+        {
+            continue;
+        }
+        m->status = rt903x_go(m->dev, 1);
+        m->go_us = rt903x_time_us();
+    }
+    rt903x_event_set(worker->group, RT903X_SYNC_DONE(worker->port));
+    rt903x_task_exit();
+}
+
+int32_t rt903x_sync_play(rt903x_sync_member_t *members, uint8_t count, RT903X_BOOST_VOLTAGE vout, uint32_t *skew_us)
+{
+    rt903x_sync_worker_t worker[I2C_BUS_PORT_MAX];
+    rt903x_event_t group;
+    uint32_t ready = 0;
+    uint32_t done = 0;
+    int32_t started = 0;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+
+    if (members == NULL || count == 0 || count > RT903X_SYNC_MAX_CHIPS)
+    {
+        return -1;
+    }
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (members[i].dev == NULL || members[i].dev->bus == NULL || members[i].dev->bus->port >= I2C_BUS_PORT_MAX)
+        {
+            return -1;
+        }
+        members[i].status = 0;
+        members[i].go_us = 0;
+    }
+
+    rt903x_event_init(&group);
+    static const char *task_name[I2C_BUS_PORT_MAX] = {"rt903_sync_0", "rt903_sync_1"};
+    for (uint8_t port = 0; port < I2C_BUS_PORT_MAX; port++)
+    {
+        bool used = false;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            used |= (members[i].dev->bus->port == port);
+        }
+        if (!used)
+        {
+            continue;
+        }
+        worker[port].members = members;
+        worker[port].count = count;
+        worker[port].port = port;
+        worker[port].vout = vout;
+        worker[port].group = &group;
+        // 跟这条总线的 executor 在同一个核上（main.c 里 bus n 在 core n）
+        if (rt903x_task_create(rt903x_sync_task, task_name[port], RT903X_SYNC_TASK_STACK, &worker[port],
+                               RT903X_SYNC_TASK_PRIO, port, NULL) < 0)
+        {
+            RT903X_LOGE(TAG, "sync worker %d create failed", port);
+            for (uint8_t i = 0; i < count; i++)
+            {
+                if (members[i].dev->bus->port == port)
+                {
+                    members[i].status = -1;
+                }
+            }
+            continue;
+        }
+        ready |= RT903X_SYNC_READY(port);
+        done |= RT903X_SYNC_DONE(port);
+    }
+
+    if (ready != 0)
+    {
+        rt903x_event_wait_all(&group, ready, RT903X_WAIT_FOREVER);
+        rt903x_event_set(&group, RT903X_SYNC_RELEASE);
+        rt903x_event_wait_all(&group, done, RT903X_WAIT_FOREVER);
+    }
+    rt903x_event_deinit(&group);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (members[i].status < 0)
+        {
+            continue;
+        }
+        if (started == 0 || members[i].go_us < first_us)
+        {
+            first_us = members[i].go_us;
+        }
+        if (started == 0 || members[i].go_us > last_us)
+        {
+            last_us = members[i].go_us;
+        }
+        started++;
+    }
+    if (skew_us != NULL)
+    {
+        *skew_us = (uint32_t)(last_us - first_us);
+    }
+    return started;
+}
+
+/* f0 from the five BEMF zero-cross stamps (192 kHz ticks), quality = agreement of the two full periods */
+static int32_t rt903x_f0_from_cz(const uint16_t *cz, uint16_t *f0, uint8_t *quality)
+{
+    int32_t period1 = (int32_t)cz[3] - (int32_t)cz[1];
+    int32_t period2 = (int32_t)cz[4] - (int32_t)cz[2];
+    int32_t period = (period1 + period2) >> 1;
+    if (period1 <= 0 || period2 <= 0 || period <= 0)
+    {
+        *f0 = 0;
+        *quality = 0;
+        return -1;
+    }
+    *f0 = (uint16_t)(192000 / period);
+    int32_t spread = abs(period1 - period2) * 100 / period;
+    *quality = (uint8_t)((spread >= 100) ? 0 : (100 - spread));
+    if (*f0 < RT903X_F0_MIN_HZ || *f0 > RT903X_F0_MAX_HZ)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* f0 from the BEMF stamps of the last detection, dev->config is not touched. -1 bus error, -2 out of range */
+static int32_t rt903x_f0_measure(rt903x_dev_t *dev, uint16_t *f0, uint8_t *quality)
+{
+    int32_t res = 0;
+    uint8_t cz_raw[REG_BEMF_CZ5_VAL2 - REG_BEMF_CZ1_VAL1 + 1];
+    uint16_t cz_val[5];
+    *f0 = 0;
+    *quality = 0;
+    res = rt903x_read_block(dev, REG_BEMF_CZ1_VAL1, cz_raw, sizeof(cz_raw));
+    CHECK_ERROR_RETURN(res);
+    for (uint8_t i = 0; i < ARRAY_SIZE(cz_val); i++)
+    {
+        cz_val[i] = (uint16_t)(cz_raw[i * 2 + 1] & 0x3F);
+        cz_val[i] = (uint16_t)((cz_val[i] << 8) | cz_raw[i * 2]);
+    }
+    res = rt903x_f0_from_cz(cz_val, f0, quality);
+    if (res < 0)
+    {
+        RT903X_LOGW(TAG, "chip 0x%02x f0 out of range: %u Hz", dev->info.i2c_address, *f0);
+        return -2;
+    }
+    return 0;
+}
+
+/* a failed measurement keeps the last good f0, the loops and the resampler divide by it */
+int32_t rt903x_calc_f0(rt903x_dev_t *dev)
+{
+    uint16_t f0;
+    uint8_t quality;
+    int32_t res = rt903x_f0_measure(dev, &f0, &quality);
+    CHECK_ERROR_RETURN(res);
+    dev->config.f0 = f0;
+    dev->config.f0_quality = quality;
+    return 0;
+}
+
+/* load the f0 list/waveform, configure BEMF detection and start playing, does not wait */
+static int32_t rt903x_f0_start(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    uint8_t reg_val;
+    // Clear all interruptions
+    res = rt903x_bus_read(dev, REG_INT_STATUS, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    // Fill the list data and waveform data
+    res = rt903x_playlist_data(dev, f0_list_data,F0_LIST_DATA_LEN);
+    CHECK_ERROR_RETURN(res)
+    res = rt903x_waveform_data(dev, (const uint8_t*)f0_wave_data,F0_WAVE_DATA_LEN);
+    CHECK_ERROR_RETURN(res)
+    const i2c_reg_val_t f0_regs[] =
+    {
+        {REG_GAIN_CFG,          0x20},
+        {REG_BRAKE_CFG1,        0x00},
+        {REG_DETECT_F0_CFG,     0x01},
+        {REG_BEMF_CFG3,         0x26},
+        {REG_BEMF_CFG4,         0x20},
+        {REG_PLAY_MODE,         0x01},
+    };
+    res = rt903x_write_regs(dev, "detect_f0", f0_regs, ARRAY_SIZE(f0_regs));
+    CHECK_ERROR_RETURN(res);
+    res = rt903x_go(dev, 1);
+    CHECK_ERROR_RETURN(res);
+    return 0;
+}
+
+/* 1: the f0 waveform has finished, 0: still playing, -1: bus error */
+static int32_t rt903x_f0_done(rt903x_dev_t *dev)
+{
+    uint8_t reg_val;
+    int32_t res = rt903x_bus_read(dev, REG_PLAY_CTRL, &reg_val, 1);
+    CHECK_ERROR_RETURN(res);
+    if (reg_val != 0)
+    {
+        return 0;
+    }
+    dev->playing = false;
+    return 1;
+}
+
+/* at least one tick, pdMS_TO_TICKS(1) is 0 at 100 Hz and would spin */
+static void rt903x_f0_sleep(void)
+{
+    rt903x_sleep_ms(RT903X_F0_POLL_MS);
+}
+
+int32_t rt903x_detect_f0(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    res = rt903x_f0_start(dev);
+    CHECK_ERROR_RETURN(res);
+    int64_t deadline_us = rt903x_time_us() + (int64_t)RT903X_F0_DEADLINE_MS * 1000;
+    while (1)
+    {
+        res = rt903x_f0_done(dev);
+        CHECK_ERROR_RETURN(res);
+        if (res > 0)
+        {
+            break;
+        }
+        if (rt903x_time_us() >= deadline_us)
+        {
+            RT903X_LOGW(TAG, "chip 0x%02x f0 detect timeout", dev->info.i2c_address);
+            rt903x_go(dev, 0);
+            return -1;
+        }
+        rt903x_f0_sleep();
+    }
+
+    ics_delay_ms(RT903X_F0_SETTLE_MS);
+    res = rt903x_calc_f0(dev);
+    CHECK_ERROR_RETURN(res);
+
+    return 0;
+}
+
+enum
+{
+    F0_STATE_PLAYING = 0,
+    F0_STATE_SETTLING,
+    F0_STATE_DONE,
+};
+
+typedef struct rt903x_f0_job rt903x_f0_job_t;
+
+typedef struct
+{
+    rt903x_f0_job_t *job;
+    uint8_t port;
+} rt903x_f0_worker_t;
+
+/* one measurement over several chips, one worker task per bus so the buses run in parallel */
+struct rt903x_f0_job
+{
+    rt903x_f0_result_t results[RT903X_F0_MAX_CHIPS];
+    uint8_t state[RT903X_F0_MAX_CHIPS];
+    int64_t done_us[RT903X_F0_MAX_CHIPS];
+    uint8_t count;
+    int64_t start_us;
+    int64_t deadline_us;
+    rt903x_f0_worker_t worker[I2C_BUS_PORT_MAX];
+    uint8_t refs;           /*!< one per running worker plus one held by the submitter */
+    rt903x_f0_cb_t cb;
+    void *arg;
+};
+
+static rt903x_spin_t rt903x_f0_lock = RT903X_SPIN_INIT;
+static bool rt903x_f0_busy = false;
+
+static void rt903x_f0_finish(rt903x_f0_job_t *job, uint8_t i, int32_t status)
+{
+    rt903x_f0_result_t *result = &job->results[i];
+    result->status = status;
+    result->elapsed_ms = (uint32_t)((rt903x_time_us() - job->start_us) / 1000);
+    job->state[i] = F0_STATE_DONE;
+}
+
+/* drop references on the job, whoever drops the last one reports and frees it */
+static void rt903x_f0_release(rt903x_f0_job_t *job, uint8_t refs)
+{
+    bool last;
+    rt903x_spin_lock(&rt903x_f0_lock);
+    job->refs -= refs;
+    last = (job->refs == 0);
+    rt903x_spin_unlock(&rt903x_f0_lock);
+    if (!last)
+    {
+        return;
+    }
+    if (job->cb != NULL)
+    {
+        job->cb(job->results, job->count, job->arg);
+    }
+    free(job);
+    rt903x_spin_lock(&rt903x_f0_lock);
+    rt903x_f0_busy = false;
+    rt903x_spin_unlock(&rt903x_f0_lock);
+}
+
+static void rt903x_f0_worker_task(void *arg)
+{
+    rt903x_f0_worker_t *worker = (rt903x_f0_worker_t *)arg;
+    rt903x_f0_job_t *job = worker->job;
+    uint8_t pending = 0;
+
+    // 同一条总线上的芯片先全部启动，再一起轮询，测量时间相互重叠
+    for (uint8_t i = 0; i < job->count; i++)
+    {
+        rt903x_dev_t *dev = job->results[i].dev;
+        if (dev->bus->port != worker->port)
+        {
+            continue;
+        }
+        if (rt903x_f0_start(dev) < 0)
+        {
+            rt903x_f0_finish(job, i, RT903X_F0_ERR_BUS);
+            continue;
+        }
+        pending++;
+    }
+
+    while (pending > 0)
+    {
+        int64_t now_us = rt903x_time_us();
+        for (uint8_t i = 0; i < job->count; i++)
+        {
+            rt903x_dev_t *dev = job->results[i].dev;
+            if (dev->bus->port != worker->port || job->state[i] == F0_STATE_DONE)
+            {
+                continue;
+            }
+            if (job->state[i] == F0_STATE_SETTLING)
+            {
+                if (now_us - job->done_us[i] >= (int64_t)RT903X_F0_SETTLE_MS * 1000)
+                {
+                    rt903x_f0_result_t *result = &job->results[i];
+                    int32_t res = rt903x_f0_measure(dev, &result->f0, &result->quality);
+                    if (res == 0)
+                    {
+                        dev->config.f0 = result->f0;
+                        dev->config.f0_quality = result->quality;
+                    }
+                    rt903x_f0_finish(job, i, (res == -1) ? RT903X_F0_ERR_BUS
+                                             : (res < 0) ? RT903X_F0_ERR_RANGE : RT903X_F0_OK);
+                    pending--;
+                }
+                continue;
+            }
+            int32_t res = rt903x_f0_done(dev);
+            if (res < 0)
+            {
+                rt903x_f0_finish(job, i, RT903X_F0_ERR_BUS);
+                pending--;
+            }
+            else if (res > 0)
+            {
+                job->state[i] = F0_STATE_SETTLING;
+                job->done_us[i] = now_us;
+            }
+            else if (now_us >= job->deadline_us)
+            {
+                rt903x_go(dev, 0);
+                rt903x_f0_finish(job, i, RT903X_F0_ERR_TIMEOUT);
+                pending--;
+            }
+        }
+        if (pending > 0)
+        {
+            rt903x_f0_sleep();
+        }
+    }
+
+    rt903x_f0_release(job, 1);
+    rt903x_task_exit();
+}
+
+int32_t rt903x_detect_f0_async(rt903x_dev_t *const *devs, uint8_t count, uint32_t deadline_ms,
+                               rt903x_f0_cb_t cb, void *arg)
+{
+    if (devs == NULL || count == 0 || count > RT903X_F0_MAX_CHIPS)
+    {
+        return -1;
+    }
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (devs[i] == NULL || devs[i]->bus == NULL || devs[i]->bus->port >= I2C_BUS_PORT_MAX)
+        {
+            return -1;
+        }
+    }
+
+    rt903x_spin_lock(&rt903x_f0_lock);
+    bool busy = rt903x_f0_busy;
+    rt903x_f0_busy = true;
+    rt903x_spin_unlock(&rt903x_f0_lock);
+    if (busy)
+    {
+        RT903X_LOGW(TAG, "f0 measurement already running");
+        return -1;
+    }
+
+    rt903x_f0_job_t *job = (rt903x_f0_job_t *)calloc(1, sizeof(rt903x_f0_job_t));
+    if (job == NULL)
+    {
+        rt903x_spin_lock(&rt903x_f0_lock);
+        rt903x_f0_busy = false;
+        rt903x_spin_unlock(&rt903x_f0_lock);
+        return -1;
+    }
+    job->count = count;
+    job->cb = cb;
+    job->arg = arg;
+    job->start_us = rt903x_time_us();
+    job->deadline_us = job->start_us + (int64_t)(deadline_ms ? deadline_ms : RT903X_F0_DEADLINE_MS) * 1000;
+
+    bool used[I2C_BUS_PORT_MAX] = {false};
+    job->refs = 1;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        job->results[i].dev = devs[i];
+        job->results[i].status = RT903X_F0_ERR_TIMEOUT;
+        if (!used[devs[i]->bus->port])
+        {
+            used[devs[i]->bus->port] = true;
+            job->refs++;
+        }
+    }
+
+    // 引用计数先算好，任何一个 worker 都可能最后结束并回调
+    static const char *task_name[I2C_BUS_PORT_MAX] = {"rt903_f0_0", "rt903_f0_1"};
+    uint8_t dropped = 1;
+    for (uint8_t port = 0; port < I2C_BUS_PORT_MAX; port++)
+    {
+        if (!used[port])
+        {
+            continue;
+        }
+        job->worker[port].job = job;
+        job->worker[port].port = port;
+        if (rt903x_task_create(rt903x_f0_worker_task, task_name[port], RT903X_F0_TASK_STACK,
+                               &job->worker[port], RT903X_F0_TASK_PRIO, RT903X_CORE_ANY, NULL) < 0)
+        {
+            RT903X_LOGE(TAG, "f0 worker %d create failed", port);
+            for (uint8_t i = 0; i < count; i++)
+            {
+                if (devs[i]->bus->port == port)
+                {
+                    job->results[i].status = RT903X_F0_ERR_BUS;
+                }
+            }
+            dropped++;
+        }
+    }
+    rt903x_f0_release(job, dropped);
+    return 0;
+}
+
+static int32_t check_stream_play_status(rt903x_dev_t *dev)
+{
+    uint8_t reg_val = 0;
+    if (rt903x_stream_engine_owns(dev))
+    {
+        // INT 脚唤醒，engine 任务已经读过 INT_STATUS，这里不再每 1ms 轮询
+        while (1)
+        {
+            int32_t res = rt903x_stream_wait_int(dev, &reg_val, RT903X_STREAM_WAIT_MS);
+            CHECK_ERROR_RETURN(res);
+            if ((reg_val & BIT_INTS_PLAYDONE) > 0)
+            {
+                return 1;
+            }
+            if ((reg_val & BIT_INTS_FIFO_AE) > 0)
+            {
+                return 0;
+            }
+            if ((reg_val & BIT_INTS_PROTECTION) > 0)
+            {
+                rt903x_prot_recover(dev);
+                return RT903X_PROT_EVENT;
+            }
+        }
+    }
+    while (1)
+    {
+        int16_t res = rt903x_bus_read(dev, REG_INT_STATUS, &reg_val, 1);
+        CHECK_ERROR_RETURN(res);
+        if ((reg_val & BIT_INTS_PLAYDONE) > 0)
+        {
+            return 1;
         }
 
         if ((reg_val & BIT_INTS_FIFO_AE) > 0)
@@ -476,10 +2529,11 @@ static int32_t check_stream_play_status(DEF_RT903_INFO i2c_config)
 
         if ((reg_val & BIT_INTS_PROTECTION) > 0)
         {
-              return -1;
+            rt903x_prot_recover(dev);
+            return RT903X_PROT_EVENT;
         }
 
-        res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_PLAY_CTRL, &reg_val, 1);
+        res = rt903x_bus_read(dev, REG_PLAY_CTRL, &reg_val, 1);
         CHECK_ERROR_RETURN(res);
         if ((reg_val & BIT_GO_MASK) == 0)
         {
@@ -490,51 +2544,198 @@ static int32_t check_stream_play_status(DEF_RT903_INFO i2c_config)
     }
 }
 
-int32_t rt903x_play_long(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t gain, uint16_t duration)
+/* producer side sources for the stream pipeline, run on the producer core */
+typedef struct
+{
+    struct GENERATION_CONFIG gen;   /*!< phase carries over from one fill to the next */
+    int32_t total;
+    int32_t index;
+} rt903x_gen_source_t;
+
+static int32_t rt903x_gen_fill(void *ctx, uint8_t *buf, int32_t size)
+{
+    rt903x_gen_source_t *src = (rt903x_gen_source_t *)ctx;
+    int32_t n = min(size, src->total - src->index);
+    if (n <= 0)
+    {
+        return 0;
+    }
+    ics_generation_waveform(&src->gen, buf, (int16_t)n);
+    src->index += n;
+    return n;
+}
+
+typedef struct
+{
+    struct RESAMPLE_CONFIG resample;
+    const uint8_t *wave;
+    int16_t wave_len;
+    uint8_t *buf;
+    int16_t size;           /*!< capacity of buf, then the resampled length */
+    bool ready;
+    int32_t total;          /*!< loop count, then resampled length * loop */
+    int32_t index;
+} rt903x_resample_source_t;
+
+static int32_t rt903x_resample_fill(void *ctx, uint8_t *buf, int32_t size)
+{
+    rt903x_resample_source_t *src = (rt903x_resample_source_t *)ctx;
+    if (!src->ready)
+    {
+        if (src->buf == NULL || ics_resample_waveform(&src->resample, src->wave, src->wave_len, src->buf, &src->size) < 0)
+        {
+            return 0;
+        }
+        src->total *= src->size;
+        src->ready = true;
+    }
+    int32_t n = min(size, src->total - src->index);
+    int32_t done = 0;
+    while (done < n)
+    {
+        int32_t buf_offset = (src->index + done) % src->size;
+        int32_t batch_size = min(n - done, src->size - buf_offset);
+        memcpy(buf + done, src->buf + buf_offset, batch_size);
+        done += batch_size;
+    }
+    src->index += n;
+    return (n > 0) ? n : 0;
+}
+
+static int32_t rt903x_stream_pipe_play(rt903x_dev_t *dev, uint8_t gain, rt903x_pipe_fill_t fill, void *ctx)
+{
+    int32_t res = 0;
+    uint8_t tries = 0;
+    do
+    {
+        // 重试时增益已经被保护策略压低，源从断掉的位置接着产生
+        res = rt903x_gain(dev, gain);
+        CHECK_ERROR_RETURN(res);
+        res = rt903x_play_mode(dev, MODE_STREAM_PLAY);
+        CHECK_ERROR_RETURN(res);
+        res = rt903x_stream_run_pipe(dev, fill, ctx, RT903X_PIPE_PRODUCER_CORE);
+    } while (res == RT903X_PROT_EVENT && rt903x_prot_retry(dev, &tries));
+    return res;
+}
+
+/* FIFO mode, INT cleared, gain/mode set and GO, for the polling stream loops */
+static int32_t rt903x_stream_restart(rt903x_dev_t *dev, uint8_t gain)
+{
+    int32_t res = 0;
+    res = rt903x_write_reg(dev, REG_RAM_CFG, 0x01);
+    CHECK_ERROR_RETURN(res);
+    // Clear all interruptions
+    res = rt903x_clear_int(dev);
+    CHECK_ERROR_RETURN(res);
+    res = rt903x_gain(dev, gain);
+    CHECK_ERROR_RETURN(res);
+    res = rt903x_play_mode(dev, MODE_STREAM_PLAY);
+    CHECK_ERROR_RETURN(res);
+    rt903x_stream_int_arm(dev, true);
+    return rt903x_go(dev, 1);
+}
+
+/* measured f0, the nominal one while the chip has none that is plausible */
+static uint16_t rt903x_f0_or_nominal(rt903x_dev_t *dev)
+{
+    uint16_t f0 = dev->config.f0;
+    return (f0 < RT903X_F0_MIN_HZ || f0 > RT903X_F0_MAX_HZ) ? RT903X_TRACK_F0_DEFAULT : f0;
+}
+
+/* sine of the long buzz, 6k sample rate */
+static void rt903x_long_source(rt903x_dev_t *dev, uint16_t duration, rt903x_gen_source_t *src)
 {
     struct GENERATION_CONFIG gen_config =
     {
         WAVEFORM_SINE,
-        rt903x_config.f0,
+        rt903x_f0_or_nominal(dev),
         0,
         64,
         6000,
         LPF_NONE
     };
-    ics_generation_reset(&gen_config);
+    src->gen = gen_config;
+    src->total = duration * 6;
+    src->index = 0;
+}
+
+/* 芯片自己跟踪谐振（auto-track，需要先打开）或循环常驻的周期块，主机只写启动 */
+static bool rt903x_long_chip_loop(rt903x_dev_t *dev, uint8_t gain, uint16_t duration)
+{
+    return (dev->auto_track && rt903x_track_play(dev, gain, duration) >= 0) || rt903x_loop_long(dev, gain, duration) >= 0;
+}
+
+int32_t rt903x_play_long_start(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t duration,
+                               rt903x_stream_done_t cb, void *arg)
+{
+    if (rt903x_long_chip_loop(dev, gain, duration))
+    {
+        return 0;
+    }
+    if (!rt903x_stream_engine_owns(dev))
+    {
+        return -1;
+    }
+    // 生成器状态跟着 pipe 走，流被打断时由 pipe 释放
+    rt903x_gen_source_t *src = (rt903x_gen_source_t *)malloc(sizeof(rt903x_gen_source_t));
+    if (src == NULL)
+    {
+        return -1;
+    }
+    rt903x_long_source(dev, duration, src);
+    if (rt903x_gain(dev, gain) < 0 || rt903x_play_mode(dev, MODE_STREAM_PLAY) < 0)
+    {
+        free(src);
+        return -1;
+    }
+    int32_t res = rt903x_stream_start_pipe(dev, rt903x_gen_fill, src, free, RT903X_PIPE_PRODUCER_CORE, cb, arg);
+    return (res < 0) ? -1 : 1;
+}
+
+int32_t rt903x_play_long(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t duration)
+{
+    rt903x_gen_source_t src;
+    // 都不行时才退回流播放
+    if (rt903x_long_chip_loop(dev, gain, duration))
+    {
+        return 0;
+    }
+    rt903x_long_source(dev, duration, &src);
 
-    int32_t total_size = duration * 6; //6k sample rate
+    int32_t total_size = src.total;
     int32_t total_index = 0;
-    int32_t fifo_size = (rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL;
+    if (rt903x_stream_engine_owns(dev))
+    {
+        return rt903x_stream_pipe_play(dev, gain, rt903x_gen_fill, &src);
+    }
+    int32_t fifo_size = rt903x_ram_fifo_size(dev);
     uint8_t *sin_gen_buf = (uint8_t *)malloc(fifo_size); //buf size depend on the fifo size
 
     int32_t res = 0;
-    uint8_t reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &reg_val, 1);
-    // Clear all interruptions
-    res = rt903x_clear_int(i2c_config);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_gain(i2c_config, gain);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_play_mode(i2c_config, MODE_STREAM_PLAY);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_go(i2c_config, 1);
+    uint8_t tries = 0;
+    res = rt903x_stream_restart(dev, gain);
     CHECK_ERROR_CLEAN(res);
 
     while(total_size > total_index)
     {
         int32_t gen_size = min(fifo_size, total_size - total_index);
-        ics_generation_waveform(sin_gen_buf, gen_size);
-        res = rt903x_stream_data(i2c_config, (const uint8_t*)sin_gen_buf, gen_size);
+        ics_generation_waveform(&src.gen, sin_gen_buf, gen_size);
+        res = rt903x_stream_data(dev, (const uint8_t*)sin_gen_buf, gen_size);
         CHECK_ERROR_CLEAN(res);
         total_index += gen_size;
             
-        res = check_stream_play_status(i2c_config);
+        res = check_stream_play_status(dev);
+        if (res == RT903X_PROT_EVENT && rt903x_prot_retry(dev, &tries))
+        {
+            // 已经恢复，压低增益后接着播剩下的
+            res = rt903x_stream_restart(dev, gain);
+            CHECK_ERROR_CLEAN(res);
+            continue;
+        }
         CHECK_ERROR_CLEAN(res);
         if (res == 0)     // FIFO AE
         {
-            fifo_size = ((rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL)
-                            - ((rt903x_config.ram_param.FifoAEH << 8) | rt903x_config.ram_param.FifoAEL);
+            fifo_size = rt903x_ram_refill_size(dev);
         }
         else if (res == 1)  // Play Done or Stop
         {
@@ -543,40 +2744,63 @@ int32_t rt903x_play_long(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t gain
     }
 
 err:
+    rt903x_stream_int_arm(dev, false);
     free(sin_gen_buf);
     return res;
 }
 
-int32_t rt903x_play_transient(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t gain, uint16_t loop)
+int32_t rt903x_play_transient(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t loop)
 {
     struct RESAMPLE_CONFIG resample_config =
     {
         130.0f,
-        rt903x_config.f0
+        rt903x_f0_or_nominal(dev)
     };
-    ics_resample_reset(&resample_config);
+    if (index >= ARRAY_SIZE(wave_data_list) || wave_data_list[index].wave == NULL || wave_data_list[index].len < 2)
+    {
+        return -1;
+    }
+    if (rt903x_loop_transient(dev, index, gain, loop) >= 0)
+    {
+        return 0;
+    }
 
     int16_t resample_size = wave_data_list[index].len;
     float g = resample_config.src_f0 / resample_config.dest_f0;
     resample_size = (int16_t)floor((resample_size - 1) * g) + 1;
     uint8_t *resample_buf = (uint8_t *)malloc(sizeof(uint8_t) * resample_size); //buf size depend on the resampled wave size
-    ics_resample_waveform((const uint8_t*)wave_data_list[index].wave, wave_data_list[index].len, resample_buf, &resample_size);
+    if (resample_buf == NULL)
+    {
+        return -1;
+    }
+    if (rt903x_stream_engine_owns(dev))
+    {
+        // 重采样也放到生产者任务里做
+        rt903x_resample_source_t src =
+        {
+            resample_config,
+            (const uint8_t*)wave_data_list[index].wave, wave_data_list[index].len,
+            resample_buf, resample_size, false, loop, 0
+        };
+        int32_t res = rt903x_stream_pipe_play(dev, gain, rt903x_resample_fill, &src);
+        free(resample_buf);
+        return res;
+    }
+    int32_t res = 0;
+    uint8_t tries = 0;
+    res = ics_resample_waveform(&resample_config, (const uint8_t*)wave_data_list[index].wave, wave_data_list[index].len,
+                                resample_buf, &resample_size);
+    if (res < 0)
+    {
+        free(resample_buf);
+        return -1;
+    }
 
     int32_t total_size = resample_size * loop;
     int32_t total_index = 0;
-    int32_t fifo_size = (rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL;
+    int32_t fifo_size = rt903x_ram_fifo_size(dev);
 
-    int32_t res = 0;
-    uint8_t reg_val = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &reg_val, 1);
-    // Clear all interruptions
-    res = rt903x_clear_int(i2c_config);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_gain(i2c_config, gain);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_play_mode(i2c_config, MODE_STREAM_PLAY);
-    CHECK_ERROR_CLEAN(res);
-    res = rt903x_go(i2c_config, 1);
+    res = rt903x_stream_restart(dev, gain);
     CHECK_ERROR_CLEAN(res);
 
     while(total_size > total_index)
@@ -586,18 +2810,24 @@ int32_t rt903x_play_transient(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t
         {
             int32_t buf_offset = total_index % resample_size;
             int32_t batch_size = min(stream_size, resample_size - buf_offset);                    
-            res = rt903x_stream_data(i2c_config, (const uint8_t*)resample_buf + buf_offset, batch_size);
+            res = rt903x_stream_data(dev, (const uint8_t*)resample_buf + buf_offset, batch_size);
             CHECK_ERROR_CLEAN(res);
             stream_size -= batch_size;
             total_index += batch_size;
         }
 
-        res = check_stream_play_status(i2c_config);
+        res = check_stream_play_status(dev);
+        if (res == RT903X_PROT_EVENT && rt903x_prot_retry(dev, &tries))
+        {
+            // 已经恢复，压低增益后接着播剩下的
+            res = rt903x_stream_restart(dev, gain);
+            CHECK_ERROR_CLEAN(res);
+            continue;
+        }
         CHECK_ERROR_CLEAN(res);
         if (res == 0)     // FIFO AE
         {
-            fifo_size = ((rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL)
-                            - ((rt903x_config.ram_param.FifoAEH << 8) | rt903x_config.ram_param.FifoAEL);
+            fifo_size = rt903x_ram_refill_size(dev);
         }
         else if (res == 1)  // Play Done or Stop
         {
@@ -606,6 +2836,7 @@ int32_t rt903x_play_transient(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t
     }
 
 err:
+    rt903x_stream_int_arm(dev, false);
     free(resample_buf);
     return res;
 }
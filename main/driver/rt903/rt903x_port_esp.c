@@ -0,0 +1,213 @@
+/*
+ * rt903x_port_esp.c
+ *
+ * ESP-IDF / FreeRTOS side of the rt903 platform shim, see rt903x_port.h. Also holds the
+ * pieces of the driver that talk to the ESP transport directly (bus speed negotiation).
+ */
+#include "rt903x_port.h"
+#include "rt903x.h"
+#include <i2c_adapter.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "driver/gpio.h"
+
+static TickType_t rt903x_port_ticks(uint32_t timeout_ms)
+{
+    if (timeout_ms == RT903X_WAIT_FOREVER)
+    {
+        return portMAX_DELAY;
+    }
+    return (TickType_t)(((uint64_t)timeout_ms * configTICK_RATE_HZ + 999) / 1000);
+}
+
+int64_t rt903x_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void rt903x_delay_ms(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void rt903x_sleep_ms(uint32_t ms)
+{
+    TickType_t ticks = rt903x_port_ticks(ms);
+    vTaskDelay(ticks ? ticks : 1);
+}
+
+void rt903x_mutex_init(rt903x_mutex_t *mutex, bool recursive)
+{
+    mutex->recursive = recursive;
+    mutex->handle = recursive ? xSemaphoreCreateRecursiveMutexStatic(&mutex->buf)
+                              : xSemaphoreCreateMutexStatic(&mutex->buf);
+}
+
+void rt903x_mutex_lock(rt903x_mutex_t *mutex)
+{
+    rt903x_mutex_trylock(mutex, RT903X_WAIT_FOREVER);
+}
+
+bool rt903x_mutex_trylock(rt903x_mutex_t *mutex, uint32_t timeout_ms)
+{
+    if (mutex->recursive)
+    {
+        return xSemaphoreTakeRecursive(mutex->handle, rt903x_port_ticks(timeout_ms)) == pdTRUE;
+    }
+    return xSemaphoreTake(mutex->handle, rt903x_port_ticks(timeout_ms)) == pdTRUE;
+}
+
+void rt903x_mutex_unlock(rt903x_mutex_t *mutex)
+{
+    if (mutex->recursive)
+    {
+        xSemaphoreGiveRecursive(mutex->handle);
+        return;
+    }
+    xSemaphoreGive(mutex->handle);
+}
+
+void rt903x_sem_init(rt903x_sem_t *sem, uint32_t max, uint32_t initial)
+{
+    sem->handle = xSemaphoreCreateCountingStatic(max, initial, &sem->buf);
+}
+
+bool rt903x_sem_take(rt903x_sem_t *sem, uint32_t timeout_ms)
+{
+    return xSemaphoreTake(sem->handle, rt903x_port_ticks(timeout_ms)) == pdTRUE;
+}
+
+void rt903x_sem_give(rt903x_sem_t *sem)
+{
+    xSemaphoreGive(sem->handle);
+}
+
+void rt903x_sem_deinit(rt903x_sem_t *sem)
+{
+    vSemaphoreDelete(sem->handle);
+}
+
+void rt903x_event_init(rt903x_event_t *event)
+{
+    event->handle = xEventGroupCreateStatic(&event->buf);
+}
+
+void rt903x_event_set(rt903x_event_t *event, uint32_t bits)
+{
+    xEventGroupSetBits(event->handle, (EventBits_t)bits);
+}
+
+bool rt903x_event_wait_all(rt903x_event_t *event, uint32_t bits, uint32_t timeout_ms)
+{
+    EventBits_t got = xEventGroupWaitBits(event->handle, (EventBits_t)bits, pdFALSE, pdTRUE,
+                                          rt903x_port_ticks(timeout_ms));
+    return (got & bits) == bits;
+}
+
+void rt903x_event_deinit(rt903x_event_t *event)
+{
+    vEventGroupDelete(event->handle);
+}
+
+int32_t rt903x_task_create(void (*fn)(void *), const char *name, uint32_t stack, void *arg,
+                           uint8_t prio, int8_t core, rt903x_task_t *task)
+{
+    BaseType_t ret;
+    if (core == RT903X_CORE_ANY)
+    {
+        ret = xTaskCreate(fn, name, stack, arg, prio, task);
+    }
+    else
+    {
+        ret = xTaskCreatePinnedToCore(fn, name, stack, arg, prio, task, core);
+    }
+    return (ret == pdPASS) ? 0 : -1;
+}
+
+void rt903x_task_exit(void)
+{
+    vTaskDelete(NULL);
+}
+
+void rt903x_task_notify(rt903x_task_t task, uint32_t bits)
+{
+    xTaskNotify(task, bits, eSetBits);
+}
+
+void RT903X_ISR_ATTR rt903x_task_notify_isr(rt903x_task_t task, uint32_t bits)
+{
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(task, bits, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+uint32_t rt903x_task_wait(uint32_t timeout_ms)
+{
+    uint32_t bits = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &bits, rt903x_port_ticks(timeout_ms)) != pdTRUE)
+    {
+        return 0;
+    }
+    return bits;
+}
+
+int32_t rt903x_store_get(const char *ns, const char *key, void *buf, uint32_t len)
+{
+    nvs_handle_t handle;
+    size_t size = len;
+    if (nvs_open(ns, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return -1;
+    }
+    esp_err_t err = nvs_get_blob(handle, key, buf, &size);
+    nvs_close(handle);
+    return (err == ESP_OK && size == len) ? 0 : -1;
+}
+
+int32_t rt903x_store_set(const char *ns, const char *key, const void *buf, uint32_t len)
+{
+    nvs_handle_t handle;
+    if (nvs_open(ns, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return -1;
+    }
+    esp_err_t err = nvs_set_blob(handle, key, buf, len);
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return (err == ESP_OK) ? 0 : -1;
+}
+
+/* gpio_install_isr_service must already have run */
+int32_t rt903x_irq_attach(uint8_t gpio, rt903x_irq_handler_t handler, void *arg)
+{
+    gpio_config_t io_conf;
+    io_conf.intr_type = GPIO_INTR_NEGEDGE;
+    io_conf.pin_bit_mask = 1ULL << gpio;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
+    if (gpio_config(&io_conf) != ESP_OK)
+    {
+        return -1;
+    }
+    gpio_isr_handler_remove(gpio);
+    return (gpio_isr_handler_add(gpio, handler, arg) == ESP_OK) ? 0 : -1;
+}
+
+int rt903x_irq_level(uint8_t gpio)
+{
+    return gpio_get_level(gpio);
+}
+
+int32_t rt903x_speed_register(rt903x_dev_t *dev)
+{
+    esp_err_t ret = i2c_speed_register(dev->info.i2c_master_num, dev->info.i2c_address, dev->info.max_freq_hz,
+                                       rt903x_speed_check, dev);
+    return ret == ESP_OK ? 0 : -1;
+}
@@ -0,0 +1,443 @@
+/*
+ * rt903x_port_host.c
+ *
+ * POSIX side of the rt903 platform shim, see rt903x_port.h. Only built by host/ for the
+ * bench: tasks are threads (priority and core are ignored), NVS is a small table in memory
+ * and the INT line is a variable the bench's chip model drives.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "rt903x_port.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define RT903X_HOST_STORE_MAX       8
+#define RT903X_HOST_STORE_SIZE      64
+#define RT903X_HOST_IRQ_MAX         64
+
+struct rt903x_host_task
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t bits;
+    void (*fn)(void *);
+    void *arg;
+};
+
+typedef struct
+{
+    bool used;
+    char ns[RT903X_STORE_KEY_MAX];
+    char key[RT903X_STORE_KEY_MAX];
+    uint32_t len;
+    uint8_t data[RT903X_HOST_STORE_SIZE];
+} rt903x_host_blob_t;
+
+typedef struct
+{
+    int level;
+    rt903x_irq_handler_t handler;
+    void *arg;
+} rt903x_host_irq_t;
+
+static __thread struct rt903x_host_task *rt903x_host_self = NULL;
+static pthread_mutex_t rt903x_host_lock = PTHREAD_MUTEX_INITIALIZER;
+static rt903x_host_blob_t rt903x_host_store[RT903X_HOST_STORE_MAX];
+static rt903x_host_irq_t rt903x_host_irq[RT903X_HOST_IRQ_MAX];
+
+/* absolute CLOCK_REALTIME deadline for the pthread timed waits */
+static struct timespec rt903x_host_deadline(uint32_t timeout_ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_ms / 1000;
+    ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/* wait on cond until pred() holds or the timeout passes, lock held on entry and exit */
+static bool rt903x_host_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint32_t timeout_ms,
+                             bool (*pred)(void *), void *ctx)
+{
+    struct timespec ts = rt903x_host_deadline(timeout_ms == RT903X_WAIT_FOREVER ? 0 : timeout_ms);
+    while (!pred(ctx))
+    {
+        if (timeout_ms == RT903X_WAIT_FOREVER)
+        {
+            pthread_cond_wait(cond, lock);
+        }
+        else if (pthread_cond_timedwait(cond, lock, &ts) == ETIMEDOUT)
+        {
+            return pred(ctx);
+        }
+    }
+    return true;
+}
+
+int64_t rt903x_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void rt903x_delay_ms(uint32_t ms)
+{
+    if (ms == 0)
+    {
+        sched_yield();
+        return;
+    }
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/* the host tick is 1 ms */
+void rt903x_sleep_ms(uint32_t ms)
+{
+    rt903x_delay_ms(ms ? ms : 1);
+}
+
+void rt903x_mutex_init(rt903x_mutex_t *mutex, bool recursive)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, recursive ? PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_NORMAL);
+    pthread_mutex_init(&mutex->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void rt903x_mutex_lock(rt903x_mutex_t *mutex)
+{
+    pthread_mutex_lock(&mutex->lock);
+}
+
+bool rt903x_mutex_trylock(rt903x_mutex_t *mutex, uint32_t timeout_ms)
+{
+    if (timeout_ms == RT903X_WAIT_FOREVER)
+    {
+        return pthread_mutex_lock(&mutex->lock) == 0;
+    }
+    struct timespec ts = rt903x_host_deadline(timeout_ms);
+    return pthread_mutex_timedlock(&mutex->lock, &ts) == 0;
+}
+
+void rt903x_mutex_unlock(rt903x_mutex_t *mutex)
+{
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+void rt903x_sem_init(rt903x_sem_t *sem, uint32_t max, uint32_t initial)
+{
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->count = initial;
+    sem->max = max;
+}
+
+static bool rt903x_sem_ready(void *ctx)
+{
+    return ((rt903x_sem_t *)ctx)->count > 0;
+}
+
+bool rt903x_sem_take(rt903x_sem_t *sem, uint32_t timeout_ms)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool ok = rt903x_host_wait(&sem->cond, &sem->lock, timeout_ms, rt903x_sem_ready, sem);
+    if (ok)
+    {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ok;
+}
+
+void rt903x_sem_give(rt903x_sem_t *sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count < sem->max)
+    {
+        sem->count++;
+    }
+    pthread_cond_broadcast(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+}
+
+void rt903x_sem_deinit(rt903x_sem_t *sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->lock);
+}
+
+void rt903x_event_init(rt903x_event_t *event)
+{
+    pthread_mutex_init(&event->lock, NULL);
+    pthread_cond_init(&event->cond, NULL);
+    event->bits = 0;
+}
+
+void rt903x_event_set(rt903x_event_t *event, uint32_t bits)
+{
+    pthread_mutex_lock(&event->lock);
+    event->bits |= bits;
+    pthread_cond_broadcast(&event->cond);
+    pthread_mutex_unlock(&event->lock);
+}
+
+typedef struct
+{
+    rt903x_event_t *event;
+    uint32_t bits;
+} rt903x_host_event_wait_t;
+
+static bool rt903x_event_ready(void *ctx)
+{
+    rt903x_host_event_wait_t *wait = (rt903x_host_event_wait_t *)ctx;
+    return (wait->event->bits & wait->bits) == wait->bits;
+}
+
+bool rt903x_event_wait_all(rt903x_event_t *event, uint32_t bits, uint32_t timeout_ms)
+{
+    rt903x_host_event_wait_t wait = {event, bits};
+    pthread_mutex_lock(&event->lock);
+    bool ok = rt903x_host_wait(&event->cond, &event->lock, timeout_ms, rt903x_event_ready, &wait);
+    pthread_mutex_unlock(&event->lock);
+    return ok;
+}
+
+void rt903x_event_deinit(rt903x_event_t *event)
+{
+    pthread_cond_destroy(&event->cond);
+    pthread_mutex_destroy(&event->lock);
+}
+
+static struct rt903x_host_task *rt903x_host_task_new(void)
+{
+    struct rt903x_host_task *task = (struct rt903x_host_task *)calloc(1, sizeof(struct rt903x_host_task));
+    if (task != NULL)
+    {
+        pthread_mutex_init(&task->lock, NULL);
+        pthread_cond_init(&task->cond, NULL);
+    }
+    return task;
+}
+
+/* threads the port did not start (the bench's main) get their notification slot on first use */
+static struct rt903x_host_task *rt903x_host_task_self(void)
+{
+    if (rt903x_host_self == NULL)
+    {
+        rt903x_host_self = rt903x_host_task_new();
+        if (rt903x_host_self != NULL)
+        {
+            rt903x_host_self->thread = pthread_self();
+        }
+    }
+    return rt903x_host_self;
+}
+
+static void *rt903x_host_task_entry(void *arg)
+{
+    struct rt903x_host_task *task = (struct rt903x_host_task *)arg;
+    rt903x_host_self = task;
+    task->thread = pthread_self();
+    task->fn(task->arg);
+    rt903x_task_exit();
+    return NULL;
+}
+
+int32_t rt903x_task_create(void (*fn)(void *), const char *name, uint32_t stack, void *arg,
+                           uint8_t prio, int8_t core, rt903x_task_t *task)
+{
+    struct rt903x_host_task *t = rt903x_host_task_new();
+    if (t == NULL)
+    {
+        return -1;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    // 句柄要在线程开始跑之前就交给调用方，和 xTaskCreate 一样
+    if (task != NULL)
+    {
+        *task = t;
+    }
+    // 线程可能在 pthread_create 返回前就跑完并释放 t，线程号不能写回 t
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, rt903x_host_task_entry, t);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
+    {
+        if (task != NULL)
+        {
+            *task = NULL;
+        }
+        free(t);
+        return -1;
+    }
+    return 0;
+}
+
+/* like vTaskDelete(NULL), the handle must not be notified afterwards */
+void rt903x_task_exit(void)
+{
+    struct rt903x_host_task *task = rt903x_host_self;
+    rt903x_host_self = NULL;
+    if (task != NULL)
+    {
+        pthread_cond_destroy(&task->cond);
+        pthread_mutex_destroy(&task->lock);
+        free(task);
+    }
+    pthread_exit(NULL);
+}
+
+void rt903x_task_notify(rt903x_task_t task, uint32_t bits)
+{
+    if (task == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&task->lock);
+    task->bits |= bits;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+void rt903x_task_notify_isr(rt903x_task_t task, uint32_t bits)
+{
+    rt903x_task_notify(task, bits);
+}
+
+static bool rt903x_task_ready(void *ctx)
+{
+    return ((struct rt903x_host_task *)ctx)->bits != 0;
+}
+
+uint32_t rt903x_task_wait(uint32_t timeout_ms)
+{
+    struct rt903x_host_task *task = rt903x_host_task_self();
+    if (task == NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&task->lock);
+    rt903x_host_wait(&task->cond, &task->lock, timeout_ms, rt903x_task_ready, task);
+    uint32_t bits = task->bits;
+    task->bits = 0;
+    pthread_mutex_unlock(&task->lock);
+    return bits;
+}
+
+static rt903x_host_blob_t *rt903x_host_blob(const char *ns, const char *key)
+{
+    for (uint8_t i = 0; i < RT903X_HOST_STORE_MAX; i++)
+    {
+        rt903x_host_blob_t *blob = &rt903x_host_store[i];
+        if (blob->used && strcmp(blob->ns, ns) == 0 && strcmp(blob->key, key) == 0)
+        {
+            return blob;
+        }
+    }
+    return NULL;
+}
+
+int32_t rt903x_store_get(const char *ns, const char *key, void *buf, uint32_t len)
+{
+    int32_t res = -1;
+    pthread_mutex_lock(&rt903x_host_lock);
+    rt903x_host_blob_t *blob = rt903x_host_blob(ns, key);
+    if (blob != NULL && blob->len == len)
+    {
+        memcpy(buf, blob->data, len);
+        res = 0;
+    }
+    pthread_mutex_unlock(&rt903x_host_lock);
+    return res;
+}
+
+int32_t rt903x_store_set(const char *ns, const char *key, const void *buf, uint32_t len)
+{
+    int32_t res = -1;
+    if (len > RT903X_HOST_STORE_SIZE || strlen(ns) >= RT903X_STORE_KEY_MAX || strlen(key) >= RT903X_STORE_KEY_MAX)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&rt903x_host_lock);
+    rt903x_host_blob_t *blob = rt903x_host_blob(ns, key);
+    for (uint8_t i = 0; i < RT903X_HOST_STORE_MAX && blob == NULL; i++)
+    {
+        if (!rt903x_host_store[i].used)
+        {
+            blob = &rt903x_host_store[i];
+            blob->used = true;
+            strcpy(blob->ns, ns);
+            strcpy(blob->key, key);
+        }
+    }
+    if (blob != NULL)
+    {
+        memcpy(blob->data, buf, len);
+        blob->len = len;
+        res = 0;
+    }
+    pthread_mutex_unlock(&rt903x_host_lock);
+    return res;
+}
+
+int32_t rt903x_irq_attach(uint8_t gpio, rt903x_irq_handler_t handler, void *arg)
+{
+    if (gpio >= RT903X_HOST_IRQ_MAX)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&rt903x_host_lock);
+    rt903x_host_irq[gpio].level = 1;
+    rt903x_host_irq[gpio].handler = handler;
+    rt903x_host_irq[gpio].arg = arg;
+    pthread_mutex_unlock(&rt903x_host_lock);
+    return 0;
+}
+
+int rt903x_irq_level(uint8_t gpio)
+{
+    if (gpio >= RT903X_HOST_IRQ_MAX)
+    {
+        return 1;
+    }
+    pthread_mutex_lock(&rt903x_host_lock);
+    int level = rt903x_host_irq[gpio].level;
+    pthread_mutex_unlock(&rt903x_host_lock);
+    return level;
+}
+
+void rt903x_port_host_irq_set(uint8_t gpio, int level)
+{
+    if (gpio >= RT903X_HOST_IRQ_MAX)
+    {
+        return;
+    }
+    pthread_mutex_lock(&rt903x_host_lock);
+    rt903x_host_irq_t irq = rt903x_host_irq[gpio];
+    bool falling = (irq.level != 0 && level == 0);
+    rt903x_host_irq[gpio].level = level;
+    pthread_mutex_unlock(&rt903x_host_lock);
+    if (falling && irq.handler != NULL)
+    {
+        irq.handler(irq.arg);
+    }
+}
@@ -6,8 +6,6 @@
 #include <stdint.h>
 #include "esp_log.h"
 
-const uint8_t list_data[] = {1,0,1,0};
-#define LIST_DATA_LEN        sizeof(list_data)
 #define ARRAY_LENGTH(a) (sizeof(a) / sizeof(a[0]))
 
 // static const int8_t a_b_300hz[]=
@@ -208,76 +206,141 @@ static const uint32_t input_int8_playList_len[] =
 	ARRAY_LENGTH(sound_4),
 };
 
-//仅仅是demo使用， number数需要在0-3之间
-//int_number  ,中断触发的值，不同的按键有不同的int number
-int16_t rt903x_Ram_prepare(DEF_RT903_INFO i2c_config, uint8_t gain, uint8_t number, uint8_t int_number)
+//int_number 对应的第 number 个效果
+static int16_t ram_demo_effect(uint8_t number, uint8_t int_number, const uint8_t **wave, uint32_t *wave_len)
 {
+	*wave = NULL;
+	*wave_len = 0;
 	if (number >= EFFECT_NUMBER_MAX) return -1;
-	if(gain > 0x80) return -1;
-	int16_t res = 0;
 
-	// Clear all interruptions
-	res = rt903x_clear_int(i2c_config);
-  	CHECK_ERROR_RETURN(res);
-	res = rt903x_go(i2c_config, 0);
-	CHECK_ERROR_RETURN(res);
-	
-	// Fill the waveform data.
+	// Pick the waveform data.
 	switch (int_number)
     {
 		case INPUT_INT1:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int1_playList[number],input_int1_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int1_playList[number];
+			*wave_len = input_int1_playList_len[number];
 			break;
 		case INPUT_INT2:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int2_playList[number],input_int2_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int2_playList[number];
+			*wave_len = input_int2_playList_len[number];
 			break;
 		case INPUT_INT3:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int3_playList[number],input_int3_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int3_playList[number];
+			*wave_len = input_int3_playList_len[number];
 			break;
 		case INPUT_INT4:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int4_playList[number],input_int4_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int4_playList[number];
+			*wave_len = input_int4_playList_len[number];
 			break;
 		case INPUT_INT5:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int5_playList[number],input_int5_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int5_playList[number];
+			*wave_len = input_int5_playList_len[number];
 			break;
 		case INPUT_INT6:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int6_playList[number],input_int6_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int6_playList[number];
+			*wave_len = input_int6_playList_len[number];
 			break;
 		case INPUT_INT7:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int7_playList[number],input_int7_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int7_playList[number];
+			*wave_len = input_int7_playList_len[number];
 			break;
 		case INPUT_INT8:
-			res = rt903x_waveform_data(i2c_config, (const uint8_t*)input_int8_playList[number],input_int8_playList_len[number]);
-			CHECK_ERROR_RETURN(res);
+			*wave = (const uint8_t*)input_int8_playList[number];
+			*wave_len = input_int8_playList_len[number];
 			break;
 		default:
 			break;
 		//
 	}
-	res = rt903x_gain(i2c_config, gain);
+	return (*wave == NULL) ? -1 : 0;
+}
+
+//仅仅是demo使用， number数需要在0-3之间
+//int_number  ,中断触发的值，不同的按键有不同的int number
+int16_t rt903x_Ram_prepare(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number)
+{
+	if(gain > 0x80) return -1;
+	const uint8_t *wave;
+	uint32_t wave_len;
+	int16_t res = ram_demo_effect(number, int_number, &wave, &wave_len);
 	CHECK_ERROR_RETURN(res);
-	res = rt903x_boost_voltage(i2c_config, BOOST_VOUT_850);
+	// 已经在RAM里的效果不再上传，只切换 WAVE_BASE；playlist 只写一次
+	int32_t loaded = rt903x_ram_arm(dev, wave, wave_len, gain, BOOST_VOUT_850);
+	CHECK_ERROR_RETURN(loaded);
+
+	return 0;
+}
+int16_t rt903x_Ram_play(rt903x_dev_t *dev)
+{
+	int res = rt903x_go(dev, 1);
 	CHECK_ERROR_RETURN(res);
-	ics_delay_ms(1);
+	return 0;
+}
 
-	// Fill the list data and waveform data
-	res = rt903x_playlist_data(i2c_config, list_data,LIST_DATA_LEN);
+//按键触发：已经准备好（armed）时只写一次 GO，was_armed 返回按下时是否已准备好
+int16_t rt903x_Ram_trigger(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number, bool *was_armed)
+{
+	if(gain > 0x80) return -1;
+	const uint8_t *wave;
+	uint32_t wave_len;
+	int16_t res = ram_demo_effect(number, int_number, &wave, &wave_len);
 	CHECK_ERROR_RETURN(res);
-	res = rt903x_play_mode(i2c_config, MODE_RAM_PLAY);
+	res = rt903x_ram_trigger(dev, wave, wave_len, gain, BOOST_VOUT_850, was_armed);
 	CHECK_ERROR_RETURN(res);
-
 	return 0;
 }
-int16_t rt903x_Ram_play(DEF_RT903_INFO i2c_config)
+
+//后台准备下一次按键要播的效果，当前效果播完后再切
+int16_t rt903x_Ram_arm(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number)
 {
-	int res = rt903x_go(i2c_config, 1);
+	if(gain > 0x80) return -1;
+	const uint8_t *wave;
+	uint32_t wave_len;
+	int16_t res = ram_demo_effect(number, int_number, &wave, &wave_len);
+	CHECK_ERROR_RETURN(res);
+	return rt903x_ram_arm_async(dev, wave, wave_len, gain, BOOST_VOUT_850);
+}
+
+//几颗芯片同时开始播第 number 组里 int_number[i] 的效果，gain[i] 为各自增益；返回开始播的芯片数
+int16_t rt903x_Ram_sync_play(rt903x_dev_t *const *devs, uint8_t count, const uint8_t *gain, uint8_t number,
+							 const uint8_t *int_number, uint32_t *skew_us)
+{
+	rt903x_sync_member_t members[RT903X_SYNC_MAX_CHIPS] = {0};
+	if(count > RT903X_SYNC_MAX_CHIPS) return -1;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if(gain[i] > 0x80) return -1;
+		int16_t res = ram_demo_effect(number, int_number[i], &members[i].wave, &members[i].len);
+		CHECK_ERROR_RETURN(res);
+		members[i].dev = devs[i];
+		members[i].gain = gain[i];
+	}
+	return (int16_t)rt903x_sync_play(members, count, BOOST_VOUT_850, skew_us);
+}
+
+//效果播放时长（ms），调度器据此判断一次按键的效果什么时候播完
+int32_t rt903x_Ram_effect_ms(uint8_t number, uint8_t int_number)
+{
+	const uint8_t *wave;
+	uint32_t wave_len;
+	int16_t res = ram_demo_effect(number, int_number, &wave, &wave_len);
+	CHECK_ERROR_RETURN(res);
+	return (int32_t)(wave_len * 1000 / RT903X_LOOP_SAMPLE_RATE);
+}
+
+//按键直接接到rt903的触发脚：第n个触发脚拉低（下降沿）时芯片自己播 int_number[n] 的效果，0 表示不用
+//只在效果组或增益变化时调用，按下本身不经过MCU和I2C
+int16_t rt903x_Ram_gpio_bind(rt903x_dev_t *dev, uint8_t gain, uint8_t number, const uint8_t int_number[RT903X_GPIO_TRIG_NUM])
+{
+	struct RT903X_GPIO_BIND bind[RT903X_GPIO_TRIG_NUM] = {0};
+	if(gain > 0x80) return -1;
+	for (uint8_t i = 0; i < RT903X_GPIO_TRIG_NUM; i++)
+	{
+		if (int_number[i] == 0) continue;
+		int16_t res = ram_demo_effect(number, int_number[i], &bind[i].neg_wave, &bind[i].neg_len);
+		CHECK_ERROR_RETURN(res);
+	}
+	int32_t res = rt903x_gpio_trig_bind(dev, bind, gain, BOOST_VOUT_850);
 	CHECK_ERROR_RETURN(res);
 	return 0;
 }
@@ -0,0 +1,467 @@
+#include "rt903x_sched.h"
+#include "rt903x_stream.h"
+#include "rt903x_reg.h"
+#include "ics_util.h"
+#include "rt903x_port.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "esp_console.h"
+#endif
+
+static const char *TAG = "rt903-sched";
+
+#define RT903X_SCHED_EVT_REQ    (1 << 0)    /* something was queued or cancelled */
+#define RT903X_SCHED_EVT_DONE   (1 << 1)    /* the engine finished a stream effect */
+
+typedef struct
+{
+    rt903x_dev_t *dev;
+    rt903x_task_t task;
+    rt903x_sched_req_t queue[RT903X_SCHED_QUEUE_LEN];   /*!< oldest first */
+    uint8_t count;
+    bool playing;                   /*!< cur is the request the worker is on */
+    rt903x_sched_req_t cur;
+    bool preempt;                   /*!< cut cur off as soon as possible */
+    bool cancel;                    /*!< the cut comes from rt903x_sched_cancel */
+    bool held;                      /*!< submits refused, see rt903x_sched_hold */
+
+    /* worker task only */
+    bool live;                      /*!< the chip may still play what the worker started last */
+    bool streaming;                 /*!< live effect is an engine stream, stop it through the engine */
+    uint32_t gen;                   /*!< bumped per stream start, stale callbacks are ignored */
+    volatile uint32_t done_gen;     /*!< gen of the last stream the engine finished */
+    rt903x_sched_stats_t stats;
+} rt903x_sched_chip_t;
+
+typedef struct
+{
+    rt903x_spin_t lock;
+    uint8_t chip_cnt;
+    rt903x_sched_chip_t chip[RT903X_SCHED_CHIP_MAX];
+} rt903x_sched_t;
+
+static rt903x_sched_t sched = {
+    .lock = RT903X_SPIN_INIT,
+};
+
+static rt903x_sched_chip_t *rt903x_sched_chip(rt903x_dev_t *dev)
+{
+    for (uint8_t i = 0; i < sched.chip_cnt; i++)
+    {
+        if (sched.chip[i].dev == dev)
+        {
+            return &sched.chip[i];
+        }
+    }
+    return NULL;
+}
+
+/* same effect: a second copy still waiting in the queue would play the same thing again */
+static bool rt903x_sched_same(const rt903x_sched_req_t *a, const rt903x_sched_req_t *b)
+{
+    return a->kind == b->kind && a->effect == b->effect && a->int_number == b->int_number;
+}
+
+static void rt903x_sched_remove(rt903x_sched_chip_t *chip, uint8_t index)
+{
+    memmove(&chip->queue[index], &chip->queue[index + 1],
+            (chip->count - index - 1) * sizeof(rt903x_sched_req_t));
+    chip->count--;
+}
+
+/* oldest request of the lowest priority, the one to give up when the queue is full */
+static uint8_t rt903x_sched_victim(rt903x_sched_chip_t *chip)
+{
+    uint8_t victim = 0;
+    for (uint8_t i = 1; i < chip->count; i++)
+    {
+        if (chip->queue[i].prio < chip->queue[victim].prio)
+        {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+/* oldest request of the highest priority becomes cur */
+static bool rt903x_sched_pop(rt903x_sched_chip_t *chip, rt903x_sched_req_t *req)
+{
+    bool found = false;
+    rt903x_spin_lock(&sched.lock);
+    if (chip->count > 0)
+    {
+        uint8_t best = 0;
+        for (uint8_t i = 1; i < chip->count; i++)
+        {
+            if (chip->queue[i].prio > chip->queue[best].prio)
+            {
+                best = i;
+            }
+        }
+        *req = chip->queue[best];
+        rt903x_sched_remove(chip, best);
+        chip->cur = *req;
+        found = true;
+    }
+    chip->playing = found;
+    chip->preempt = false;
+    chip->cancel = false;
+    rt903x_spin_unlock(&sched.lock);
+    return found;
+}
+
+static void rt903x_sched_stream_done(rt903x_dev_t *dev, int32_t status, void *arg)
+{
+    rt903x_sched_chip_t *chip = rt903x_sched_chip(dev);
+    if (chip == NULL)
+    {
+        return;
+    }
+    chip->done_gen = (uint32_t)(uintptr_t)arg;
+    rt903x_task_notify(chip->task, RT903X_SCHED_EVT_DONE);
+}
+
+static void rt903x_sched_cut(rt903x_sched_chip_t *chip)
+{
+    if (chip->streaming)
+    {
+        rt903x_stream_stop(chip->dev);
+    }
+    else
+    {
+        rt903x_go(chip->dev, 0);
+    }
+    chip->live = false;
+    chip->streaming = false;
+}
+
+/* start req, *wait_ms is how long the chip keeps playing after the call returns */
+static int32_t rt903x_sched_start(rt903x_sched_chip_t *chip, const rt903x_sched_req_t *req, uint32_t *wait_ms)
+{
+    rt903x_dev_t *dev = chip->dev;
+    int32_t res = 0;
+    int32_t ms = 0;
+    uint32_t begin = 0;
+    uint32_t spent = 0;
+    bool armed = false;
+    *wait_ms = 0;
+    switch (req->kind)
+    {
+        case RT903X_SCHED_CLICK:
+            ms = rt903x_Ram_effect_ms(req->effect, req->int_number);
+            CHECK_ERROR_RETURN(ms);
+            res = rt903x_Ram_trigger(dev, req->gain, req->effect, req->int_number, &armed);
+            CHECK_ERROR_RETURN(res);
+            if (armed)
+            {
+                chip->stats.click_armed++;
+            }
+            else
+            {
+                chip->stats.click_cold++;
+            }
+            // 下一次按键大概率还是这个效果，播完后在后台准备好
+            rt903x_Ram_arm(dev, req->gain, req->effect, req->int_number);
+            *wait_ms = (uint32_t)ms;
+            break;
+        case RT903X_SCHED_STREAM:
+            chip->gen++;
+            res = rt903x_stream_effect_start(dev, req->effect, req->gain, rt903x_sched_stream_done,
+                                             (void *)(uintptr_t)chip->gen);
+            if (res >= 0)
+            {
+                chip->streaming = true;
+                *wait_ms = RT903X_SCHED_STREAM_MAX_MS;
+                break;
+            }
+            // engine 不管这颗芯片时只能阻塞播完，期间不能被打断
+            res = rt903x_stream_play_effect(dev, req->effect);
+            break;
+        case RT903X_SCHED_LONG:
+            chip->gen++;
+            res = rt903x_play_long_start(dev, req->effect, req->gain, req->duration, rt903x_sched_stream_done,
+                                         (void *)(uintptr_t)chip->gen);
+            if (res > 0)
+            {
+                // 流播放：跟 STREAM 一样等 engine 回调，也能被 cut 打断；多给一个中断间隔的余量
+                chip->streaming = true;
+                *wait_ms = (uint32_t)req->duration + RT903X_STREAM_WAIT_MS;
+                res = 0;
+                break;
+            }
+            if (res == 0)
+            {
+                *wait_ms = req->duration;
+                break;
+            }
+            // engine 不管这颗芯片时只能阻塞播完，期间不能被打断
+            begin = rt903x_time_ms();
+            res = rt903x_play_long(dev, req->effect, req->gain, req->duration);
+            CHECK_ERROR_RETURN(res);
+            spent = rt903x_time_ms() - begin;
+            if (req->duration > spent)
+            {
+                *wait_ms = req->duration - spent;
+            }
+            break;
+        default:
+            return -1;
+    }
+    return res;
+}
+
+/* sleep until the effect ends on its own or a newer request cuts it */
+static void rt903x_sched_wait(rt903x_sched_chip_t *chip, uint32_t wait_ms)
+{
+    uint32_t begin = rt903x_time_ms();
+    chip->live = wait_ms > 0;
+    while (chip->live)
+    {
+        rt903x_spin_lock(&sched.lock);
+        bool preempt = chip->preempt;
+        bool cancel = chip->cancel;
+        rt903x_spin_unlock(&sched.lock);
+        if (preempt)
+        {
+            rt903x_sched_cut(chip);
+            if (!cancel)
+            {
+                chip->stats.preempted++;
+            }
+            return;
+        }
+        if (chip->streaming && chip->done_gen == chip->gen)
+        {
+            chip->live = false;
+            chip->streaming = false;
+            return;
+        }
+        uint32_t spent = rt903x_time_ms() - begin;
+        if (spent >= wait_ms)
+        {
+            if (chip->streaming)
+            {
+                RT903X_LOGW(TAG, "i2c%d 0x%02x stream effect overran, stopped",
+                         chip->dev->info.i2c_master_num, chip->dev->info.i2c_address);
+                rt903x_sched_cut(chip);
+            }
+            chip->live = false;
+            return;
+        }
+        rt903x_task_wait(wait_ms - spent);
+    }
+}
+
+static void rt903x_sched_task(void *arg)
+{
+    rt903x_sched_chip_t *chip = (rt903x_sched_chip_t *)arg;
+    rt903x_sched_req_t req;
+    for (;;)
+    {
+        if (!rt903x_sched_pop(chip, &req))
+        {
+            rt903x_task_wait(RT903X_WAIT_FOREVER);
+            continue;
+        }
+        uint32_t wait_ms = 0;
+        if (rt903x_sched_start(chip, &req, &wait_ms) < 0)
+        {
+            chip->stats.failed++;
+            chip->streaming = false;
+            continue;
+        }
+        chip->stats.played++;
+        rt903x_sched_wait(chip, wait_ms);
+    }
+}
+
+int32_t rt903x_sched_add(rt903x_dev_t *dev, uint8_t core_id)
+{
+    if (rt903x_sched_chip(dev) != NULL)
+    {
+        return 0;
+    }
+    if (sched.chip_cnt >= RT903X_SCHED_CHIP_MAX)
+    {
+        return -1;
+    }
+    rt903x_sched_chip_t *chip = &sched.chip[sched.chip_cnt];
+    memset(chip, 0, sizeof(rt903x_sched_chip_t));
+    chip->dev = dev;
+    if (rt903x_task_create(rt903x_sched_task, "rt903_sched", RT903X_SCHED_TASK_STACK, chip,
+                           RT903X_SCHED_TASK_PRIO, core_id, &chip->task) < 0)
+    {
+        RT903X_LOGE(TAG, "worker task create failed");
+        return -1;
+    }
+    rt903x_spin_lock(&sched.lock);
+    sched.chip_cnt++;
+    rt903x_spin_unlock(&sched.lock);
+    return 0;
+}
+
+int32_t rt903x_sched_submit(rt903x_dev_t *dev, const rt903x_sched_req_t *req)
+{
+    rt903x_sched_chip_t *chip = rt903x_sched_chip(dev);
+    if (chip == NULL || req == NULL)
+    {
+        return -1;
+    }
+    int32_t res = 0;
+    RT903X_SCHED_PRIO prio = req->prio;
+    rt903x_spin_lock(&sched.lock);
+    chip->stats.submitted++;
+    if (chip->held)
+    {
+        chip->stats.dropped++;
+        rt903x_spin_unlock(&sched.lock);
+        return -1;
+    }
+    uint8_t i = 0;
+    while (i < chip->count && !rt903x_sched_same(&chip->queue[i], req))
+    {
+        i++;
+    }
+    if (i < chip->count)
+    {
+        // 合并：参数用新的，优先级取高的，排队位置不变
+        prio = max(chip->queue[i].prio, req->prio);
+        chip->queue[i] = *req;
+        chip->queue[i].prio = prio;
+        chip->stats.coalesced++;
+    }
+    else
+    {
+        if (chip->count >= RT903X_SCHED_QUEUE_LEN)
+        {
+            uint8_t victim = rt903x_sched_victim(chip);
+            chip->stats.dropped++;
+            if (chip->queue[victim].prio > req->prio)
+            {
+                res = -1;
+            }
+            else
+            {
+                rt903x_sched_remove(chip, victim);
+            }
+        }
+        if (res >= 0)
+        {
+            chip->queue[chip->count++] = *req;
+            chip->stats.queued_max = max(chip->stats.queued_max, chip->count);
+        }
+    }
+    if (res >= 0 && chip->playing && prio >= chip->cur.prio)
+    {
+        chip->preempt = true;
+    }
+    rt903x_spin_unlock(&sched.lock);
+    if (res >= 0)
+    {
+        rt903x_task_notify(chip->task, RT903X_SCHED_EVT_REQ);
+    }
+    return res;
+}
+
+int32_t rt903x_sched_cancel(rt903x_dev_t *dev)
+{
+    rt903x_sched_chip_t *chip = rt903x_sched_chip(dev);
+    if (chip == NULL)
+    {
+        return -1;
+    }
+    rt903x_spin_lock(&sched.lock);
+    chip->count = 0;
+    if (chip->playing)
+    {
+        chip->preempt = true;
+        chip->cancel = true;
+    }
+    rt903x_spin_unlock(&sched.lock);
+    rt903x_task_notify(chip->task, RT903X_SCHED_EVT_REQ);
+    return 0;
+}
+
+int32_t rt903x_sched_hold(rt903x_dev_t *dev, bool hold)
+{
+    rt903x_sched_chip_t *chip = rt903x_sched_chip(dev);
+    if (chip == NULL)
+    {
+        return 0;
+    }
+    rt903x_spin_lock(&sched.lock);
+    chip->held = hold;
+    rt903x_spin_unlock(&sched.lock);
+    if (!hold)
+    {
+        return 0;
+    }
+    rt903x_sched_cancel(dev);
+    // 被打断的效果停下、worker 回到空闲后芯片才交出去
+    uint32_t begin = rt903x_time_ms();
+    for (;;)
+    {
+        rt903x_spin_lock(&sched.lock);
+        bool idle = !chip->playing;
+        rt903x_spin_unlock(&sched.lock);
+        if (idle)
+        {
+            return 0;
+        }
+        if (rt903x_time_ms() - begin >= RT903X_SCHED_HOLD_WAIT_MS)
+        {
+            return -1;
+        }
+        rt903x_sleep_ms(1);
+    }
+}
+
+void rt903x_sched_stats(rt903x_dev_t *dev, rt903x_sched_stats_t *stats)
+{
+    rt903x_sched_chip_t *chip = rt903x_sched_chip(dev);
+    if (chip == NULL)
+    {
+        memset(stats, 0, sizeof(rt903x_sched_stats_t));
+        return;
+    }
+    *stats = chip->stats;
+}
+
+#ifdef ESP_PLATFORM
+static int rt903x_sched_cmd(int argc, char **argv)
+{
+    for (uint8_t i = 0; i < sched.chip_cnt; i++)
+    {
+        rt903x_sched_chip_t *chip = &sched.chip[i];
+        if (argc > 1 && strcmp(argv[1], "reset") == 0)
+        {
+            memset(&chip->stats, 0, sizeof(rt903x_sched_stats_t));
+            chip->dev->trig_armed = 0;
+            chip->dev->trig_cold = 0;
+            continue;
+        }
+        printf("rt903 i2c%d 0x%02x: queued:%u submitted:%u played:%u coalesced:%u preempted:%u dropped:%u failed:%u queued_max:%u"
+               " click_armed:%u click_cold:%u trig_armed:%u trig_cold:%u\n",
+               chip->dev->info.i2c_master_num, chip->dev->info.i2c_address, chip->count,
+               (unsigned)chip->stats.submitted, (unsigned)chip->stats.played, (unsigned)chip->stats.coalesced,
+               (unsigned)chip->stats.preempted, (unsigned)chip->stats.dropped, (unsigned)chip->stats.failed,
+               chip->stats.queued_max, (unsigned)chip->stats.click_armed, (unsigned)chip->stats.click_cold,
+               (unsigned)chip->dev->trig_armed, (unsigned)chip->dev->trig_cold);
+    }
+    return 0;
+}
+
+esp_err_t rt903x_sched_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903sched",
+        .help = "rt903 effect scheduler and press (armed/cold) counters per chip, 'rt903sched reset' clears them",
+        .hint = NULL,
+        .func = &rt903x_sched_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+#endif
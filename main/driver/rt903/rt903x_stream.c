@@ -0,0 +1,828 @@
+#include "rt903x_stream.h"
+#include "rt903x_reg.h"
+#include "ics_util.h"
+#include "rt903x_port.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#include "esp_console.h"
+#endif
+
+static const char *TAG = "rt903-stream";
+
+#define RT903X_STREAM_EVT_INT   (1 << 0)    /* INT line fell */
+#define RT903X_STREAM_EVT_KICK  (1 << 1)    /* producer published into a ring that ran dry */
+#define RT903X_PIPE_EVT_SPACE   (1 << 0)    /* engine freed a ring block, or the pipe was cancelled */
+
+typedef struct
+{
+    rt903x_dev_t *dev;
+    rt903x_sem_t event;             /*!< given to a rt903x_stream_wait_int caller */
+    volatile uint8_t int_status;    /*!< INT_STATUS bits not yet taken by the waiter */
+    bool armed;                     /*!< sources unmasked, the engine reads this chip on INT */
+    bool claimed;                   /*!< a stream owns the chip from its start until it is detached */
+    volatile uint8_t producers;     /*!< pipe producer tasks of this chip that have not left yet */
+
+    /* buffer stream refilled by the engine task itself */
+    bool active;
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t pos;
+    struct rt903x_pipe *pipe;       /*!< ring source instead of data/len when not NULL */
+    rt903x_stream_done_t cb;
+    void *arg;
+    rt903x_pipe_stats_t pipe_stats;
+} rt903x_stream_slot_t;
+
+/*
+ * Sample ring between a producer task on one core (DSP) and the engine task on the
+ * other (I2C). The producer publishes whole blocks, the engine drains them into the
+ * FIFO on FIFO_AE, so generation never sits in the refill path.
+ */
+typedef struct rt903x_pipe
+{
+    uint8_t data[RT903X_PIPE_BLOCKS][RT903X_PIPE_BLOCK_SIZE];
+    uint16_t len[RT903X_PIPE_BLOCKS];
+    uint32_t head;                  /*!< blocks published by the producer */
+    uint32_t tail;                  /*!< blocks fully written to the FIFO */
+    uint16_t tail_off;              /*!< bytes of the tail block already written */
+    uint32_t owed;                  /*!< FIFO space the last drain left empty, refilled on a kick */
+    volatile bool eos;              /*!< producer published its last block */
+    volatile bool cancel;
+    rt903x_task_t producer;         /*!< NULL once the producer has left */
+    uint8_t waking;                 /*!< notifies of producer in flight, it does not exit before they are done */
+    rt903x_pipe_fill_t fill;
+    void *ctx;
+    rt903x_pipe_release_t release;  /*!< hands ctx back once the pipe is gone, may be NULL */
+    rt903x_pipe_stats_t *stats;
+    volatile uint8_t *producers;    /*!< the slot's count, dropped once fill() is never called again */
+    uint8_t refs;                   /*!< producer + engine */
+} rt903x_pipe_t;
+
+typedef struct
+{
+    bool started;
+    uint8_t int_gpio;
+    rt903x_task_t task;
+    rt903x_spin_t lock;
+    uint8_t slot_cnt;
+    rt903x_stream_slot_t slot[RT903X_STREAM_CHIP_MAX];
+} rt903x_stream_engine_t;
+
+static rt903x_stream_engine_t stream_engine = {
+    .lock = RT903X_SPIN_INIT,
+};
+
+static rt903x_stream_slot_t *rt903x_stream_slot(rt903x_dev_t *dev)
+{
+    for (uint8_t i = 0; i < stream_engine.slot_cnt; i++)
+    {
+        if (stream_engine.slot[i].dev == dev)
+        {
+            return &stream_engine.slot[i];
+        }
+    }
+    return NULL;
+}
+
+/* both follow the chip's current RAM partition, see rt903x_ram_partition */
+static int32_t rt903x_stream_fifo_size(rt903x_dev_t *dev)
+{
+    return rt903x_ram_fifo_size(dev);
+}
+
+/* free space in the FIFO when FIFO_AE fires */
+static int32_t rt903x_stream_refill_size(rt903x_dev_t *dev)
+{
+    return rt903x_ram_refill_size(dev);
+}
+
+static int32_t rt903x_stream_mask(rt903x_dev_t *dev, bool arm)
+{
+    uint8_t mask = arm ? (uint8_t)(BIT_INTM_ALL & ~RT903X_STREAM_INT_SRC) : (uint8_t)(BIT_INTM_ALL & ~RT903X_STREAM_IDLE_SRC);
+    return rt903x_write_reg(dev, REG_INT_MASK, mask);
+}
+
+static void RT903X_ISR_ATTR rt903x_stream_isr(void *arg)
+{
+    rt903x_task_notify_isr(stream_engine.task, RT903X_STREAM_EVT_INT);
+}
+
+static uint32_t rt903x_pipe_count(rt903x_pipe_t *pipe)
+{
+    rt903x_spin_lock(&stream_engine.lock);
+    uint32_t count = pipe->head - pipe->tail;
+    rt903x_spin_unlock(&stream_engine.lock);
+    return count;
+}
+
+static void rt903x_pipe_release(rt903x_pipe_t *pipe)
+{
+    bool last;
+    rt903x_spin_lock(&stream_engine.lock);
+    last = (--pipe->refs == 0);
+    rt903x_spin_unlock(&stream_engine.lock);
+    if (last)
+    {
+        if (pipe->release != NULL)
+        {
+            pipe->release(pipe->ctx);
+        }
+        free(pipe);
+    }
+}
+
+/*
+ * Wake the producer. The notify can yield, so it must not run inside the critical section;
+ * waking keeps the handle valid in between, the producer waits for it before it exits.
+ */
+static void rt903x_pipe_wake(rt903x_pipe_t *pipe)
+{
+    rt903x_spin_lock(&stream_engine.lock);
+    rt903x_task_t producer = pipe->producer;
+    if (producer != NULL)
+    {
+        pipe->waking++;
+    }
+    rt903x_spin_unlock(&stream_engine.lock);
+    if (producer != NULL)
+    {
+        rt903x_task_notify(producer, RT903X_PIPE_EVT_SPACE);
+        rt903x_spin_lock(&stream_engine.lock);
+        pipe->waking--;
+        rt903x_spin_unlock(&stream_engine.lock);
+    }
+}
+
+static void rt903x_pipe_cancel(rt903x_pipe_t *pipe)
+{
+    rt903x_spin_lock(&stream_engine.lock);
+    pipe->cancel = true;
+    rt903x_spin_unlock(&stream_engine.lock);
+    rt903x_pipe_wake(pipe);
+    rt903x_pipe_release(pipe);
+}
+
+static void rt903x_pipe_task(void *arg)
+{
+    rt903x_pipe_t *pipe = (rt903x_pipe_t *)arg;
+    while (!pipe->cancel)
+    {
+        if (rt903x_pipe_count(pipe) >= RT903X_PIPE_BLOCKS)
+        {
+            // 环满了，等消费者腾出一块
+            pipe->stats->backpressure++;
+            rt903x_task_wait(RT903X_WAIT_FOREVER);
+            continue;
+        }
+        uint8_t idx = pipe->head % RT903X_PIPE_BLOCKS;
+        int32_t n = pipe->fill(pipe->ctx, pipe->data[idx], RT903X_PIPE_BLOCK_SIZE);
+        if (n <= 0)
+        {
+            break;
+        }
+        pipe->len[idx] = (uint16_t)n;
+        rt903x_spin_lock(&stream_engine.lock);
+        pipe->head++;
+        bool kick = (pipe->owed > 0);
+        rt903x_spin_unlock(&stream_engine.lock);
+        pipe->stats->produced += n;
+        if (kick)
+        {
+            // 上次 FIFO_AE 没填满，FIFO 不会再低于阈值，得叫 engine 来补
+            rt903x_task_notify(stream_engine.task, RT903X_STREAM_EVT_KICK);
+        }
+    }
+    rt903x_spin_lock(&stream_engine.lock);
+    pipe->eos = true;
+    pipe->producer = NULL;
+    bool waking = (pipe->waking > 0);
+    rt903x_spin_unlock(&stream_engine.lock);
+    while (waking)
+    {
+        // 还有人拿着本任务的句柄在 notify，等它做完再退出
+        rt903x_sleep_ms(1);
+        rt903x_spin_lock(&stream_engine.lock);
+        waking = (pipe->waking > 0);
+        rt903x_spin_unlock(&stream_engine.lock);
+    }
+    rt903x_spin_lock(&stream_engine.lock);
+    (*pipe->producers)--;
+    rt903x_spin_unlock(&stream_engine.lock);
+    rt903x_pipe_release(pipe);
+    rt903x_task_exit();
+}
+
+/* write up to want bytes from the ring into the FIFO as one transfer, returns bytes written */
+static int32_t rt903x_pipe_drain(rt903x_pipe_t *pipe, rt903x_dev_t *dev, int32_t want)
+{
+    i2c_iovec_t iov[RT903X_PIPE_BLOCKS];
+    uint8_t iovcnt = 0;
+    uint32_t count = rt903x_pipe_count(pipe);
+    uint32_t seen = pipe->tail + count;
+    uint32_t block = pipe->tail;
+    uint16_t off = pipe->tail_off;
+    int32_t total = 0;
+    while (total < want && block != seen && iovcnt < RT903X_PIPE_BLOCKS)
+    {
+        uint8_t idx = block % RT903X_PIPE_BLOCKS;
+        uint16_t n = (uint16_t)min((int32_t)(pipe->len[idx] - off), want - total);
+        iov[iovcnt].buf = pipe->data[idx] + off;
+        iov[iovcnt].len = n;
+        iovcnt++;
+        total += n;
+        off += n;
+        if (off == pipe->len[idx])
+        {
+            block++;
+            off = 0;
+        }
+    }
+    if (iovcnt > 0 && rt903x_stream_datav(dev, iov, iovcnt) < 0)
+    {
+        return -1;
+    }
+    pipe->stats->consumed += total;
+    bool short_write = (total < want && !pipe->eos);
+    if (short_write)
+    {
+        // FIFO 有空间但生产者还没跟上
+        pipe->stats->underrun++;
+    }
+    bool freed = (block != pipe->tail);
+    rt903x_spin_lock(&stream_engine.lock);
+    pipe->tail = block;
+    pipe->tail_off = off;
+    pipe->owed = short_write ? (uint32_t)(want - total) : 0;
+    // 生产者在上面写 FIFO 时又发布了一块，它看到的 owed 还是旧值
+    bool kick = (pipe->owed > 0 && pipe->head != seen);
+    rt903x_spin_unlock(&stream_engine.lock);
+    if (freed)
+    {
+        rt903x_pipe_wake(pipe);
+    }
+    if (kick)
+    {
+        rt903x_task_notify(stream_engine.task, RT903X_STREAM_EVT_KICK);
+    }
+    return total;
+}
+
+/*
+ * Arming rewrites RAM and stops the chip, so a stream claims the chip under arm_lock and
+ * arming checks rt903x_stream_busy under the same lock. The mutex itself is not held for
+ * the whole stream: the stream ends on the engine task and only the holder may give it.
+ */
+static bool rt903x_stream_claim(rt903x_stream_slot_t *slot)
+{
+    rt903x_mutex_lock(&slot->dev->arm_lock);
+    bool free = !slot->claimed;
+    if (free)
+    {
+        rt903x_spin_lock(&stream_engine.lock);
+        slot->claimed = true;
+        rt903x_spin_unlock(&stream_engine.lock);
+    }
+    rt903x_mutex_unlock(&slot->dev->arm_lock);
+    return free;
+}
+
+/* true when this call ended a live stream: engine finish and rt903x_stream_stop can race,
+ * only the one that detaches first gets to run (or skip) the callback */
+static bool rt903x_stream_detach(rt903x_stream_slot_t *slot)
+{
+    rt903x_spin_lock(&stream_engine.lock);
+    rt903x_pipe_t *pipe = slot->pipe;
+    bool live = slot->active;
+    slot->armed = false;
+    slot->active = false;
+    slot->claimed = false;
+    slot->pipe = NULL;
+    rt903x_spin_unlock(&stream_engine.lock);
+    if (pipe != NULL)
+    {
+        rt903x_pipe_cancel(pipe);
+    }
+    return live;
+}
+
+static void rt903x_stream_finish(rt903x_stream_slot_t *slot, int32_t status)
+{
+    rt903x_stream_done_t cb = slot->cb;
+    void *arg = slot->arg;
+    if (status < 0)
+    {
+        rt903x_go(slot->dev, 0);
+    }
+    rt903x_stream_mask(slot->dev, false);
+    if (rt903x_stream_detach(slot) && cb != NULL)
+    {
+        cb(slot->dev, status, arg);
+    }
+}
+
+static void rt903x_stream_service(rt903x_stream_slot_t *slot)
+{
+    uint8_t status = 0;
+    int32_t res = rt903x_read_reg(slot->dev, REG_INT_STATUS, &status);
+    if (res < 0)
+    {
+        if (slot->active)
+        {
+            rt903x_stream_finish(slot, -1);
+        }
+        return;
+    }
+    if (status == 0)
+    {
+        return;
+    }
+    if (status & BIT_INTS_PROTECTION)
+    {
+        rt903x_shadow_invalidate(slot->dev);
+    }
+
+    if (!slot->active)
+    {
+        // 调用方自己填数据，这里只把状态转交给它
+        rt903x_spin_lock(&stream_engine.lock);
+        slot->int_status |= status;
+        rt903x_spin_unlock(&stream_engine.lock);
+        rt903x_sem_give(&slot->event);
+        return;
+    }
+
+    if (status & BIT_INTS_PROTECTION)
+    {
+        RT903X_LOGW(TAG, "chip 0x%02x protection while streaming", slot->dev->info.i2c_address);
+        rt903x_prot_recover(slot->dev);
+        rt903x_stream_finish(slot, RT903X_PROT_EVENT);
+        return;
+    }
+    // 生产者还没结束或环里还有数据，PLAYDONE 就是 FIFO 被放空了，不是播完
+    bool starved = slot->pipe != NULL && (!slot->pipe->eos || rt903x_pipe_count(slot->pipe) > 0);
+    if ((status & BIT_INTS_FIFO_AE) && slot->pipe != NULL)
+    {
+        if (rt903x_pipe_drain(slot->pipe, slot->dev, rt903x_stream_refill_size(slot->dev)) < 0)
+        {
+            rt903x_stream_finish(slot, -1);
+            return;
+        }
+    }
+    else if ((status & BIT_INTS_FIFO_AE) && slot->pos < slot->len)
+    {
+        uint32_t size = min((uint32_t)rt903x_stream_refill_size(slot->dev), slot->len - slot->pos);
+        if (rt903x_stream_data(slot->dev, slot->data + slot->pos, size) < 0)
+        {
+            rt903x_stream_finish(slot, -1);
+            return;
+        }
+        slot->pos += size;
+    }
+    if (status & BIT_INTS_PLAYDONE)
+    {
+        slot->dev->playing = false;
+        if (starved)
+        {
+            RT903X_LOGW(TAG, "chip 0x%02x FIFO ran dry before the producer finished", slot->dev->info.i2c_address);
+        }
+        rt903x_stream_finish(slot, starved ? -1 : 0);
+    }
+}
+
+/* a producer caught up after an underrun: write what the last drain left empty */
+static void rt903x_stream_refeed(void)
+{
+    for (uint8_t i = 0; i < stream_engine.slot_cnt; i++)
+    {
+        rt903x_stream_slot_t *slot = &stream_engine.slot[i];
+        if (slot->active && slot->pipe != NULL && slot->pipe->owed > 0
+            && rt903x_pipe_drain(slot->pipe, slot->dev, (int32_t)slot->pipe->owed) < 0)
+        {
+            rt903x_stream_finish(slot, -1);
+        }
+    }
+}
+
+/* a chip nobody streams to only pulls the line for PROTECTION, e.g. during a RAM play */
+static void rt903x_stream_idle_check(rt903x_stream_slot_t *slot)
+{
+    uint8_t status = 0;
+    if (rt903x_read_reg(slot->dev, REG_INT_STATUS, &status) < 0 || (status & BIT_INTS_PROTECTION) == 0)
+    {
+        return;
+    }
+    RT903X_LOGW(TAG, "chip 0x%02x protection while idle or in RAM play", slot->dev->info.i2c_address);
+    rt903x_prot_recover(slot->dev);
+}
+
+static void rt903x_stream_task(void *arg)
+{
+    for (;;)
+    {
+        uint32_t bits = rt903x_task_wait(RT903X_STREAM_IDLE_CHECK_MS);
+        if (bits & RT903X_STREAM_EVT_KICK)
+        {
+            rt903x_stream_refeed();
+        }
+        if ((bits & RT903X_STREAM_EVT_INT) == 0 && rt903x_irq_level(stream_engine.int_gpio) != 0)
+        {
+            continue;
+        }
+        // 多颗芯片共用一根线，线一直为低说明还有芯片没处理完
+        uint8_t pass = 0;
+        do
+        {
+            for (uint8_t i = 0; i < stream_engine.slot_cnt; i++)
+            {
+                rt903x_stream_slot_t *slot = &stream_engine.slot[i];
+                if (slot->armed)
+                {
+                    rt903x_stream_service(slot);
+                }
+            }
+            // 流播放的芯片都处理完线还是低，才去读空闲的芯片
+            for (uint8_t i = 0; i < stream_engine.slot_cnt && rt903x_irq_level(stream_engine.int_gpio) == 0; i++)
+            {
+                rt903x_stream_slot_t *slot = &stream_engine.slot[i];
+                if (!slot->armed)
+                {
+                    rt903x_stream_idle_check(slot);
+                }
+            }
+            if (++pass >= RT903X_STREAM_SERVICE_MAX)
+            {
+                rt903x_sleep_ms(1);
+                pass = 0;
+            }
+        } while (rt903x_irq_level(stream_engine.int_gpio) == 0 && stream_engine.slot_cnt > 0);
+    }
+}
+
+typedef struct
+{
+    rt903x_sem_t done;
+    int32_t status;
+} rt903x_stream_wait_t;
+
+static void rt903x_stream_wake(rt903x_dev_t *dev, int32_t status, void *arg)
+{
+    rt903x_stream_wait_t *wait = (rt903x_stream_wait_t *)arg;
+    wait->status = status;
+    rt903x_sem_give(&wait->done);
+}
+
+int32_t rt903x_stream_engine_init(uint8_t int_gpio, uint8_t core_id)
+{
+    if (stream_engine.started)
+    {
+        return 0;
+    }
+    stream_engine.int_gpio = int_gpio;
+
+    if (rt903x_task_create(rt903x_stream_task, "rt903_stream", RT903X_STREAM_TASK_STACK,
+                           NULL, RT903X_STREAM_TASK_PRIO, core_id, &stream_engine.task) < 0)
+    {
+        RT903X_LOGE(TAG, "stream task create failed");
+        return -1;
+    }
+    if (rt903x_irq_attach(int_gpio, rt903x_stream_isr, NULL) < 0)
+    {
+        RT903X_LOGE(TAG, "INT gpio %d isr add failed", int_gpio);
+        return -1;
+    }
+    stream_engine.started = true;
+    return 0;
+}
+
+int32_t rt903x_stream_engine_add(rt903x_dev_t *dev)
+{
+    if (rt903x_stream_slot(dev) != NULL)
+    {
+        return 0;
+    }
+    if (stream_engine.slot_cnt >= RT903X_STREAM_CHIP_MAX)
+    {
+        return -1;
+    }
+    int32_t res = rt903x_stream_mask(dev, false);
+    CHECK_ERROR_RETURN(res);
+    res = rt903x_write_reg(dev, REG_INT_CFG, BIT_INT_CFG_PIN_EN);
+    CHECK_ERROR_RETURN(res);
+    res = rt903x_clear_int(dev);
+    CHECK_ERROR_RETURN(res);
+
+    rt903x_stream_slot_t *slot = &stream_engine.slot[stream_engine.slot_cnt];
+    memset(slot, 0, sizeof(rt903x_stream_slot_t));
+    slot->dev = dev;
+    rt903x_sem_init(&slot->event, 1, 0);
+    // 先填好再加计数，engine 任务不会看到半初始化的 slot
+    rt903x_spin_lock(&stream_engine.lock);
+    stream_engine.slot_cnt++;
+    rt903x_spin_unlock(&stream_engine.lock);
+    return 0;
+}
+
+bool rt903x_stream_engine_owns(rt903x_dev_t *dev)
+{
+    return stream_engine.started && rt903x_stream_slot(dev) != NULL;
+}
+
+bool rt903x_stream_busy(rt903x_dev_t *dev)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    return slot != NULL && (slot->claimed || slot->producers > 0);
+}
+
+/* RAM as FIFO and INT_STATUS cleared, before the FIFO is primed */
+static int32_t rt903x_stream_prepare(rt903x_dev_t *dev)
+{
+    int32_t res = 0;
+    res = rt903x_write_reg(dev, REG_RAM_CFG, 0x01);
+    CHECK_ERROR_RETURN(res);
+    // 调用方设好模式之后、claim 之前可能有一次 arm 把它改回了 RAM 播放
+    res = rt903x_play_mode(dev, MODE_STREAM_PLAY);
+    CHECK_ERROR_RETURN(res);
+    // Clear all interruptions
+    return rt903x_clear_int(dev);
+}
+
+/* FIFO is primed: hand the chip to the engine, unmask and GO */
+static int32_t rt903x_stream_go_live(rt903x_stream_slot_t *slot, rt903x_stream_done_t cb, void *arg)
+{
+    slot->cb = cb;
+    slot->arg = arg;
+    rt903x_spin_lock(&stream_engine.lock);
+    slot->active = true;
+    slot->armed = true;
+    rt903x_spin_unlock(&stream_engine.lock);
+
+    int32_t res = rt903x_stream_mask(slot->dev, true);
+    if (res >= 0)
+    {
+        res = rt903x_go(slot->dev, 1);
+    }
+    if (res < 0)
+    {
+        rt903x_stream_mask(slot->dev, false);
+        rt903x_stream_detach(slot);
+        return -1;
+    }
+    return 0;
+}
+
+int32_t rt903x_stream_start(rt903x_dev_t *dev, const uint8_t *data, uint32_t len,
+                            rt903x_stream_done_t cb, void *arg)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (!stream_engine.started || slot == NULL || data == NULL || len == 0 || !rt903x_stream_claim(slot))
+    {
+        return -1;
+    }
+    uint32_t size = min((uint32_t)rt903x_stream_fifo_size(dev), len);
+    int32_t res = rt903x_stream_prepare(dev);
+    if (res >= 0)
+    {
+        res = rt903x_stream_data(dev, data, size);
+    }
+    if (res < 0)
+    {
+        rt903x_stream_detach(slot);
+        return -1;
+    }
+
+    slot->data = data;
+    slot->len = len;
+    slot->pos = size;
+    return rt903x_stream_go_live(slot, cb, arg);
+}
+
+int32_t rt903x_stream_start_pipe(rt903x_dev_t *dev, rt903x_pipe_fill_t fill, void *ctx, rt903x_pipe_release_t release,
+                                 uint8_t producer_core, rt903x_stream_done_t cb, void *arg)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (!stream_engine.started || slot == NULL || fill == NULL || !rt903x_stream_claim(slot))
+    {
+        if (release != NULL)
+        {
+            release(ctx);
+        }
+        return -1;
+    }
+    rt903x_pipe_t *pipe = NULL;
+    if (rt903x_stream_prepare(dev) < 0 || (pipe = (rt903x_pipe_t *)calloc(1, sizeof(rt903x_pipe_t))) == NULL)
+    {
+        rt903x_stream_detach(slot);
+        if (release != NULL)
+        {
+            release(ctx);
+        }
+        return -1;
+    }
+    pipe->fill = fill;
+    pipe->ctx = ctx;
+    pipe->release = release;
+    pipe->stats = &slot->pipe_stats;
+    pipe->producers = &slot->producers;
+    pipe->refs = 2;
+    rt903x_spin_lock(&stream_engine.lock);
+    slot->producers++;
+    rt903x_spin_unlock(&stream_engine.lock);
+    if (rt903x_task_create(rt903x_pipe_task, "rt903_pipe", RT903X_PIPE_TASK_STACK, pipe,
+                           RT903X_PIPE_TASK_PRIO, producer_core, &pipe->producer) < 0)
+    {
+        rt903x_spin_lock(&stream_engine.lock);
+        slot->producers--;
+        rt903x_spin_unlock(&stream_engine.lock);
+        free(pipe);
+        rt903x_stream_detach(slot);
+        if (release != NULL)
+        {
+            release(ctx);
+        }
+        return -1;
+    }
+
+    // 先让生产者攒够一整个 FIFO 再 GO
+    int32_t prime = min(rt903x_stream_fifo_size(dev), RT903X_PIPE_BLOCKS * RT903X_PIPE_BLOCK_SIZE);
+    int64_t prime_end_us = rt903x_time_us() + (int64_t)RT903X_PIPE_PRIME_MS * 1000;
+    while (!pipe->eos && rt903x_pipe_count(pipe) * RT903X_PIPE_BLOCK_SIZE < (uint32_t)prime && rt903x_time_us() < prime_end_us)
+    {
+        rt903x_sleep_ms(1);
+    }
+    int32_t res = rt903x_pipe_drain(pipe, dev, prime);
+    if (res <= 0)
+    {
+        rt903x_pipe_cancel(pipe);
+        rt903x_stream_detach(slot);
+        return -1;
+    }
+    slot->data = NULL;
+    slot->len = 0;
+    slot->pos = 0;
+    slot->pipe = pipe;
+    return rt903x_stream_go_live(slot, cb, arg);
+}
+
+/* the engine's progress on the chip's current stream, moves with every FIFO write */
+static uint32_t rt903x_stream_fed(rt903x_stream_slot_t *slot)
+{
+    return slot->pos + slot->pipe_stats.consumed;
+}
+
+bool rt903x_stream_wait_done(rt903x_dev_t *dev, rt903x_sem_t *done)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (slot == NULL)
+    {
+        return false;
+    }
+    uint32_t fed = rt903x_stream_fed(slot);
+    while (!rt903x_sem_take(done, RT903X_STREAM_WAIT_MS))
+    {
+        uint32_t now = rt903x_stream_fed(slot);
+        if (now != fed)
+        {
+            fed = now;
+            continue;
+        }
+        RT903X_LOGW(TAG, "chip 0x%02x no FIFO refill for %d ms, stream stopped", dev->info.i2c_address,
+                    RT903X_STREAM_WAIT_MS);
+        rt903x_go(dev, 0);
+        rt903x_stream_mask(dev, false);
+        if (rt903x_stream_detach(slot))
+        {
+            return false;
+        }
+        // engine 抢先结束了这次播放，它的回调马上就到
+        return rt903x_sem_take(done, RT903X_STREAM_WAIT_MS);
+    }
+    return true;
+}
+
+/* rt903x_stream_start_pipe and block until the stream has played out */
+int32_t rt903x_stream_run_pipe(rt903x_dev_t *dev, rt903x_pipe_fill_t fill, void *ctx, uint8_t producer_core)
+{
+    rt903x_stream_wait_t wait = {.status = -1};
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    rt903x_sem_init(&wait.done, 1, 0);
+    int32_t res = rt903x_stream_start_pipe(dev, fill, ctx, NULL, producer_core, rt903x_stream_wake, &wait);
+    if (res >= 0)
+    {
+        res = rt903x_stream_wait_done(dev, &wait.done) ? wait.status : -1;
+    }
+    // 被取消的生产者可能还在 fill() 里，等它走了 ctx 才能交还给调用方（或者拿来重试）
+    while (slot != NULL && slot->producers > 0)
+    {
+        rt903x_sleep_ms(1);
+    }
+    rt903x_sem_deinit(&wait.done);
+    return res;
+}
+
+void rt903x_stream_pipe_stats(rt903x_dev_t *dev, rt903x_pipe_stats_t *stats)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (slot == NULL)
+    {
+        memset(stats, 0, sizeof(rt903x_pipe_stats_t));
+        return;
+    }
+    *stats = slot->pipe_stats;
+}
+
+int32_t rt903x_stream_stop(rt903x_dev_t *dev)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (slot == NULL)
+    {
+        return -1;
+    }
+    int32_t res = rt903x_go(dev, 0);
+    rt903x_stream_mask(dev, false);
+    rt903x_stream_detach(slot);
+    return res;
+}
+
+int32_t rt903x_stream_int_arm(rt903x_dev_t *dev, bool arm)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (!stream_engine.started || slot == NULL || slot->active)
+    {
+        return -1;
+    }
+    if (arm)
+    {
+        // 调用方自己灌 FIFO 也是流播放，一样要占住芯片
+        if (slot->armed || !rt903x_stream_claim(slot))
+        {
+            return -1;
+        }
+        rt903x_spin_lock(&stream_engine.lock);
+        slot->int_status = 0;
+        rt903x_spin_unlock(&stream_engine.lock);
+        rt903x_sem_take(&slot->event, 0);
+    }
+    int32_t res = rt903x_stream_mask(dev, arm);
+    if (res < 0 || !arm)
+    {
+        rt903x_stream_detach(slot);
+        return (res < 0) ? -1 : 0;
+    }
+    rt903x_spin_lock(&stream_engine.lock);
+    slot->armed = true;
+    rt903x_spin_unlock(&stream_engine.lock);
+    return 0;
+}
+
+int32_t rt903x_stream_wait_int(rt903x_dev_t *dev, uint8_t *status, uint32_t timeout_ms)
+{
+    rt903x_stream_slot_t *slot = rt903x_stream_slot(dev);
+    if (slot == NULL || !slot->armed || slot->active)
+    {
+        return -1;
+    }
+    if (!rt903x_sem_take(&slot->event, timeout_ms))
+    {
+        return -1;
+    }
+    rt903x_spin_lock(&stream_engine.lock);
+    *status = slot->int_status;
+    slot->int_status = 0;
+    rt903x_spin_unlock(&stream_engine.lock);
+    return 0;
+}
+
+#ifdef ESP_PLATFORM
+static int rt903x_stream_cmd(int argc, char **argv)
+{
+    for (uint8_t i = 0; i < stream_engine.slot_cnt; i++)
+    {
+        rt903x_stream_slot_t *slot = &stream_engine.slot[i];
+        if (argc > 1 && strcmp(argv[1], "reset") == 0)
+        {
+            memset(&slot->pipe_stats, 0, sizeof(rt903x_pipe_stats_t));
+            continue;
+        }
+        printf("rt903 i2c%d 0x%02x: %s produced:%u consumed:%u backpressure:%u underrun:%u\n",
+               slot->dev->info.i2c_master_num, slot->dev->info.i2c_address, slot->active ? "streaming" : "idle",
+               (unsigned)slot->pipe_stats.produced, (unsigned)slot->pipe_stats.consumed,
+               (unsigned)slot->pipe_stats.backpressure, (unsigned)slot->pipe_stats.underrun);
+    }
+    return 0;
+}
+
+esp_err_t rt903x_stream_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903stream",
+        .help = "rt903 stream pipeline counters per chip, 'rt903stream reset' clears them",
+        .hint = NULL,
+        .func = &rt903x_stream_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+#endif
@@ -1,6 +1,7 @@
-#include "i2c_adapter.h"
 #include "rt903x_reg.h"
 #include "rt903x.h"
+#include "rt903x_stream.h"
+#include "rt903x_port.h"
 #include "ics_util.h"
 #include "string.h"
 #include <stdint.h>
@@ -56,38 +57,42 @@ static const uint32_t effect_play_index_len[] =
     ARRAY_LENGTH(eight_6k),
 };
 
-uint8_t stream_demo_flag = 0;
-uint32_t data_demo_index = 0;
-
-int32_t stream_play_demo_proc(DEF_RT903_INFO i2c_config, const uint8_t *stream_data, uint32_t stream_data_len)
+/* index: bytes already in the FIFO, refill: FIFO_AE seen; per call, several chips stream at once */
+static int32_t stream_play_demo_proc(rt903x_dev_t *dev, const uint8_t *stream_data, uint32_t stream_data_len,
+                                     uint32_t *data_index, uint8_t *refill)
 {
     uint8_t reg_val = 0;
     while (1)
     {
-        int16_t res = I2CReadReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_INT_STATUS, &reg_val, 1);
+        int16_t res = rt903x_read_reg(dev, REG_INT_STATUS, &reg_val);
         CHECK_ERROR_RETURN(res);
         if ((reg_val & BIT_INTS_PLAYDONE) > 0)
         {
             return 0;
         }
+        if ((reg_val & BIT_INTS_PROTECTION) > 0)
+        {
+            // 保护后芯片不会再报 AE/PLAYDONE，不处理就在这里空转
+            rt903x_prot_recover(dev);
+            return RT903X_PROT_EVENT;
+        }
         if ((reg_val & BIT_INTS_FIFO_AF) > 0)
         {
-            stream_demo_flag = 0;
+            *refill = 0;
         }
         if ((reg_val & BIT_INTS_FIFO_AE) > 0)
         {
-            stream_demo_flag = 1;
+            *refill = 1;
         }
-        if (stream_demo_flag == 1)
+        if (*refill == 1 && *data_index < stream_data_len)
         {
-            stream_demo_flag = 0;
-            int32_t stream_size = ((rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL)
-                - ((rt903x_config.ram_param.FifoAEH << 8) | rt903x_config.ram_param.FifoAEL);
-            stream_size = min(stream_data_len - data_demo_index, stream_size);
-            res = rt903x_stream_data(i2c_config, (const uint8_t*)stream_data + data_demo_index, stream_size);
+            *refill = 0;
+            int32_t stream_size = rt903x_ram_refill_size(dev);
+            stream_size = min(stream_data_len - *data_index, stream_size);
+            res = rt903x_stream_data(dev, (const uint8_t*)stream_data + *data_index, stream_size);
             CHECK_ERROR_RETURN(res);
-            data_demo_index += stream_size;
-            if (data_demo_index >= stream_data_len)
+            *data_index += stream_size;
+            if (*data_index >= stream_data_len)
             {
                 break;
             }
@@ -97,35 +102,100 @@ int32_t stream_play_demo_proc(DEF_RT903_INFO i2c_config, const uint8_t *stream_d
     return 0;
 }
 
-int32_t rt903x_stream_play_demo(DEF_RT903_INFO i2c_config, const uint8_t *stream_data, uint32_t stream_data_len)
+typedef struct
+{
+    rt903x_sem_t done;
+    int32_t status;
+} stream_play_demo_wait_t;
+
+static void stream_play_demo_done(rt903x_dev_t *dev, int32_t status, void *arg)
+{
+    stream_play_demo_wait_t *wait = (stream_play_demo_wait_t *)arg;
+    wait->status = status;
+    rt903x_sem_give(&wait->done);
+}
+
+/* INT 脚在 engine 里，FIFO 由 engine 任务在 FIFO_AE 中断时补数据，这里只等播放结束 */
+static int32_t stream_play_demo_int(rt903x_dev_t *dev, const uint8_t *stream_data, uint32_t stream_data_len)
 {
     int32_t res = 0;
-    uint8_t regvalue = 0x01;
-    res = I2CWriteReg(i2c_config.i2c_master_num, i2c_config.i2c_address, REG_RAM_CFG, &regvalue, 1);
-    // Clear all interruptions
-    res = rt903x_clear_int(i2c_config);
-    CHECK_ERROR_RETURN(res);
-    res = rt903x_gain(i2c_config, 0x80);
+    stream_play_demo_wait_t wait = {.status = -1};
+    res = rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850);
     CHECK_ERROR_RETURN(res);
-    res = rt903x_boost_voltage(i2c_config, BOOST_VOUT_850);
+    rt903x_sem_init(&wait.done, 1, 0);
+    res = rt903x_stream_start(dev, stream_data, stream_data_len, stream_play_demo_done, &wait);
+    if (res >= 0)
+    {
+        res = rt903x_stream_wait_done(dev, &wait.done) ? wait.status : -1;
+    }
+    rt903x_sem_deinit(&wait.done);
+    return res;
+}
+
+/* FIFO mode, INT cleared, GO and the FIFO primed from data_index on */
+static int32_t stream_play_demo_restart(rt903x_dev_t *dev, const uint8_t *stream_data, uint32_t stream_data_len,
+                                        uint32_t *data_index)
+{
+    int32_t res = 0;
+    res = rt903x_write_reg(dev, REG_RAM_CFG, 0x01);
     CHECK_ERROR_RETURN(res);
-    res = rt903x_play_mode(i2c_config, MODE_STREAM_PLAY);
+    // Clear all interruptions
+    res = rt903x_clear_int(dev);
     CHECK_ERROR_RETURN(res);
-    res = rt903x_go(i2c_config, 1);
+    res = rt903x_play_setup(dev, MODE_STREAM_PLAY, 0x80, BOOST_VOUT_850);
     CHECK_ERROR_RETURN(res);
-    int32_t stream_size = (rt903x_config.ram_param.ListBaseAddrH << 8) | rt903x_config.ram_param.ListBaseAddrL;
-    stream_size = min(stream_data_len, stream_size);
-    res = rt903x_stream_data(i2c_config,  (const uint8_t*)stream_data, stream_size);
+    res = rt903x_go(dev, 1);
     CHECK_ERROR_RETURN(res);
-    data_demo_index += stream_size;
-    res = stream_play_demo_proc(i2c_config, (const uint8_t*)stream_data, stream_data_len);
+    int32_t stream_size = rt903x_ram_fifo_size(dev);
+    stream_size = min(stream_data_len - *data_index, stream_size);
+    res = rt903x_stream_data(dev, (const uint8_t*)stream_data + *data_index, stream_size);
     CHECK_ERROR_RETURN(res);
-	data_demo_index = 0;
-	
+    *data_index += stream_size;
     return 0;
 }
 
-int rt903x_stream_play_effect(DEF_RT903_INFO i2c_config, uint8_t index){
-    rt903x_stream_play_demo(i2c_config, (const uint8_t*)effect_play_index[index], effect_play_index_len[index]);
-    return 0;
+int32_t rt903x_stream_play_demo(rt903x_dev_t *dev, const uint8_t *stream_data, uint32_t stream_data_len)
+{
+    if (rt903x_stream_engine_owns(dev))
+    {
+        return stream_play_demo_int(dev, stream_data, stream_data_len);
+    }
+
+    int32_t res = 0;
+    uint32_t data_index = 0;
+    uint8_t refill = 0;
+    uint8_t tries = 0;
+    do
+    {
+        // 保护打断后已经恢复、增益已压低，从断点接着播剩下的
+        refill = 0;
+        res = stream_play_demo_restart(dev, stream_data, stream_data_len, &data_index);
+        if (res >= 0)
+        {
+            res = stream_play_demo_proc(dev, (const uint8_t*)stream_data, stream_data_len, &data_index, &refill);
+        }
+    } while (res == RT903X_PROT_EVENT && data_index < stream_data_len && rt903x_prot_retry(dev, &tries));
+    return res;
+}
+
+/* polls or waits until the effect has played, -1 for an index past the effect table */
+int rt903x_stream_play_effect(rt903x_dev_t *dev, uint8_t index)
+{
+    if (index >= ARRAY_LENGTH(effect_play_index))
+    {
+        return -1;
+    }
+    return rt903x_stream_play_demo(dev, (const uint8_t*)effect_play_index[index], effect_play_index_len[index]);
+}
+
+/* 不等播完：engine 补数据，播完（或保护、出错）时在 engine 任务上调 cb；rt903x_stream_stop 打断时不调 */
+int32_t rt903x_stream_effect_start(rt903x_dev_t *dev, uint8_t index, uint8_t gain, rt903x_stream_done_t cb, void *arg)
+{
+    if (index >= ARRAY_LENGTH(effect_play_index) || !rt903x_stream_engine_owns(dev))
+    {
+        return -1;
+    }
+    int32_t res = rt903x_play_setup(dev, MODE_STREAM_PLAY, gain, BOOST_VOUT_850);
+    CHECK_ERROR_RETURN(res);
+    return rt903x_stream_start(dev, (const uint8_t*)effect_play_index[index], effect_play_index_len[index], cb, arg);
 }
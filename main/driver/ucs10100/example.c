@@ -8,6 +8,8 @@
 #include "ussys_tp_driver.h"
 #include "driver/gpio.h"
 #include "driver/i2c.h"
+#include "i2c_adapter.h"
+#include "i2c_bus.h"
 #include "esp_sleep.h"
 #include "rt903x.h"
 
@@ -16,19 +18,22 @@
 #define ENABLE_HARDCODE_CAL_PARAM	(1)
 #define ENABLE_IRQ_TEST				(0)
 
-#define I2C_MASTER_NUM0              0          /*!< I2C master i2c port number, the number of i2c peripheral interfaces available will depend on the chip */
-#define I2C_MASTER_NUM1              1          /*!< I2C master i2c port number, the number of i2c peripheral interfaces available will depend on the chip */
-#define ACK_CHECK_EN 0x1            /*!< I2C master will check ack from slave*/
-#define WRITE_BIT I2C_MASTER_WRITE  /*!< I2C master write */
-#define READ_BIT I2C_MASTER_READ    /*!< I2C master read */
-#define I2C_MASTER_TIMEOUT_MS       1000
-#define ACK_VAL 0x0                 /*!< I2C ack value */
-#define NACK_VAL 0x1                /*!< I2C nack value */
+#define USSYS_TP_I2C_MAX_FREQ_HZ	I2C_SPEED_FAST_PLUS_HZ
+#define USSYS_SPEED_CHECK_READS		4
 
-uint8_t I2C_MASTER_NUM = I2C_MASTER_NUM0;
+static uint8_t ussys_i2c_master_num = I2C_MASTER_NUM0;
+static i2c_bus_t *ussys_bus = NULL;
+static const uint16_t ussys_i2c_addr[BUTTON_NUM] = {0x27, 0x2F, 0x37, 0x3F};
 
 void set_i2c_master_num(uint8_t num){
-	I2C_MASTER_NUM = num;
+	ussys_i2c_master_num = num;
+	ussys_bus = i2c_bus_esp_get(num);
+}
+
+/* run the touch chips over another transport, e.g. a fake bus on a host bench */
+void set_ussys_bus(i2c_bus_t *bus){
+	ussys_bus = bus;
+	ussys_i2c_master_num = bus->port;
 }
 
 #if ENABLE_HARDCODE_CAL_PARAM
@@ -202,24 +207,14 @@ static ussys_cal_param_t hardcode_cal_param1[] = {
 
 static int ussys_i2c_read(ussys_tp_dev_t *dev, uint8_t *buf, uint16_t size)
 {
-	uint16_t dev_addr = dev->i2c_addr;
     if (size == 0) {
         return ESP_OK;
     }
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (dev_addr << 1) | READ_BIT, ACK_CHECK_EN);
-    if (size > 1) {
-        i2c_master_read(cmd, buf, size - 1, ACK_VAL);
-    }
-    i2c_master_read_byte(cmd, buf + size - 1, NACK_VAL);
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+    int ret = ussys_bus->ops->read(ussys_bus, dev->i2c_addr, buf, size);
 	if (0 != ret){
 		debug_info("ussys_i2c_read,ret:%d!\r\n",ret);
 	}
-    return ret;
+    return ret == 0 ? ESP_OK : ESP_FAIL;
 
     //HAL_I2C_Master_Receive(&hi2c1, dev->i2c_addr << 1, buf, size, 100)
 
@@ -229,28 +224,50 @@ static int ussys_i2c_read(ussys_tp_dev_t *dev, uint8_t *buf, uint16_t size)
 
 static int ussys_i2c_write(ussys_tp_dev_t *dev, uint8_t *buf, uint16_t size)
 {
-	uint16_t devAddr = dev->i2c_addr;
     if (size == 0) {
         return ESP_OK;
     }
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (devAddr << 1) | WRITE_BIT, ACK_CHECK_EN);
-    for (int i = 0; i < size; i++) {
-        i2c_master_write_byte(cmd, buf[i], ACK_CHECK_EN);
-    }
-    i2c_master_stop(cmd);
-    esp_err_t ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, 1000 / portTICK_PERIOD_MS);
-    i2c_cmd_link_delete(cmd);
+    int ret = ussys_bus->ops->write(ussys_bus, dev->i2c_addr, buf, size);
 	if (0 != ret){
 		debug_info("ussys_i2c_write,ret2:%d!\r\n",ret);
 	}
-    return ret;
+    return ret == 0 ? ESP_OK : ESP_FAIL;
 
     //HAL_I2C_Master_Transmit(&hi2c1, dev->i2c_addr << 1, buf, size, 100) == HAL_OK)
 
 }
 
+static int ussys_i2c_writev(ussys_tp_dev_t *dev, const ussys_tp_iovec_t *iov, uint8_t iovcnt)
+{
+    i2c_iovec_t segs[I2C_IOV_MAX];
+    if (iovcnt > I2C_IOV_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* only the segment descriptors are translated, the payload is never copied */
+    for (int i = 0; i < iovcnt; i++) {
+        segs[i].buf = iov[i].base;
+        segs[i].len = iov[i].len;
+    }
+    return ussys_bus->ops->writev(ussys_bus, dev->i2c_addr, segs, iovcnt) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static int ussys_i2c_write_read(ussys_tp_dev_t *dev, const uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize)
+{
+    if (rsize == 0) {
+        return ESP_OK;
+    }
+    int ret = ussys_bus->ops->write_read(ussys_bus, dev->i2c_addr, wbuf, wsize, rbuf, rsize);
+	if (0 != ret){
+		debug_info("ussys_i2c_write_read,ret:%d!\r\n",ret);
+	}
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static void ussys_i2c_retry_notify(ussys_tp_dev_t *dev)
+{
+	i2c_stats_note_retry(ussys_i2c_master_num, dev->i2c_addr);
+}
+
 static uint64_t ussys_get_timestamp_us(void)
 {
 	//uint64_t ts = 1000 * HAL_GetTick();
@@ -265,7 +282,7 @@ int ussys_load_cal_param(ussys_tp_dev_t *dev)
 #if ENABLE_HARDCODE_CAL_PARAM
 
 	if (dev->dev_idx < ARRAY_SIZE(hardcode_cal_param)) {
-			if(I2C_MASTER_NUM0 == I2C_MASTER_NUM){
+			if(I2C_MASTER_NUM0 == ussys_i2c_master_num){
 				memcpy(&dev->cal_param, &hardcode_cal_param[dev->dev_idx], sizeof(ussys_cal_param_t));
 			}else{
 				memcpy(&dev->cal_param, &hardcode_cal_param1[dev->dev_idx], sizeof(ussys_cal_param_t));
@@ -291,6 +308,32 @@ int ussys_store_cal_param(ussys_tp_dev_t *dev)
 	return 0;//return ussys_write_cal_data_into_flash(dev->dev_idx, (uint8_t *)&dev->cal_param, sizeof(ussys_cal_param_t));
 }
 
+/* bus speed probe: repeated fd whoami reads must all return a known whoami value */
+static int ussys_i2c_speed_check(uint8_t i2c_master_num, uint16_t devAddr, void *arg)
+{
+	uint8_t reg = TOUCH_POINT_FD_REG_WHOAMI;
+	uint8_t whoami = 0;
+
+	for (int i = 0; i < USSYS_SPEED_CHECK_READS; i++) {
+		whoami = 0;
+		if (I2CWriteRead(i2c_master_num, devAddr, &reg, 1, &whoami, 1) != 0) {
+			return -1;
+		}
+		if (TOUCH_POINT_A0A1_WHOAMI_VALUE != whoami && TOUCH_POINT_A2_WHOAMI_VALUE != whoami) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* add the touch chips of one port to its speed negotiation, absent chips are skipped */
+void ussys_tp_speed_register(uint8_t i2c_master_num)
+{
+	for (int i = 0; i < BUTTON_NUM; i++) {
+		i2c_speed_register(i2c_master_num, ussys_i2c_addr[i], USSYS_TP_I2C_MAX_FREQ_HZ, ussys_i2c_speed_check, NULL);
+	}
+}
+
 void ussys_tp_main(void)
 {
 	ussys_tp_dev_t ussys_tp_dev[BUTTON_NUM];
@@ -303,19 +346,13 @@ void ussys_tp_main(void)
 		memset(dev, 0, sizeof(ussys_tp_dev_t));
 
 		dev->dev_idx = i;
-		if (i == 0) {
-			dev->i2c_addr = 0x27;
-		} 
-		else if (i == 1) {
-			dev->i2c_addr = 0x2F;//0x2F;
-		}else if (i == 2){
-			dev->i2c_addr = 0x37;
-		}else if (i == 3){
-			dev->i2c_addr = 0x3F;
-		}
+		dev->i2c_addr = ussys_i2c_addr[i];
 
 		dev->i2c_read			= ussys_i2c_read;
 		dev->i2c_write			= ussys_i2c_write;
+		dev->i2c_writev			= ussys_i2c_writev;
+		dev->i2c_write_read		= ussys_i2c_write_read;
+		dev->i2c_retry_notify	= ussys_i2c_retry_notify;
 		dev->get_timestamp_us	= ussys_get_timestamp_us;
 		dev->load_cal_param		= ussys_load_cal_param;
 		dev->store_cal_param	= ussys_store_cal_param;
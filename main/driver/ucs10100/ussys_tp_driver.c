@@ -59,31 +59,34 @@ void mdelay(ussys_tp_dev_t *dev, uint32_t delay_ms)
 /**********************************************************
  ******************** I2C functions ***********************
  **********************************************************/
+static void ussys_tp_i2c_retry_notify(ussys_tp_dev_t *dev, int i2c_retry_cnt)
+{
+	if (NULL != dev->i2c_retry_notify && i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM)
+		dev->i2c_retry_notify(dev);
+}
+
 /* [bd mode] write reg & memory */
 static int ussys_tp_bd_write(ussys_tp_dev_t *dev, uint16_t reg_addr, uint8_t *val, uint16_t size)
 {
-	uint8_t *buf = malloc(size + 5);
+	uint8_t hdr[] = {0x02,/* bd write */
+					(uint8_t)(reg_addr >> 8),
+					(uint8_t)reg_addr,
+					(uint8_t)(size >> 8),
+					(uint8_t)size};
+	ussys_tp_iovec_t iov[] = {
+		{hdr, ARRAY_SIZE(hdr)},
+		{val, size},
+	};
 	int rc = 0, i2c_retry_cnt = 0;
 
-	if (NULL == buf)
-		return -1;
-
-	buf[0] = 0x02;/* bd write */
-	buf[1] = (uint8_t)(reg_addr >> 8);
-	buf[2] = (uint8_t)reg_addr;
-	buf[3] = (uint8_t)(size >> 8);
-	buf[4] = (uint8_t)size;
-	memcpy(&buf[5], val, size);
-
 	do {
-		rc = dev->i2c_write(dev, buf, size + 5);
+		rc = dev->i2c_writev(dev, iov, ARRAY_SIZE(iov));
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
-	free(buf);
-
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
 		debug_info("dev%d(%#X) bd i2c write %#X failed! \r\n", dev->dev_idx, dev->i2c_addr, reg_addr);
 		return -2;
@@ -103,11 +106,11 @@ static int ussys_tp_bd_read_oneshot(ussys_tp_dev_t *dev, uint16_t reg_addr, uint
 	int rc = 0, i2c_retry_cnt = 0;
 
 	do {
-		rc = dev->i2c_write(dev, buf, ARRAY_SIZE(buf));
-		rc += dev->i2c_read(dev, val, size);
+		rc = dev->i2c_write_read(dev, buf, ARRAY_SIZE(buf), val, size);
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
@@ -157,24 +160,20 @@ static int ussys_tp_bd_write_bitmask(ussys_tp_dev_t *dev, uint16_t reg_addr, uin
 /* [fd mode] write 1-byte fd reg */
 static int ussys_tp_write_fd_reg(ussys_tp_dev_t *dev, uint8_t reg_addr, uint8_t *val, uint16_t size)
 {
-	uint8_t *buf = malloc(size + 1);
+	ussys_tp_iovec_t iov[] = {
+		{&reg_addr, 1},	//reg start addr;
+		{val, size},
+	};
 	int rc = 0, i2c_retry_cnt = 0;
 
-	if (NULL == buf)
-		return -1;
-
-	buf[0] = reg_addr;	//reg start addr;
-	memcpy(&buf[1], val, size);
-
 	do {
-		rc = dev->i2c_write(dev, buf, size + 1);
+		rc = dev->i2c_writev(dev, iov, ARRAY_SIZE(iov));
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
-	free(buf);
-
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
 		debug_info("dev%d(%#X) i2c write fd reg %#X failed!\r\n", dev->dev_idx, dev->i2c_addr, reg_addr);
 		return -2;
@@ -189,11 +188,11 @@ static int ussys_tp_write_fd_reg(ussys_tp_dev_t *dev, uint8_t reg_addr, uint8_t
 	int rc = 0, i2c_retry_cnt = 0;
 
 	do {
-		rc = dev->i2c_write(dev, &reg_addr, 1);
-		rc += dev->i2c_read(dev, val, size);
+		rc = dev->i2c_write_read(dev, &reg_addr, 1, val, size);
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
@@ -224,28 +223,25 @@ static int ussys_tp_write_fd_reg(ussys_tp_dev_t *dev, uint8_t reg_addr, uint8_t
 /* [fd mode] write two bytes memory addr(e.g. dsram) */
 /*static*/ int ussys_tp_write_mem(ussys_tp_dev_t *dev, uint16_t mem_addr, uint8_t *val, uint16_t size)
 {
-	uint8_t *buf = malloc(size + 5);
+	uint8_t hdr[] = {TOUCH_POINT_FD_REG_ADDR_INDEX_H,
+					(uint8_t)(mem_addr >> 8),
+					TOUCH_POINT_FD_REG_ADDR_INDEX_L,
+					(uint8_t)mem_addr,
+					TOUCH_POINT_FD_REG_BURST_WRITE};
+	ussys_tp_iovec_t iov[] = {
+		{hdr, ARRAY_SIZE(hdr)},
+		{val, size},
+	};
 	int rc = 0, i2c_retry_cnt = 0;
 
-	if (NULL == buf)
-		return -1;
-
-	buf[0] = TOUCH_POINT_FD_REG_ADDR_INDEX_H;
-	buf[1] = (uint8_t)(mem_addr >> 8);
-	buf[2] = TOUCH_POINT_FD_REG_ADDR_INDEX_L;
-	buf[3] = (uint8_t)mem_addr;
-	buf[4] = TOUCH_POINT_FD_REG_BURST_WRITE;
-	memcpy(&buf[5], val, size);
-
 	do {
-		rc = dev->i2c_write(dev, buf, size + 5);
+		rc = dev->i2c_writev(dev, iov, ARRAY_SIZE(iov));
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
-	free(buf);
-
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
 		debug_info("dev%d(%#X) i2c write mem addr %#X failed!\r\n", dev->dev_idx, dev->i2c_addr, mem_addr);
 		return -2;
@@ -265,11 +261,11 @@ static int ussys_tp_read_mem_oneshot(ussys_tp_dev_t *dev, uint16_t mem_addr, uin
 	int rc = 0, i2c_retry_cnt = 0;
 
 	do {
-		rc = dev->i2c_write(dev, buf, ARRAY_SIZE(buf));
-		rc += dev->i2c_read(dev, val, size);
+		rc = dev->i2c_write_read(dev, buf, ARRAY_SIZE(buf), val, size);
 		if (rc == 0)
 			break;
 		i2c_retry_cnt++;
+		ussys_tp_i2c_retry_notify(dev, i2c_retry_cnt);
 	} while (i2c_retry_cnt < USSYS_TP_I2C_MAX_RETRY_NUM);
 
 	if (i2c_retry_cnt == USSYS_TP_I2C_MAX_RETRY_NUM) {
@@ -1268,7 +1264,7 @@ int ussys_tp_if_init(ussys_tp_dev_t *dev)
 	int rc = 0;
 	
 	if (NULL == dev || NULL == dev->i2c_read || NULL == dev->i2c_write
-		|| NULL == dev->get_timestamp_us || NULL == dev->load_cal_param 
+		|| NULL == dev->i2c_writev || NULL == dev->i2c_write_read || NULL == dev->get_timestamp_us || NULL == dev->load_cal_param 
 		|| NULL ==dev->store_cal_param) {
 		debug_info("bad param!\r\n");
 
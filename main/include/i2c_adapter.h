@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <esp_err.h>
 #include "driver/gpio.h"
+#include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "i2c_bus.h"
 
 /* Definition for I2Cx clock resources */
 #define I2Cx                            I2C4
@@ -76,6 +80,9 @@
 #define I2C_MASTER_RX_BUF_DISABLE   0                          /*!< I2C master doesn't need buffer */
 #define I2C_MASTER_TIMEOUT_MS       1000
 
+//所有rt903的中断脚并在一起接GPIO5（开漏，低有效）
+#define RT903_INT_IO  GPIO_NUM_5
+
 #define INPUT_INT1    GPIO_NUM_1
 #define INPUT_INT2    GPIO_NUM_2
 #define INPUT_INT3    GPIO_NUM_6
@@ -114,12 +121,125 @@ typedef struct {
     uint8_t i2c_master_num;
     uint8_t i2c_master_sda_io;
     uint8_t i2c_master_scl_io; 
-    uint32_t i2c_master_freq_hz;
+    uint32_t i2c_master_freq_hz;        /*!< boot clock, every device on the port must work at it */
+    uint32_t i2c_master_max_freq_hz;    /*!< upper bound for speed negotiation (board wiring / pull-ups) */
 } def_i2c_config_t;
 
+/* bus speed profiles, i2c_speed_negotiate moves a port to the fastest one every registered device passes */
+#define I2C_SPEED_STANDARD_HZ       100000
+#define I2C_SPEED_FAST_HZ           400000
+#define I2C_SPEED_FAST_PLUS_HZ      1000000
+#define I2C_SPEED_DEV_MAX           8       /*!< registered devices per port */
+#define I2C_SPEED_FALLBACK_ERRS     3       /*!< consecutive failures on a registered device before stepping down */
+
+/* readback check of one device at the current clock, 0 when the device answered correctly */
+typedef int (*i2c_speed_check_t)(uint8_t i2c_master_num, uint16_t devAddr, void *arg);
+
+
+/* Per-port asynchronous executor: one owner task per I2C port drains a queue of
+ * submitted transactions, so bus 0 and bus 1 run concurrently on both cores. */
+#define I2C_PORT_NUM_MAX            I2C_BUS_PORT_MAX
+#define I2C_EXECUTOR_QUEUE_LEN      16
+#define I2C_EXECUTOR_TASK_STACK     3072
+#define I2C_EXECUTOR_TASK_PRIO      12
+/* static command link per port, sized for up to I2C_CMD_LINK_TRANS_MAX START..STOP bursts
+ * (a register read counts as two), so no transaction allocates from the heap */
+#define I2C_CMD_LINK_TRANS_MAX      8
+#define I2C_CMD_LINK_BUF_SIZE       I2C_LINK_RECOMMENDED_SIZE(I2C_CMD_LINK_TRANS_MAX)
+
+typedef enum {
+    I2C_TRANS_WRITE = 0,    /*!< START | addr+W | reg | data... | STOP */
+    I2C_TRANS_READ,         /*!< START | addr+W | reg | RESTART | addr+R | data... | STOP */
+    I2C_TRANS_RAW_WRITE,    /*!< START | addr+W | data... | STOP, reg is ignored */
+    I2C_TRANS_RAW_READ,     /*!< START | addr+R | data... | STOP, reg is ignored */
+    I2C_TRANS_BATCH,        /*!< (reg,value) list, contiguous registers merged into auto-increment bursts */
+    I2C_TRANS_WRITEV,       /*!< START | addr+W | seg0 | seg1... | STOP, no intermediate copy */
+    I2C_TRANS_WRITE_READ,   /*!< START | addr+W | wr... | RESTART | addr+R | data... | STOP */
+    I2C_TRANS_SET_CLOCK,    /*!< reprogram SCL to freq_hz, ordered with the transfers queued before it */
+} i2c_trans_op_t;
+
+#define I2C_IOV_MAX                 9       /* register byte + RT903X_STREAM_IOV_MAX sample segments */
+
+/* fault handling: every transaction gets a short deadline (I2C_TRANS_TIMEOUT_MS plus its wire time,
+ * rounded up to whole ticks, at least I2C_TRANS_MIN_TICKS plus I2C_TRANS_MARGIN_TICKS), a timeout that
+ * leaves SDA or SCL held low clocks the bus free and reinstalls the driver, and a device failing
+ * I2C_QUARANTINE_ERRS transactions in a row fails fast until an address probe after its backoff succeeds */
+#define I2C_TRANS_TIMEOUT_MS        5
+#define I2C_TRANS_MIN_TICKS         2       /* a 1 tick deadline may expire right after the transfer starts */
+#define I2C_TRANS_MARGIN_TICKS      1       /* executor preempted by a higher priority task */
+#define I2C_RECOVER_HALF_PERIOD_US  5
+#define I2C_QUARANTINE_DEV_MAX      8
+#define I2C_QUARANTINE_ERRS         2
+#define I2C_QUARANTINE_MIN_MS       10
+#define I2C_QUARANTINE_MAX_MS       2000
+
+/* bus instrumentation, collected by the port owner for every transaction */
+#define I2C_STATS_DEV_MAX           8       /*!< device addresses tracked per port, the rest only count in the port total */
+#define I2C_STATS_LAT_BUCKETS       8       /*!< submit-to-done latency: <50us <100us <200us <500us <1ms <2ms <5ms >=5ms */
+#define I2C_STATS_SLOT_US           100000  /*!< occupancy is kept in 100 ms slots ... */
+#define I2C_STATS_SLOTS             10      /*!< ... ring, the last 9 complete slots form the sliding window */
+
+typedef struct {
+    uint16_t dev_addr;
+    uint32_t trans;
+    uint32_t bytes;             /*!< bytes on the wire excluding address bytes */
+    uint32_t errors;
+    uint32_t retries;           /*!< reported by the caller through i2c_stats_note_retry */
+    uint32_t lat_hist[I2C_STATS_LAT_BUCKETS];
+    uint32_t lat_max_us;
+    uint64_t busy_us;           /*!< time the bus was held for this device */
+} i2c_dev_stats_t;
+
+typedef struct {
+    i2c_dev_stats_t total;      /*!< whole port, dev_addr unused */
+    uint8_t occupancy_pct;      /*!< bus busy time over the sliding window */
+    uint8_t dev_cnt;
+    i2c_dev_stats_t dev[I2C_STATS_DEV_MAX];
+} i2c_port_stats_t;
+
+struct i2c_trans;
+typedef void (*i2c_trans_cb_t)(struct i2c_trans *trans, void *arg);
+
+typedef struct i2c_trans {
+    i2c_trans_op_t op;
+    uint8_t i2c_master_num;
+    uint16_t dev_addr;
+    uint16_t reg;
+    uint8_t *data;
+    uint16_t len;
+    const i2c_reg_val_t *regs;  /*!< I2C_TRANS_BATCH only, len is the number of entries */
+    i2c_batch_stats_t *stats;   /*!< I2C_TRANS_BATCH only, optional, accumulated */
+    const i2c_iovec_t *iov;     /*!< I2C_TRANS_WRITEV only, len is the number of segments */
+    const uint8_t *wr_buf;      /*!< I2C_TRANS_WRITE_READ only, bytes sent before the repeated start */
+    uint16_t wr_len;
+    uint32_t freq_hz;           /*!< I2C_TRANS_SET_CLOCK only */
+    uint32_t timeout_ms;        /*!< optional deadline, 0 derives it from the length and the bus clock */
+    i2c_trans_cb_t cb;          /*!< optional, runs on the port owner task, must not block on the bus */
+    void *cb_arg;
+    esp_err_t result;
+    int64_t submit_us;          /*!< set by i2c_executor_submit, for the latency histogram */
+    SemaphoreHandle_t done;     /*!< wait handle, given once the transaction has completed */
+    StaticSemaphore_t done_buf;
+} i2c_trans_t;
 
 esp_err_t i2c_master_init(def_i2c_config_t i2cConfig);
+esp_err_t i2c_executor_start(uint8_t i2c_master_num, BaseType_t core_id);
+void i2c_trans_init(i2c_trans_t *trans, i2c_trans_op_t op, uint8_t i2c_master_num, uint16_t devAddr,
+                    uint16_t reg, uint8_t *data, uint16_t len);
+esp_err_t i2c_executor_submit(i2c_trans_t *trans);
+esp_err_t i2c_executor_wait(i2c_trans_t *trans, TickType_t ticks_to_wait);
+esp_err_t i2c_set_clock(uint8_t i2c_master_num, uint32_t freq_hz);
+uint32_t i2c_get_clock(uint8_t i2c_master_num);
+esp_err_t i2c_speed_register(uint8_t i2c_master_num, uint16_t devAddr, uint32_t max_freq_hz, i2c_speed_check_t check, void *arg);
+uint32_t i2c_speed_negotiate(uint8_t i2c_master_num);
+esp_err_t i2c_stats_snapshot(uint8_t i2c_master_num, i2c_port_stats_t *out);
+void i2c_stats_reset(uint8_t i2c_master_num);
+void i2c_stats_note_retry(uint8_t i2c_master_num, uint16_t devAddr);
+esp_err_t i2c_stats_register_cmd(void);
 int16_t I2CWriteReg(uint8_t i2c_master_num, uint16_t devAddr, uint16_t WriteAddr, uint8_t *data_wr, uint16_t length);
 int16_t I2CReadReg(uint8_t i2c_master_num, uint16_t devAddr, uint16_t ReadAddr, uint8_t *data_wr, uint16_t len);
+int16_t I2CWriteRead(uint8_t i2c_master_num, uint16_t devAddr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len);
+int16_t I2CWriteV(uint8_t i2c_master_num, uint16_t devAddr, const i2c_iovec_t *iov, uint8_t iovcnt);
+int16_t I2CWriteRegBatch(uint8_t i2c_master_num, uint16_t devAddr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats);
 
 #endif	// __I2C_ADAPTER_H__
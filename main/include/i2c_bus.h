@@ -0,0 +1,60 @@
+#ifndef __I2C_BUS_H__
+#define __I2C_BUS_H__
+
+/*
+ * Bus transport interface shared by the rt903 and ucs10100 drivers. Each bus is a
+ * vtable plus context; the ESP-IDF implementation goes through the per-port executor,
+ * the fake (i2c_bus_fake.h) keeps device registers in memory so the drivers run on a host.
+ * No ESP-IDF header is needed here.
+ */
+#include <stdint.h>
+
+#define I2C_BUS_PORT_MAX            2
+#define I2C_BATCH_MAX_REGS          64      /* longest (reg,value) list of one write_regs call */
+
+typedef struct {
+    const uint8_t *buf;
+    uint16_t len;
+} i2c_iovec_t;
+
+typedef struct {
+    uint8_t reg;
+    uint8_t val;
+} i2c_reg_val_t;
+
+typedef struct {
+    uint16_t regs;          /*!< registers written */
+    uint16_t bursts;        /*!< START..STOP bursts on the wire */
+    uint32_t wire_bytes;    /*!< bytes clocked out including address bytes */
+    uint32_t single_bytes;  /*!< bytes the same sequence costs as single-register writes */
+} i2c_batch_stats_t;
+
+typedef struct i2c_bus i2c_bus_t;
+
+/* every op returns 0 on success and -1 on failure */
+typedef struct {
+    /* START | addr+W | reg | data... | STOP */
+    int (*write_reg)(i2c_bus_t *bus, uint16_t addr, uint8_t reg, const uint8_t *data, uint16_t len);
+    /* START | addr+W | reg | RESTART | addr+R | data... | STOP */
+    int (*read_reg)(i2c_bus_t *bus, uint16_t addr, uint8_t reg, uint8_t *data, uint16_t len);
+    /* (reg,value) list, contiguous registers merged into auto-increment bursts, stats optional */
+    int (*write_regs)(i2c_bus_t *bus, uint16_t addr, const i2c_reg_val_t *regs, uint16_t count, i2c_batch_stats_t *stats);
+    /* START | addr+W | data... | STOP */
+    int (*write)(i2c_bus_t *bus, uint16_t addr, const uint8_t *data, uint16_t len);
+    /* START | addr+R | data... | STOP */
+    int (*read)(i2c_bus_t *bus, uint16_t addr, uint8_t *data, uint16_t len);
+    /* START | addr+W | seg0 | seg1... | STOP */
+    int (*writev)(i2c_bus_t *bus, uint16_t addr, const i2c_iovec_t *iov, uint8_t iovcnt);
+    /* START | addr+W | wr... | RESTART | addr+R | data... | STOP */
+    int (*write_read)(i2c_bus_t *bus, uint16_t addr, const uint8_t *wr_buf, uint16_t wr_len, uint8_t *rd_buf, uint16_t rd_len);
+} i2c_bus_ops_t;
+
+struct i2c_bus {
+    const i2c_bus_ops_t *ops;
+    uint8_t port;           /*!< port number, for logs and stats */
+    void *ctx;              /*!< implementation data */
+};
+
+i2c_bus_t *i2c_bus_esp_get(uint8_t i2c_master_num);
+
+#endif	// __I2C_BUS_H__
@@ -0,0 +1,56 @@
+#ifndef __I2C_BUS_FAKE_H__
+#define __I2C_BUS_FAKE_H__
+
+/*
+ * In-memory i2c_bus for host builds. Each device is a 256-byte register file with the
+ * usual register-pointer protocol (first written byte selects the register, the pointer
+ * auto-increments) unless a device model is plugged in through xfer. The bus counts
+ * transactions, bytes and errors and accumulates the wire time the traffic would take
+ * at freq_hz, so driver changes can be compared without a board.
+ * Plain C, no ESP-IDF or FreeRTOS dependency.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "i2c_bus.h"
+
+#define I2C_FAKE_DEV_MAX            8
+#define I2C_FAKE_REG_NUM            256
+#define I2C_FAKE_SCRATCH_SIZE       2048    /*!< largest write a device model receives in one piece */
+
+typedef struct i2c_fake_dev i2c_fake_dev_t;
+
+/* device model, replaces the register-pointer protocol for every transaction addressed to the device */
+typedef int (*i2c_fake_xfer_t)(i2c_fake_dev_t *dev, const uint8_t *wr, uint16_t wr_len, uint8_t *rd, uint16_t rd_len);
+
+struct i2c_fake_dev {
+    uint16_t addr;
+    uint8_t regs[I2C_FAKE_REG_NUM];
+    uint8_t no_inc[I2C_FAKE_REG_NUM / 8];   /*!< data-port registers, the pointer stays on them */
+    uint8_t ptr;
+    i2c_fake_xfer_t xfer;                   /*!< optional */
+    void *model;                            /*!< model data for xfer */
+    uint32_t fail_next;                     /*!< NACK this many transactions, for fault injection */
+    uint32_t trans;
+    uint32_t wr_bytes;
+    uint32_t rd_bytes;
+    uint32_t errors;
+};
+
+typedef struct {
+    i2c_bus_t bus;                          /*!< pass &fake->bus to the drivers */
+    uint32_t freq_hz;
+    uint32_t trans;
+    uint32_t bytes;                         /*!< on the wire, address bytes included */
+    uint32_t errors;
+    uint64_t wire_us;                       /*!< 9 clocks per byte at freq_hz */
+    uint8_t dev_cnt;
+    i2c_fake_dev_t dev[I2C_FAKE_DEV_MAX];
+    uint8_t scratch[I2C_FAKE_SCRATCH_SIZE];
+} i2c_fake_bus_t;
+
+void i2c_fake_bus_init(i2c_fake_bus_t *fake, uint8_t port, uint32_t freq_hz);
+i2c_fake_dev_t *i2c_fake_bus_add(i2c_fake_bus_t *fake, uint16_t addr);
+void i2c_fake_dev_set_data_port(i2c_fake_dev_t *dev, uint8_t reg);
+void i2c_fake_bus_reset_counters(i2c_fake_bus_t *fake);
+
+#endif	// __I2C_BUS_FAKE_H__
@@ -19,6 +19,14 @@
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#endif
+
 enum WAVEFORM_TYPE
 {
     WAVEFORM_SINE = 0,
@@ -62,10 +70,9 @@ struct FirmwareVersion
 };
 #pragma pack()
 
-int16_t ics_generation_reset(const struct GENERATION_CONFIG* config);
-int16_t ics_generation_waveform(uint8_t* buf, int16_t size);
-int16_t ics_resample_reset(const struct RESAMPLE_CONFIG* config);
-int16_t ics_resample_waveform(const uint8_t* src_buf, int16_t src_size, uint8_t* dst_buf, int16_t* dst_size);
+// no shared state: every caller owns its config, so streams on several chips generate at once
+int16_t ics_generation_waveform(struct GENERATION_CONFIG* gen, uint8_t* buf, int16_t size);
+int16_t ics_resample_waveform(const struct RESAMPLE_CONFIG* config, const uint8_t* src_buf, int16_t src_size, uint8_t* dst_buf, int16_t* dst_size);
 
 void ics_delay_ms(int16_t ms);
 
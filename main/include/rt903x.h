@@ -2,6 +2,8 @@
 #define __RT903X_H
 #include <stdint.h>
 #include <stdbool.h>
+#include "i2c_bus.h"
+#include "rt903x_port.h"
 #define    CHIP_ID    0x6B
 #define TRUE 1
 #define FALSE 0
@@ -26,6 +28,7 @@ typedef struct {
     bool is_online;       /*!< record chip is online or not>*/
     uint8_t i2c_master_num;/*!< I2C master number , 0  or 1> */
     uint16_t i2c_address;   /*!< I2C address, 0x5E or 0x5F>*/
+    uint32_t max_freq_hz;   /*!< fastest I2C clock the chip is rated for>*/
 } DEF_RT903_INFO;
 
 struct RT903X_CONFIG {
@@ -37,9 +40,84 @@ struct RT903X_CONFIG {
     float vbat;
     float rl;
 
+    uint32_t efuse_data;    /*!< raw trim word read by rt903x_apply_trim */
+    uint8_t f0_quality;     /*!< 0..100, agreement of the two BEMF periods behind f0 */
+    bool trim_cached;       /*!< trims came from NVS this boot, efuse not read yet */
+
     struct RAM_PARAM ram_param;
 };
 
+#define RT903X_SHADOW_REG_NUM   0x70
+
+/* write-through cache of the configuration registers, see rt903x_read_reg/rt903x_write_reg */
+struct RT903X_SHADOW
+{
+    uint8_t val[RT903X_SHADOW_REG_NUM];
+    uint8_t valid[RT903X_SHADOW_REG_NUM / 8];
+};
+
+/* RAM partition: stream FIFO from 0, the playlist at LIST_BASE, waveforms from WAVE_BASE to the end.
+ * a bigger FIFO means fewer refills per stream, a bigger waveform area more resident effects */
+#define RT903X_RAM_SIZE             0x600   /* 1.5 KB */
+#define RT903X_RAM_ALIGN            0x20
+#define RT903X_LIST_AREA_SIZE       0x20    /* list header + 15 entries, see rt903x_loop_go */
+#define RT903X_FIFO_SIZE_MIN        0x80
+#define RT903X_WAVE_AREA_MIN        0x100   /* the f0 detection waveform has to fit */
+#define RT903X_FIFO_SIZE_CLICK      0x100   /* 0x4E0 of waveforms, for zones that only play RAM clicks */
+#define RT903X_FIFO_SIZE_DEFAULT    0x200   /* power-on split, 0x3E0 of waveforms */
+#define RT903X_FIFO_SIZE_STREAM     0x400   /* a quarter of the refills of the click split, 0x1E0 of waveforms */
+
+#define RT903X_RAM_SLOT_MAX     8
+#define RT903X_WAVE_HDR_LEN     4       /* {start addr H, L, sample count H, L} in front of every waveform */
+
+/* one waveform resident in chip RAM, selected by pointing WAVE_BASE at its header */
+struct RT903X_RAM_SLOT
+{
+    const uint8_t *wave;    /*!< effect identity, the const array it was uploaded from */
+    uint16_t len;           /*!< header + samples */
+    uint16_t addr;          /*!< RAM address of the header */
+    uint32_t last_use;
+};
+
+/* RAM playlist: {entry count, 0} then {wave table entry, extra plays} per entry */
+#define RT903X_LIST_HDR_LEN     2
+#define RT903X_LIST_ENTRY_LEN   2
+#define RT903X_LIST_REPEAT_MAX  256     /* plays one list entry can stand for */
+
+#define RT903X_LOOP_HDR_LEN     (2 * RT903X_WAVE_HDR_LEN)   /* entry 1 whole block, entry 2 its first period */
+#define RT903X_LOOP_BLOCK_MIN   96      /* samples, whole f0 periods are packed until the block is this long */
+#define RT903X_LOOP_SAMPLE_RATE 6000
+
+typedef enum
+{
+    LOOP_NONE = 0,
+    LOOP_SINE,                  /*!< sine at f0, see rt903x_loop_long */
+    LOOP_TRANSIENT,             /*!< wave_data_list entry resampled to f0, see rt903x_loop_transient */
+    LOOP_TRACK                  /*!< one drive cycle at the nominal f0, see rt903x_track_play */
+} RT903X_LOOP_KIND;
+
+/* what the resident loop block of a chip was generated from */
+struct RT903X_LOOP
+{
+    RT903X_LOOP_KIND kind;
+    uint16_t index;
+    uint16_t f0;
+    uint16_t block;             /*!< samples behind wave table entry 1 */
+    uint16_t period;            /*!< samples behind entry 2, one f0 period (the whole block for transients) */
+};
+
+/* which effects sit in the waveform area of this chip, see rt903x_ram_load */
+struct RT903X_RAM_CACHE
+{
+    struct RT903X_RAM_SLOT slot[RT903X_RAM_SLOT_MAX];
+    uint8_t cnt;
+    bool list_loaded;       /*!< the one-entry RAM playlist is in place */
+    uint32_t tick;
+    uint32_t hits;
+    uint32_t uploads;
+    uint32_t evictions;
+};
+
 typedef enum
 {
     MODE_RAM_PLAY         = 1,
@@ -67,30 +145,259 @@ typedef enum
     BOOST_VOUT_110    = 15
 } RT903X_BOOST_VOLTAGE;
 
-int32_t rt903x_soft_reset(DEF_RT903_INFO i2c_config);
-int32_t rt903x_apply_trim(DEF_RT903_INFO i2c_config);
-int32_t rt903x_init(DEF_RT903_INFO i2c_config);
-int32_t rt903x_chip_id(DEF_RT903_INFO i2c_config);
-int32_t rt903x_clear_int(DEF_RT903_INFO i2c_config);
-int32_t rt903x_detect_f0(DEF_RT903_INFO i2c_config);
+/* RAM effect the background arming task should prepare next, see rt903x_ram_arm_async */
+struct RT903X_ARM_REQ
+{
+    const uint8_t *wave;
+    uint32_t len;
+    uint8_t gain;
+    RT903X_BOOST_VOLTAGE vout;
+    bool pending;
+    bool held;              /*!< requests refused, see rt903x_ram_arm_hold */
+};
+
+#define RT903X_GPIO_TRIG_NUM    3       /* trigger inputs GPIO1..3 of the chip */
+#define RT903X_GPIO_WAVE_MAX    (RT903X_GPIO_TRIG_NUM * 2)
+
+/* effects a trigger input plays by itself on its rising/falling edge, NULL = that edge does nothing */
+struct RT903X_GPIO_BIND
+{
+    const uint8_t *pos_wave;        /*!< effect data including its 4 byte header */
+    uint32_t pos_len;
+    const uint8_t *neg_wave;
+    uint32_t neg_len;
+};
+
+/* wave table the trigger inputs point into, see rt903x_gpio_trig_bind */
+struct RT903X_GPIO_TRIG
+{
+    bool bound;                     /*!< the waveform area holds the trigger table, RAM uploads are refused */
+    uint8_t wave_cnt;               /*!< table entries, shared effects are stored once */
+    const uint8_t *wave[RT903X_GPIO_WAVE_MAX];
+    uint16_t end;                   /*!< first RAM address after the last effect */
+};
+
+#define RT903X_PROT_EVENT       -2      /* play stopped by a protection event, the chip is already recovered */
+
+/* what a protection event costs the plays that follow it */
+struct RT903X_PROT_POLICY
+{
+    uint8_t max_retries;        /*!< restarts of an interrupted stream before giving up */
+    uint8_t gain_pct;           /*!< every event caps the gain at this share of the gain that tripped */
+    uint8_t min_gain;           /*!< the cap never goes below this */
+    uint16_t hold_ms;           /*!< cap lifted after this long without another event */
+};
+
+/* per chip protection counters, see rt903x_prot_recover */
+struct RT903X_PROT_STATS
+{
+    uint32_t events;
+    uint32_t recovered;         /*!< events the clear sequence went through for */
+    uint32_t retries;           /*!< interrupted streams restarted */
+    uint32_t gave_up;           /*!< interrupted streams out of retries */
+    uint8_t status1;            /*!< PROTECTION_STATUS1/2 of the last event */
+    uint8_t status2;
+    uint8_t gain_cap;           /*!< 0 = no cap */
+    int64_t last_us;            /*!< rt903x_time_us of the last event */
+};
+
+/* per chip handle, owns everything that used to be shared through the global rt903x_config */
+typedef struct {
+    DEF_RT903_INFO info;            /*!< online flag, port and address */
+    i2c_bus_t *bus;                 /*!< transport the chip sits on */
+    struct RT903X_CONFIG config;    /*!< chip id, f0, trims and RAM partition of this chip */
+    struct RT903X_SHADOW shadow;
+    rt903x_mutex_t reg_lock;        /*!< recursive, makes shadow check + bus write + store one step */
+    struct RT903X_RAM_CACHE ram;    /*!< resident waveforms */
+    RT903X_PLAY_MODE play_mode;     /*!< last mode written */
+    bool playing;                   /*!< GO written and not yet stopped by the driver */
+    rt903x_mutex_t arm_lock;        /*!< serialises arming and triggering of this chip, and a stream's claim on it */
+    struct RT903X_ARM_REQ arm_req;
+    struct RT903X_LOOP loop;        /*!< resident loop block, its RAM slot is keyed by &loop */
+    struct RT903X_GPIO_TRIG gpio_trig;  /*!< hardware trigger bindings, the chip plays them without the MCU */
+    struct RT903X_PROT_STATS prot;
+    uint32_t trig_armed;            /*!< presses that only cost the GO write */
+    uint32_t trig_cold;             /*!< presses that had to prepare first */
+    bool auto_track;                /*!< play_long may use auto-track, off until rt903x_track_enable */
+} rt903x_dev_t;
+
+void rt903x_dev_init(rt903x_dev_t *dev, DEF_RT903_INFO info, i2c_bus_t *bus);
+int32_t rt903x_soft_reset(rt903x_dev_t *dev);
+int32_t rt903x_apply_trim(rt903x_dev_t *dev);
+int32_t rt903x_init(rt903x_dev_t *dev);
+
+#define RT903X_INIT_MAX_CHIPS       4
+#define RT903X_INIT_TASK_STACK      4096
+#define RT903X_INIT_TASK_PRIO       5
+#define RT903X_TRIM_NVS_NAMESPACE   "rt903trim"
+
+/* rt903x_init of all chips at once, one task each. on ESP nvs_flash_init must have run for the trim cache */
+int32_t rt903x_init_parallel(rt903x_dev_t *const *devs, uint8_t count);
+/* efuse check for a chip that took its trims from the cache, 1 = cache was stale and got fixed.
+ * the cache is keyed by port/address only and cannot tell chips apart: a chip replaced at the same
+ * place runs on the previous chip's trims until this has run, so call it soon after init */
+int32_t rt903x_trim_verify(rt903x_dev_t *dev);
+int32_t rt903x_chip_id(rt903x_dev_t *dev);
+int32_t rt903x_clear_int(rt903x_dev_t *dev);
+int32_t rt903x_clear_protection(rt903x_dev_t *dev);
+/* stop, record the cause, clear the protection and forget the cached registers; lowers the
+ * gain cap by the policy. called wherever a PROTECTION status is seen */
+int32_t rt903x_prot_recover(rt903x_dev_t *dev);
+/* gain to program for a requested gain, the cap of a recent protection event applied */
+uint8_t rt903x_prot_gain(rt903x_dev_t *dev, uint8_t gain);
+/* count a restart of an interrupted stream, false once the policy's retries are used up */
+bool rt903x_prot_retry(rt903x_dev_t *dev, uint8_t *tries);
+void rt903x_prot_policy_set(const struct RT903X_PROT_POLICY *policy);
+void rt903x_prot_policy_get(struct RT903X_PROT_POLICY *policy);
+int32_t rt903x_read_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t *val);
+int32_t rt903x_write_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t val);
+/* burst read from reg upward, the range must not cover the RAM/stream/efuse data ports */
+int32_t rt903x_read_block(rt903x_dev_t *dev, uint8_t reg, uint8_t *buf, uint16_t len);
+int32_t rt903x_update_reg(rt903x_dev_t *dev, uint8_t reg, uint8_t mask, uint8_t val);
+void rt903x_shadow_invalidate(rt903x_dev_t *dev);
+int rt903x_speed_check(uint8_t i2c_master_num, uint16_t devAddr, void *arg);
+int32_t rt903x_speed_register(rt903x_dev_t *dev);
+/* both leave dev->config.f0 alone unless the measurement succeeded */
+int32_t rt903x_detect_f0(rt903x_dev_t *dev);
+int32_t rt903x_calc_f0(rt903x_dev_t *dev);
+
+#define RT903X_F0_MAX_CHIPS     4
+#define RT903X_F0_DEADLINE_MS   500     /* whole measurement, f0 waveform + settle */
+#define RT903X_F0_SETTLE_MS     20      /* wait after PLAY_CTRL clears before reading BEMF_CZ */
+#define RT903X_F0_POLL_MS       2
+#define RT903X_F0_MIN_HZ        50
+#define RT903X_F0_MAX_HZ        400
+#define RT903X_F0_TASK_STACK    3072
+#define RT903X_F0_TASK_PRIO     5
+
+#define RT903X_F0_OK            0
+#define RT903X_F0_ERR_BUS       -1      /* I2C failed while starting or polling */
+#define RT903X_F0_ERR_TIMEOUT   -2      /* still playing at the deadline, chip stopped */
+#define RT903X_F0_ERR_RANGE     -3      /* BEMF stamps give no plausible f0 */
+
+typedef struct {
+    rt903x_dev_t *dev;
+    int32_t status;         /*!< RT903X_F0_OK or RT903X_F0_ERR_xxx */
+    uint16_t f0;            /*!< Hz as measured, 0 when nothing was read; only an RT903X_F0_OK result
+                                 replaces dev->config.f0, a failed one keeps the last good value */
+    uint8_t quality;        /*!< 0..100, 100 = both measured periods identical */
+    uint32_t elapsed_ms;    /*!< from submit to this chip's result */
+} rt903x_f0_result_t;
+
+/* runs once on the last finishing worker task, results are only valid during the call */
+typedef void (*rt903x_f0_cb_t)(const rt903x_f0_result_t *results, uint8_t count, void *arg);
+
+/* measure f0 of up to RT903X_F0_MAX_CHIPS chips at once, one worker per bus, returns immediately.
+ * deadline_ms 0 uses RT903X_F0_DEADLINE_MS. -1 means nothing started and cb will not run.
+ * the chips must not be played by anyone else until cb has run */
+int32_t rt903x_detect_f0_async(rt903x_dev_t *const *devs, uint8_t count, uint32_t deadline_ms,
+                               rt903x_f0_cb_t cb, void *arg);
+
+#define RT903X_SYNC_MAX_CHIPS   4
+#define RT903X_SYNC_TASK_STACK  3072
+#define RT903X_SYNC_TASK_PRIO   12      /* same as the I2C executors, nothing gets between release and GO */
+
+typedef struct {
+    rt903x_dev_t *dev;
+    const uint8_t *wave;    /*!< RAM effect to arm, NULL when the caller already armed the chip */
+    uint32_t len;
+    uint8_t gain;
+    int32_t status;         /*!< out: 0 started, -1 arm or GO failed */
+    int64_t go_us;          /*!< out: rt903x_time_us when the GO write completed */
+} rt903x_sync_member_t;
+
+/* arm every member on one task per bus, then release the tasks together so the GO writes of
+ * both buses go out at the same time, back to back within a bus. blocks until all GOs are out.
+ * returns the number started, skew_us (optional) = latest minus earliest GO completion.
+ * a transfer already queued on a bus delays that bus's GO, keep streams off the set */
+int32_t rt903x_sync_play(rt903x_sync_member_t *members, uint8_t count, RT903X_BOOST_VOLTAGE vout, uint32_t *skew_us);
+
+/* both start a RAM loop the chip plays by itself and return; host streaming is only the fallback.
+ * with auto-track enabled play_long tries it first, so the buzz follows the actuator instead of
+ * the stored f0 */
+int32_t rt903x_play_long(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t duration);
+int32_t rt903x_play_transient(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t loop);
+
+/* sine at f0 for duration ms from one resident block plus a repeat-count playlist, returns after GO */
+int32_t rt903x_loop_long(rt903x_dev_t *dev, uint8_t gain, uint16_t duration);
+/* wave_data_list[index] resampled to f0 and played loop times by the chip, returns after GO */
+int32_t rt903x_loop_transient(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t loop);
+int32_t rt903x_loop_stop(rt903x_dev_t *dev);
+
+#define RT903X_TRACK_F0_DEFAULT 130     /* nominal f0 before the first detection */
+
+/* let play_long use auto-track on this chip. off by default: the LRA_F0_CFG scale and the
+ * TRACK_CFG1 enable bit are unverified (rt903x_reg.h), rt903x_track_play itself is not gated */
+void rt903x_track_enable(rt903x_dev_t *dev, bool enable);
+/* nominal f0 into LRA_F0_CFG and BEMF tracking on, shadowed so repeating it is free */
+int32_t rt903x_track_config(rt903x_dev_t *dev, uint16_t f0);
+/* auto-track buzz: one resident drive cycle repeated for duration ms, the chip locks each
+ * cycle to the actuator's resonance. returns after GO */
+int32_t rt903x_track_play(rt903x_dev_t *dev, uint8_t gain, uint16_t duration);
+/* resonance the chip tracked during the last auto-track play, also kept in dev->config.f0 */
+int32_t rt903x_track_f0(rt903x_dev_t *dev, uint16_t *f0);
+
+int32_t rt903x_stream_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size);
+#define RT903X_STREAM_IOV_MAX   8
+int32_t rt903x_stream_datav(rt903x_dev_t *dev, const i2c_iovec_t *iov, uint8_t iovcnt);
+int32_t rt903x_boost_voltage(rt903x_dev_t *dev, RT903X_BOOST_VOLTAGE vout);
+int32_t rt903x_gain(rt903x_dev_t *dev, uint8_t gain);
+int32_t rt903x_go(rt903x_dev_t *dev, uint8_t val);
+int32_t rt903x_play_mode(rt903x_dev_t *dev, RT903X_PLAY_MODE mode);
+int32_t rt903x_play_setup(rt903x_dev_t *dev, RT903X_PLAY_MODE mode, uint8_t gain, RT903X_BOOST_VOLTAGE vout);
+int32_t rt903x_playlist_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size);
+int32_t rt903x_waveform_data(rt903x_dev_t *dev, const uint8_t* buf, int32_t size);
+int32_t rt903x_ram_load(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len);
+void rt903x_ram_forget(rt903x_dev_t *dev);
+/* FIFO bytes, and the FIFO space one FIFO_AE refill fills */
+uint16_t rt903x_ram_fifo_size(rt903x_dev_t *dev);
+uint16_t rt903x_ram_refill_size(rt903x_dev_t *dev);
+/* FIFO of fifo_size, playlist right after it, waveforms up to the end of RAM. fifo_ae/fifo_af 0
+ * take 1/4 and 3/4 of the FIFO. stops playback and drops the resident effects and trigger
+ * bindings, refused while the chip streams */
+int32_t rt903x_ram_partition(rt903x_dev_t *dev, uint16_t fifo_size, uint16_t fifo_ae, uint16_t fifo_af);
+
+#define RT903X_ARM_TASK_STACK   3072
+#define RT903X_ARM_TASK_PRIO    6       /* background, below the vibrate and stream tasks */
+#define RT903X_ARM_WAIT_MS      500     /* longest wait for the running effect, then the arm is retried */
+#define RT903X_ARM_RETRY_MS     100     /* next try of an arm put off by a running effect or stream */
+#define RT903X_ARM_POLL_MS      5
+#define RT903X_ARM_DEV_MAX      4
 
-int32_t rt903x_play_long(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t gain, uint16_t duration);
-int32_t rt903x_play_transient(DEF_RT903_INFO i2c_config, uint16_t index, uint8_t gain, uint16_t loop);
+/* effect resident and selected, mode/gain/boost in place: only GO is missing. no bus access */
+bool rt903x_ram_armed(rt903x_dev_t *dev, const uint8_t *wave, uint8_t gain, RT903X_BOOST_VOLTAGE vout);
+int32_t rt903x_ram_arm(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain, RT903X_BOOST_VOLTAGE vout);
+/* arm on a background task once the running effect or stream has finished, the latest request wins.
+ * a chip that streams is never armed under it: RAM loads are refused while rt903x_stream_busy */
+int32_t rt903x_ram_arm_async(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain, RT903X_BOOST_VOLTAGE vout);
+/* hold: drop the pending background arm and refuse new ones until released, e.g. while f0 is
+ * measured. returns once an arm already in progress has finished */
+void rt903x_ram_arm_hold(rt903x_dev_t *dev, bool hold);
+/* GO, preparing first only if the chip was not armed for this effect. was_armed may be NULL */
+int32_t rt903x_ram_trigger(rt903x_dev_t *dev, const uint8_t *wave, uint32_t len, uint8_t gain,
+                           RT903X_BOOST_VOLTAGE vout, bool *was_armed);
 
-int32_t rt903x_stream_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size);
-int32_t rt903x_boost_voltage(DEF_RT903_INFO i2c_config, RT903X_BOOST_VOLTAGE vout);
-int32_t rt903x_gain(DEF_RT903_INFO i2c_config, uint8_t gain);
-int32_t rt903x_go(DEF_RT903_INFO i2c_config, uint8_t val);
-int32_t rt903x_play_mode(DEF_RT903_INFO i2c_config, RT903X_PLAY_MODE mode);
-int32_t rt903x_playlist_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size);
-int32_t rt903x_waveform_data(DEF_RT903_INFO i2c_config, const uint8_t* buf, int32_t size);
+/* upload the bound effects as one wave table and let the chip's trigger inputs start them on
+ * their own, the MCU is not involved in a press. replaces whatever the waveform area held.
+ * the trigger enable bit and the 1-based entry numbering are not confirmed on silicon yet,
+ * see BIT_GPIO_CFG_TRIG_EN / GPIO_ENTRY_NONE in rt903x_reg.h */
+int32_t rt903x_gpio_trig_bind(rt903x_dev_t *dev, const struct RT903X_GPIO_BIND bind[RT903X_GPIO_TRIG_NUM],
+                              uint8_t gain, RT903X_BOOST_VOLTAGE vout);
+int32_t rt903x_gpio_trig_unbind(rt903x_dev_t *dev);
+/* level of the trigger inputs, bit n = GPIOn+1 */
+int32_t rt903x_gpio_trig_status(rt903x_dev_t *dev, uint8_t *level);
 
-int16_t rt903x_Ram_prepare(DEF_RT903_INFO i2c_config, uint8_t gain, uint8_t number, uint8_t area);
-int16_t rt903x_Ram_play(DEF_RT903_INFO i2c_config);
+int16_t rt903x_Ram_prepare(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t area);
+int16_t rt903x_Ram_play(rt903x_dev_t *dev);
+int16_t rt903x_Ram_trigger(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number, bool *was_armed);
+int16_t rt903x_Ram_arm(rt903x_dev_t *dev, uint8_t gain, uint8_t number, uint8_t int_number);
+int32_t rt903x_Ram_effect_ms(uint8_t number, uint8_t int_number);
+int16_t rt903x_Ram_sync_play(rt903x_dev_t *const *devs, uint8_t count, const uint8_t *gain, uint8_t number,
+                             const uint8_t *int_number, uint32_t *skew_us);
+int16_t rt903x_Ram_gpio_bind(rt903x_dev_t *dev, uint8_t gain, uint8_t number, const uint8_t int_number[RT903X_GPIO_TRIG_NUM]);
 
-int32_t rt903x_stream_play_demo(DEF_RT903_INFO i2c_config, const uint8_t *stream_data, uint32_t stream_data_len);
-int rt903x_stream_play_effect(DEF_RT903_INFO i2c_config, uint8_t index);
+int32_t rt903x_stream_play_demo(rt903x_dev_t *dev, const uint8_t *stream_data, uint32_t stream_data_len);
+int rt903x_stream_play_effect(rt903x_dev_t *dev, uint8_t index);
 
-extern struct RT903X_CONFIG rt903x_config;
 
 #endif // __RT903X
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef __RT903X_PORT_H
+#define __RT903X_PORT_H
+
+/*
+ * Platform shim of the rt903 driver (rt903x*.c, ics_util.c). Logging, time, persistent
+ * storage, the INT line and the few RTOS services the driver needs go through here, the bus
+ * through i2c_bus_t. rt903x_port_esp.c maps it onto ESP-IDF / FreeRTOS, rt903x_port_host.c
+ * onto POSIX threads for the host bench (host/), so the same driver sources build on both.
+ * Timeouts are in ms, RT903X_WAIT_FOREVER blocks; the ESP side rounds them up to whole ticks.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RT903X_WAIT_FOREVER         UINT32_MAX
+#define RT903X_CORE_ANY             (-1)
+#define RT903X_STORE_KEY_MAX        16      /* NVS key length, terminator included */
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+#define RT903X_LOGE(tag, fmt, ...)  ESP_LOGE(tag, fmt, ##__VA_ARGS__)
+#define RT903X_LOGW(tag, fmt, ...)  ESP_LOGW(tag, fmt, ##__VA_ARGS__)
+#define RT903X_LOGI(tag, fmt, ...)  ESP_LOGI(tag, fmt, ##__VA_ARGS__)
+#define RT903X_LOGD(tag, fmt, ...)  ESP_LOGD(tag, fmt, ##__VA_ARGS__)
+#define RT903X_ISR_ATTR             IRAM_ATTR
+
+/* short critical section, also taken from the engine ISR path */
+typedef portMUX_TYPE rt903x_spin_t;
+#define RT903X_SPIN_INIT            portMUX_INITIALIZER_UNLOCKED
+#define rt903x_spin_lock(spin)      portENTER_CRITICAL(spin)
+#define rt903x_spin_unlock(spin)    portEXIT_CRITICAL(spin)
+
+typedef struct {
+    SemaphoreHandle_t handle;
+    StaticSemaphore_t buf;
+    bool recursive;
+} rt903x_mutex_t;
+
+typedef struct {
+    SemaphoreHandle_t handle;
+    StaticSemaphore_t buf;
+} rt903x_sem_t;
+
+typedef struct {
+    EventGroupHandle_t handle;
+    StaticEventGroup_t buf;
+} rt903x_event_t;
+
+typedef TaskHandle_t rt903x_task_t;
+#else
+#include <stdio.h>
+#include <pthread.h>
+
+#define RT903X_LOGE(tag, fmt, ...)  printf("E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define RT903X_LOGW(tag, fmt, ...)  printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define RT903X_LOGI(tag, fmt, ...)  printf("I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define RT903X_LOGD(tag, fmt, ...)  do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#define RT903X_ISR_ATTR
+
+/* recursive like portENTER_CRITICAL, which nests; the host build defines _GNU_SOURCE for the initializer */
+typedef pthread_mutex_t rt903x_spin_t;
+#define RT903X_SPIN_INIT            PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#define rt903x_spin_lock(spin)      pthread_mutex_lock(spin)
+#define rt903x_spin_unlock(spin)    pthread_mutex_unlock(spin)
+
+typedef struct {
+    pthread_mutex_t lock;
+} rt903x_mutex_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t max;
+} rt903x_sem_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t bits;
+} rt903x_event_t;
+
+typedef struct rt903x_host_task *rt903x_task_t;
+
+/* host bench drives the shared INT line, a falling edge calls the attached handler */
+void rt903x_port_host_irq_set(uint8_t gpio, int level);
+#endif
+
+typedef void (*rt903x_irq_handler_t)(void *arg);
+
+/* time since boot */
+int64_t rt903x_time_us(void);
+static inline uint32_t rt903x_time_ms(void)
+{
+    return (uint32_t)(rt903x_time_us() / 1000);
+}
+/* vTaskDelay(pdMS_TO_TICKS(ms)): rounds down, below one tick it only yields */
+void rt903x_delay_ms(uint32_t ms);
+/* rounds up, sleeps at least one tick; for poll loops that must not spin */
+void rt903x_sleep_ms(uint32_t ms);
+
+void rt903x_mutex_init(rt903x_mutex_t *mutex, bool recursive);
+void rt903x_mutex_lock(rt903x_mutex_t *mutex);
+/* false when the mutex was not free within timeout_ms */
+bool rt903x_mutex_trylock(rt903x_mutex_t *mutex, uint32_t timeout_ms);
+void rt903x_mutex_unlock(rt903x_mutex_t *mutex);
+
+/* counting semaphore, max 1 is a binary one */
+void rt903x_sem_init(rt903x_sem_t *sem, uint32_t max, uint32_t initial);
+bool rt903x_sem_take(rt903x_sem_t *sem, uint32_t timeout_ms);
+void rt903x_sem_give(rt903x_sem_t *sem);
+void rt903x_sem_deinit(rt903x_sem_t *sem);
+
+/* event bits, for barriers across tasks */
+void rt903x_event_init(rt903x_event_t *event);
+void rt903x_event_set(rt903x_event_t *event, uint32_t bits);
+/* wait until all of bits are set, they stay set */
+bool rt903x_event_wait_all(rt903x_event_t *event, uint32_t bits, uint32_t timeout_ms);
+void rt903x_event_deinit(rt903x_event_t *event);
+
+/* core RT903X_CORE_ANY lets the scheduler pick, a task ends with rt903x_task_exit; task may be NULL */
+int32_t rt903x_task_create(void (*fn)(void *), const char *name, uint32_t stack, void *arg,
+                           uint8_t prio, int8_t core, rt903x_task_t *task);
+void rt903x_task_exit(void);
+/* or bits into the task's notification value and wake it */
+void rt903x_task_notify(rt903x_task_t task, uint32_t bits);
+void rt903x_task_notify_isr(rt903x_task_t task, uint32_t bits);
+/* notification bits of the calling task since its last wait, 0 on timeout */
+uint32_t rt903x_task_wait(uint32_t timeout_ms);
+
+/* persistent blobs (NVS), 0 only when a blob of exactly len bytes was found / stored */
+int32_t rt903x_store_get(const char *ns, const char *key, void *buf, uint32_t len);
+int32_t rt903x_store_set(const char *ns, const char *key, const void *buf, uint32_t len);
+
+/* INT line: input with pull-up, handler on every falling edge */
+int32_t rt903x_irq_attach(uint8_t gpio, rt903x_irq_handler_t handler, void *arg);
+int rt903x_irq_level(uint8_t gpio);
+
+#endif // __RT903X_PORT_H
@@ -131,6 +131,34 @@
 #define BIT_INTS_FIFO_AF             (1 << 1)
 #define BIT_INTS_PROTECTION          (1 << 0)
 
+// RT903X_REG_INT_MASK, same bit layout as INT_STATUS, 1 = source does not drive the INT pin
+#define BIT_INTM_ALL                 (0x0F)
+
+// RT903X_REG_INT_CFG
+#define BIT_INT_CFG_PIN_EN           (1 << 0)     // INT pin follows unmasked INT_STATUS, open drain, active low
+
+// RT903X_REG_LRA_F0_CFG1/2, RT903X_REG_TRACK_F0_VAL1/2: f0 * 10 (0.1 Hz), low byte first.
+// UNVERIFIED: the 0.1 Hz unit is inferred from the init value 0x052B reading as a plausible
+// 132.3 Hz, not from the datasheet. a wrong scale puts auto-track off resonance and
+// rt903x_track_f0 stores a wrong f0
+#define LRA_F0_CFG_SCALE             10
+
+// RT903X_REG_TRACK_CFG1
+// UNVERIFIED: bit 0 as the tracking enable is assumed, not checked on a board. auto-track is
+// therefore opt-in, see rt903x_track_enable
+#define BIT_TRACK_EN                 (1 << 0)     // auto-track mode retimes every drive cycle to the BEMF zero crossings
+
+// RT903X_REG_GPIO_CFG1..3, one per trigger input.
+// UNCONFIRMED: bit 0 as the trigger enable is our reading of the register map, not checked against
+// the datasheet or a board. if presses do nothing after rt903x_gpio_trig_bind, look here first
+#define BIT_GPIO_CFG_TRIG_EN         (1 << 0)     // edges on the pin play GPIOx_POS/NEG_ENTRY from the wave table
+
+// RT903X_REG_GPIOx_POS/NEG_ENTRY.
+// UNCONFIRMED: entries counted from 1 at WAVE_BASE with 0 as "no effect" is assumed, the same way the
+// playlist numbers its wave table. if the chip counts from 0, every edge plays the effect one off
+// and 0 plays the first one instead of nothing
+#define GPIO_ENTRY_NONE              0x00         // entries count from 1 at WAVE_BASE
+
 // RT903X_REG_EFS_MODE_CTRL
 #define BIT_EFS_READ                 (1 << 1)
 #define BIT_EFS_PGM                  (1 << 0)
@@ -0,0 +1,78 @@
+#ifndef __RT903X_SCHED_H
+#define __RT903X_SCHED_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "rt903x.h"
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#endif
+
+/*
+ * Per chip effect scheduler.
+ * Every chip gets one worker task and a small bounded queue, so a long effect on one chip
+ * never holds up a click on another and callers never block on playback. The worker plays
+ * the highest priority request first (oldest first within a priority). A request with the
+ * same or higher priority than the playing one cuts it off, a lower one waits for it to end.
+ * A request equal to one still waiting in the queue is merged into it instead of queued twice.
+ */
+
+#define RT903X_SCHED_CHIP_MAX       4
+#define RT903X_SCHED_QUEUE_LEN      8
+#define RT903X_SCHED_TASK_STACK     3072
+#define RT903X_SCHED_TASK_PRIO      10      /* same as the input tasks, below the stream engine */
+#define RT903X_SCHED_STREAM_MAX_MS  5000    /* stream effect still running after this is stopped */
+#define RT903X_SCHED_HOLD_WAIT_MS   1000    /* longest wait for the worker to let go of the chip */
+
+typedef enum
+{
+    RT903X_SCHED_PRIO_LOW = 0,      /*!< background buzz, waits for everything else */
+    RT903X_SCHED_PRIO_NORMAL,       /*!< UI feedback such as a mode switch */
+    RT903X_SCHED_PRIO_CLICK,        /*!< key press, cuts anything below and an older click */
+} RT903X_SCHED_PRIO;
+
+typedef enum
+{
+    RT903X_SCHED_CLICK = 0,         /*!< RAM effect (effect group, INPUT_INT), see rt903x_Ram_trigger */
+    RT903X_SCHED_STREAM,            /*!< stream effect index, see rt903x_stream_play_effect */
+    RT903X_SCHED_LONG,              /*!< buzz of duration ms, see rt903x_play_long_start, cut like a stream */
+} RT903X_SCHED_KIND;
+
+typedef struct
+{
+    RT903X_SCHED_KIND kind;
+    RT903X_SCHED_PRIO prio;
+    uint8_t effect;                 /*!< click: effect group, stream: effect index, long: wave index */
+    uint8_t int_number;             /*!< click: INPUT_INT that fired, the effect armed after it */
+    uint8_t gain;
+    uint16_t duration;              /*!< long: ms */
+} rt903x_sched_req_t;
+
+/* cumulative per chip */
+typedef struct
+{
+    uint32_t submitted;
+    uint32_t played;
+    uint32_t coalesced;     /*!< merged into a request still waiting in the queue */
+    uint32_t preempted;     /*!< playing effect cut off by a newer request */
+    uint32_t dropped;       /*!< queue full of requests with a higher priority, or the chip was held */
+    uint32_t failed;        /*!< start returned an error */
+    uint32_t click_armed;   /*!< clicks the chip was already armed for, only the GO write on the press */
+    uint32_t click_cold;    /*!< clicks that had to load and set up the effect first */
+    uint8_t queued_max;     /*!< deepest the queue has been */
+} rt903x_sched_stats_t;
+
+/* one worker per chip, call after rt903x_stream_engine_add so stream effects can be cut */
+int32_t rt903x_sched_add(rt903x_dev_t *dev, uint8_t core_id);
+/* queue a request and return at once, -1 when the chip has no worker or the request was dropped */
+int32_t rt903x_sched_submit(rt903x_dev_t *dev, const rt903x_sched_req_t *req);
+/* drop every queued request of the chip and stop what it plays */
+int32_t rt903x_sched_cancel(rt903x_dev_t *dev);
+/* hold: cancel and refuse submits until released, so someone else (f0 detection) can use the chip.
+ * returns once the worker is idle, -1 when it still was not after RT903X_SCHED_HOLD_WAIT_MS */
+int32_t rt903x_sched_hold(rt903x_dev_t *dev, bool hold);
+void rt903x_sched_stats(rt903x_dev_t *dev, rt903x_sched_stats_t *stats);
+#ifdef ESP_PLATFORM
+esp_err_t rt903x_sched_register_cmd(void);
+#endif
+
+#endif // __RT903X_SCHED_H
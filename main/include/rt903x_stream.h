@@ -0,0 +1,93 @@
+#ifndef __RT903X_STREAM_H
+#define __RT903X_STREAM_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "rt903x.h"
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+#endif
+
+/*
+ * Interrupt driven stream engine.
+ * Every rt903 INT pin is wired to one GPIO (open drain, active low, README: GPIO5).
+ * A chip only drives the line while it streams, with FIFO_AE / PLAYDONE / PROTECTION
+ * unmasked. On a falling edge the engine task reads INT_STATUS of the armed chips and
+ * refills the FIFO, nothing polls the bus while the FIFO is above the AE threshold.
+ * PROTECTION stays unmasked when idle, so a trip during a RAM play is recovered too.
+ */
+
+#define RT903X_STREAM_CHIP_MAX          4
+#define RT903X_STREAM_TASK_STACK        3072
+#define RT903X_STREAM_TASK_PRIO         11      /* below the I2C executors, above the vibrate tasks */
+#define RT903X_STREAM_IDLE_CHECK_MS     50      /* re-check the line in case an edge was lost */
+#define RT903X_STREAM_WAIT_MS           1000    /* longest gap between two interrupts of a streaming chip */
+#define RT903X_STREAM_SERVICE_MAX       8       /* passes while the line stays low before yielding */
+#define RT903X_STREAM_INT_SRC           (BIT_INTS_PLAYDONE | BIT_INTS_FIFO_AE | BIT_INTS_PROTECTION)
+#define RT903X_STREAM_IDLE_SRC          (BIT_INTS_PROTECTION)
+
+#define RT903X_PIPE_BLOCK_SIZE          128
+#define RT903X_PIPE_BLOCKS              8       /* 1 KB ahead, more than one FIFO prime + refill */
+#define RT903X_PIPE_TASK_STACK          3072
+#define RT903X_PIPE_TASK_PRIO           10
+#define RT903X_PIPE_PRODUCER_CORE       0       /* the engine task sits on core 1, see main.c */
+#define RT903X_PIPE_PRIME_MS            100     /* longest wait for the producer before GO */
+
+/* producer side, runs on the producer core: write up to size samples, return the count, 0 = end */
+typedef int32_t (*rt903x_pipe_fill_t)(void *ctx, uint8_t *buf, int32_t size);
+/* ctx handed back once fill() is never called again and the stream is over, e.g. free */
+typedef void (*rt903x_pipe_release_t)(void *ctx);
+
+/* cumulative per chip */
+typedef struct {
+    uint32_t produced;      /*!< bytes the producer put in the ring */
+    uint32_t consumed;      /*!< bytes written to the FIFO from the ring */
+    uint32_t backpressure;  /*!< producer found the ring full and waited */
+    uint32_t underrun;      /*!< FIFO_AE found less data in the ring than FIFO space, the next block is pushed at once */
+} rt903x_pipe_stats_t;
+
+/* status 0: PLAYDONE after the whole buffer, RT903X_PROT_EVENT: protection, already recovered,
+ * -1: bus error, or the FIFO ran dry before a pipe producer finished; chip stopped */
+typedef void (*rt903x_stream_done_t)(rt903x_dev_t *dev, int32_t status, void *arg);
+
+/* INT line through rt903x_irq_attach, on ESP gpio_install_isr_service must already have run */
+int32_t rt903x_stream_engine_init(uint8_t int_gpio, uint8_t core_id);
+/* configure INT_CFG, mask every source and attach the chip to the engine */
+int32_t rt903x_stream_engine_add(rt903x_dev_t *dev);
+bool rt903x_stream_engine_owns(rt903x_dev_t *dev);
+/* a stream or its producer is still running on the chip */
+bool rt903x_stream_busy(rt903x_dev_t *dev);
+
+/* play mode, gain and boost are set by the caller (rt903x_play_setup), the buffer must
+ * stay valid until cb runs on the engine task */
+int32_t rt903x_stream_start(rt903x_dev_t *dev, const uint8_t *data, uint32_t len,
+                            rt903x_stream_done_t cb, void *arg);
+/* samples come from fill() on a producer task pinned to producer_core, the engine task
+ * drains them on FIFO_AE. with release the pipe owns ctx and calls release(ctx) exactly once,
+ * also when the start fails or the stream is stopped; without it ctx must outlive the producer */
+int32_t rt903x_stream_start_pipe(rt903x_dev_t *dev, rt903x_pipe_fill_t fill, void *ctx, rt903x_pipe_release_t release,
+                                 uint8_t producer_core, rt903x_stream_done_t cb, void *arg);
+/* blocking rt903x_stream_start_pipe, returns once fill() is no longer called */
+int32_t rt903x_stream_run_pipe(rt903x_dev_t *dev, rt903x_pipe_fill_t fill, void *ctx, uint8_t producer_core);
+/* block on done, given by the stream's cb, while the engine keeps refilling the FIFO. a stream
+ * with no refill for RT903X_STREAM_WAIT_MS is stopped and false returned; true once cb ran */
+bool rt903x_stream_wait_done(rt903x_dev_t *dev, rt903x_sem_t *done);
+void rt903x_stream_pipe_stats(rt903x_dev_t *dev, rt903x_pipe_stats_t *stats);
+#ifdef ESP_PLATFORM
+esp_err_t rt903x_stream_register_cmd(void);
+#endif
+int32_t rt903x_stream_stop(rt903x_dev_t *dev);
+
+/* for callers that generate data themselves: arm the INT sources, then block until the
+ * chip interrupts and get the INT_STATUS bits seen since the last wait */
+int32_t rt903x_stream_int_arm(rt903x_dev_t *dev, bool arm);
+int32_t rt903x_stream_wait_int(rt903x_dev_t *dev, uint8_t *status, uint32_t timeout_ms);
+
+/* stream demo effect index without waiting for it, -1 when the engine does not own the chip */
+int32_t rt903x_stream_effect_start(rt903x_dev_t *dev, uint8_t index, uint8_t gain, rt903x_stream_done_t cb, void *arg);
+/* rt903x_play_long without waiting: 0 the chip loops it by itself for duration ms (cb is not
+ * called), 1 it streams through a producer pipe and cb runs at the end, rt903x_stream_stop cuts
+ * it. -1 on error or when the engine does not own the chip, rt903x_play_long is the fallback */
+int32_t rt903x_play_long_start(rt903x_dev_t *dev, uint16_t index, uint8_t gain, uint16_t duration,
+                               rt903x_stream_done_t cb, void *arg);
+
+#endif // __RT903X_STREAM_H
@@ -209,6 +209,12 @@ typedef struct ussys_tp_info {
 	uint8_t supported_sensors; /* supported sensors */
 } ussys_tp_info_t;
 
+/* one segment of a scatter-gather i2c write */
+typedef struct ussys_tp_iovec {
+	const uint8_t *base;
+	uint16_t len;
+} ussys_tp_iovec_t;
+
 typedef struct ussys_tp_dev {
 	/* dev index, must to fill */
 	uint8_t dev_idx;
@@ -222,6 +228,15 @@ typedef struct ussys_tp_dev {
 	/* i2c write function, must to implement */
 	int (*i2c_write)(struct ussys_tp_dev *dev, uint8_t *buf, uint16_t size);
 
+	/* i2c scatter-gather write, all segments back to back in one transaction, must to implement */
+	int (*i2c_writev)(struct ussys_tp_dev *dev, const ussys_tp_iovec_t *iov, uint8_t iovcnt);
+
+	/* i2c write then read joined by a repeated start in one transaction, must to implement */
+	int (*i2c_write_read)(struct ussys_tp_dev *dev, const uint8_t *wbuf, uint16_t wsize, uint8_t *rbuf, uint16_t rsize);
+
+	/* called before each i2c retry of the transport, optional (may be NULL) */
+	void (*i2c_retry_notify)(struct ussys_tp_dev *dev);
+
 	/* get system tick in microsecond, must to implement */
 	uint64_t (*get_timestamp_us)(void);
 
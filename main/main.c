@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include "rt903x.h"
 #include "rt903x_reg.h"
+#include "rt903x_stream.h"
+#include "rt903x_sched.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -11,6 +15,9 @@
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
 #include <i2c_adapter.h>
 #include "filesystem.h"
 #include "ledcontrol.h"
@@ -26,14 +33,16 @@ static int8_t gain_value = 0x0;
 
 DEF_RT903_INFO RT903_INFO[RT903_CHIP_NUMBER_MAX] = 
 {
-// {is_online, i2c_master_num, i2c_address, }
-    {false, I2C_MASTER_NUM0, I2C_0_ADDRESS},    {false, I2C_MASTER_NUM0, I2C_1_ADDRESS},
-    {false, I2C_MASTER_NUM1, I2C_0_ADDRESS},    {false, I2C_MASTER_NUM1, I2C_1_ADDRESS},
+// {is_online, i2c_master_num, i2c_address, max_freq_hz}
+    {false, I2C_MASTER_NUM0, I2C_0_ADDRESS, I2C_SPEED_FAST_PLUS_HZ},    {false, I2C_MASTER_NUM0, I2C_1_ADDRESS, I2C_SPEED_FAST_PLUS_HZ},
+    {false, I2C_MASTER_NUM1, I2C_0_ADDRESS, I2C_SPEED_FAST_PLUS_HZ},    {false, I2C_MASTER_NUM1, I2C_1_ADDRESS, I2C_SPEED_FAST_PLUS_HZ},
 };
+//每颗rt903一个句柄，f0、trim、RAM分区和播放状态互不影响
+static rt903x_dev_t rt903_dev[RT903_CHIP_NUMBER_MAX];
 def_i2c_config_t i2cConfig[] = {
-//i2c_master_num, i2c_master_sda_io, i2c_master_scl_io, i2c_master_freq_hz
-    {I2C_MASTER_NUM0, I2C_MASTER_0_SDA_IO, I2C_MASTER_0_SCL_IO, I2C_MASTER_FREQ_HZ},
-    {I2C_MASTER_NUM1, I2C_MASTER_1_SDA_IO, I2C_MASTER_1_SCL_IO, I2C_MASTER_FREQ_HZ},
+//i2c_master_num, i2c_master_sda_io, i2c_master_scl_io, i2c_master_freq_hz, i2c_master_max_freq_hz
+    {I2C_MASTER_NUM0, I2C_MASTER_0_SDA_IO, I2C_MASTER_0_SCL_IO, I2C_MASTER_FREQ_HZ, I2C_SPEED_FAST_PLUS_HZ},
+    {I2C_MASTER_NUM1, I2C_MASTER_1_SDA_IO, I2C_MASTER_1_SCL_IO, I2C_MASTER_FREQ_HZ, I2C_SPEED_FAST_PLUS_HZ},
 };
 
 const uint8_t INPUT_INT[] = 
@@ -63,6 +72,7 @@ int8_t gain_play_list_len = sizeof(hard_gain_play_list)/sizeof(hard_gain_play_li
 
 void set_i2c_master_num(uint8_t num);
 void ussys_tp_main(void);
+void ussys_tp_speed_register(uint8_t i2c_master_num);
 
 void cust_gpio_intr_anyedge_config(uint8_t gpio_num) {
     gpio_config_t io_conf;
@@ -90,53 +100,115 @@ bool is_rt903_online(DEF_RT903_INFO rt903)
 }
 
 
+//每颗rt903下一次按键最可能播放的效果：上一次触发它的 INPUT_INT，0 表示这颗芯片没有按键
+static uint8_t rt903_expected_int[RT903_CHIP_NUMBER_MAX] = {INPUT_INT1, INPUT_INT3, INPUT_INT5, 0};
+
+static uint16_t rt903_chip_gain(int chip)
+{
+    return (chip == 2) ? soft_gain_play_list[gain_value] : hard_gain_play_list[gain_value];
+}
+
+//每颗芯片的 RAM 划分：只播按键点击的芯片缩小 FIFO，多放常驻效果；要播流效果的保持默认
+static const uint16_t rt903_fifo_size[RT903_CHIP_NUMBER_MAX] =
+{
+    RT903X_FIFO_SIZE_DEFAULT, RT903X_FIFO_SIZE_CLICK, RT903X_FIFO_SIZE_CLICK, RT903X_FIFO_SIZE_DEFAULT,
+};
+
+//按键直接接到rt903触发脚时，每个触发脚对应的 INPUT_INT 效果表，全 0 表示这颗芯片没有绑定
+static uint8_t rt903_gpio_bind_int[RT903_CHIP_NUMBER_MAX][RT903X_GPIO_TRIG_NUM];
+
+static bool rt903_gpio_bound(int chip)
+{
+    for(int n=0;n<RT903X_GPIO_TRIG_NUM;n++){
+        if(rt903_gpio_bind_int[chip][n] != 0) return true;
+    }
+    return false;
+}
+
+//后台把每颗芯片的预期效果准备好，按键时只剩一次 GO 写；绑定了触发脚的芯片按当前效果组和增益重新绑定
+static void rt903_arm_expected(void)
+{
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i]) && rt903_gpio_bound(i)){
+            rt903x_Ram_gpio_bind(&rt903_dev[i], rt903_chip_gain(i), number % EFFECT_NUMBER_MAX, rt903_gpio_bind_int[i]);
+        }
+        else if(is_rt903_online(RT903_INFO[i]) && rt903_expected_int[i] != 0){
+            rt903x_Ram_arm(&rt903_dev[i], rt903_chip_gain(i), number % EFFECT_NUMBER_MAX, rt903_expected_int[i]);
+        }
+    }
+}
+
+static void rt903_press(int chip, uint8_t gpio_num, int j)
+{
+    if(rt903_gpio_bound(chip)) return;  //按键接在芯片触发脚上，芯片自己播
+    //交给这颗芯片的调度任务：打断正在播的长振动，不等播完就返回，其它芯片的按键不受影响
+    rt903x_sched_req_t req = {RT903X_SCHED_CLICK, RT903X_SCHED_PRIO_CLICK, j, gpio_num, rt903_chip_gain(chip), 0};
+    if(rt903x_sched_submit(&rt903_dev[chip], &req) < 0){
+        printf("rt903[%d] gpio:%d not queued\n", chip, gpio_num);
+    }
+    rt903_expected_int[chip] = gpio_num;
+}
+
+//按键脚上次确认的电平，电平没变的中断是抖动，不再靠延时后清空队列来消抖
+static int8_t rt903_int_level[INT_DATA_MAX];
+
+static int8_t *rt903_int_last_level(uint8_t gpio_num)
+{
+    for(int i=0;i<INT_DATA_MAX;i++){
+        if(INPUT_INT[i] == gpio_num) return &rt903_int_level[i];
+    }
+    return NULL;
+}
+
 void rt903_vibrate_task(void* arg) {
     int i =0;
+    for(int n=0;n<INT_DATA_MAX;n++){
+        rt903_int_level[n] = gpio_get_level(INPUT_INT[n]);
+    }
     for (;;) {
         /* receive gpio_int_evt_queue data,  */
         uint8_t gpio_num = 0;
         printf("rt903_vibrate_task enter, i:%d\n", i++);
         if(xQueueReceive(gpio_int_evt_queue, &gpio_num, portMAX_DELAY) == pdPASS ){
             int level = gpio_get_level(gpio_num);
+            int8_t *last_level = rt903_int_last_level(gpio_num);
             vTaskDelay(15 / portTICK_PERIOD_MS);//消抖，隔10ms再获取状态
-            if(level == gpio_get_level(gpio_num)){
+            if(level == gpio_get_level(gpio_num) && last_level != NULL && level != *last_level){
+                *last_level = level;
                 int j = number % EFFECT_NUMBER_MAX;
                 printf("rt903_vibrate_task enter, gpio:%d, level:%d, effect number is :%d\n", gpio_num, level, j);
                 switch (gpio_num)
                 {
                     case INPUT_INT1:
                     case INPUT_INT2:
-                        rt903x_Ram_prepare(RT903_INFO[0], hard_gain_play_list[gain_value], j,gpio_num);
-                        rt903x_Ram_play(RT903_INFO[0]);
+                        rt903_press(0, gpio_num, j);
                         break;
                     case INPUT_INT3:
                     case INPUT_INT4:
                         if(0 == level){
-                            rt903x_Ram_prepare(RT903_INFO[1], hard_gain_play_list[gain_value], j,gpio_num);
-                            rt903x_Ram_play(RT903_INFO[1]);
+                            rt903_press(1, gpio_num, j);
                         }
                         break;
                     case INPUT_INT5:
                     case INPUT_INT6:
                     case INPUT_INT7:
                     case INPUT_INT8:
-                        rt903x_Ram_prepare(RT903_INFO[2], soft_gain_play_list[gain_value], j,gpio_num);
-                        rt903x_Ram_play(RT903_INFO[2]);
+                        rt903_press(2, gpio_num, j);
                         break;
     /*
                     case GPIO_NUM_6:
                     // if(level == 0){// 定义此触发为播放音效，播放音效时，只在按下时播放，抬起时不播放
                         prepare_ram_data(j);
-                        rt903x_Ram_play(RT903_INFO[0]);
+                        rt903x_Ram_play(&rt903_dev[0]);
                     //  }
                         break;
                     case GPIO_NUM_7:
                         prepare_ram_data(j);
-                        rt903x_Ram_play(RT903_INFO[1]);    
+                        rt903x_Ram_play(&rt903_dev[1]);    
                         break;
                     case GPIO_NUM_8:
                         prepare_ram_data(j);
-                        rt903x_Ram_play(RT903_INFO[3]);    
+                        rt903x_Ram_play(&rt903_dev[3]);    
                         break;
                     case GPIO_NUM_10:
                     case GPIO_NUM_14:
@@ -145,7 +217,7 @@ void rt903_vibrate_task(void* arg) {
                             if(0 == gpio_get_level(gpio_num)){
                                 gain_value++;
                                 if(gain_value >= gain_play_list_len) gain_value = 0;
-                                rt903x_stream_play_demo(RT903_INFO[1]);//临时使用音效提醒切换成功
+                                rt903x_stream_play_demo(&rt903_dev[1]);//临时使用音效提醒切换成功
                                 printf("gain_value++:%d\n", gain_value);
                             }
                         }
@@ -156,7 +228,7 @@ void rt903_vibrate_task(void* arg) {
                             if(0 == gpio_get_level(gpio_num)){
                                 number++;
                                 if(number >= EFFECT_NUMBER_MAX) number = 0;
-                                rt903x_stream_play_demo(RT903_INFO[0]);//临时使用音效提醒切换成功
+                                rt903x_stream_play_demo(&rt903_dev[0]);//临时使用音效提醒切换成功
                                 printf("number--:%d\n", number);
                             }
                         }
@@ -165,14 +237,20 @@ void rt903_vibrate_task(void* arg) {
                         break;
                 }
             }
-            // 延时50ms，在延时期间的消息清空，不予响应
-            vTaskDelay(pdMS_TO_TICKS(45));
-            xQueueReset(gpio_int_evt_queue);
         }
     }
     vTaskDelete(NULL); // 删除任务
 }
 
+//切换提示音效不阻塞开关任务，按键的点击可以打断它
+static void rt903_feedback(uint8_t index)
+{
+    rt903x_sched_req_t req = {RT903X_SCHED_STREAM, RT903X_SCHED_PRIO_NORMAL, index, 0, 0x80, 0};
+    if(rt903x_sched_submit(&rt903_dev[0], &req) < 0){
+        rt903x_stream_play_effect(&rt903_dev[0], index);
+    }
+}
+
 void smart_surface_switch_dispatch(){
     int i =0;
     for (;;) {
@@ -188,12 +266,14 @@ void smart_surface_switch_dispatch(){
                         case SMART_SURFACE_SWITCH1://切换效果
                             number++;
                             if(number >= EFFECT_NUMBER_MAX) number = 0;
-                            rt903x_stream_play_effect(RT903_INFO[0],number);//临时使用音效提醒切换成功
+                            rt903_feedback(number);//临时使用音效提醒切换成功
+                            rt903_arm_expected();
                             break;
                         case SMART_SURFACE_SWITCH2://切gain值
                             gain_value++;
                             if(gain_value >= gain_play_list_len) gain_value = 0;
-                            rt903x_stream_play_effect(RT903_INFO[0],gain_value);//临时使用音效提醒切换成功
+                            rt903_feedback(gain_value);//临时使用音效提醒切换成功
+                            rt903_arm_expected();
                             break;
                         case SMART_SURFACE_SWITCH3:
                         case SMART_SURFACE_SWITCH4:
@@ -240,6 +320,249 @@ void cust_gpio_isr_handler(void* arg)
     }
 }
 
+//测量期间调度任务和后台 arm 任务都不能碰这些芯片，-1 表示有芯片的调度任务没能及时停下
+static int rt903_f0_hold(rt903x_dev_t *const *devs, uint8_t count, bool hold)
+{
+    int res = 0;
+    for(int i=0;i<count;i++){
+        rt903x_ram_arm_hold(devs[i], hold);
+        if(rt903x_sched_hold(devs[i], hold) < 0) res = -1;
+    }
+    return res;
+}
+
+static void rt903_f0_done(const rt903x_f0_result_t *results, uint8_t count, void *arg)
+{
+    rt903x_dev_t *devs[RT903X_F0_MAX_CHIPS];
+    for(int i=0;i<count;i++){
+        printf("rt903 port %d addr 0x%02x: status %ld f0 %u Hz quality %u%% in %lu ms\n",
+               results[i].dev->info.i2c_master_num, results[i].dev->info.i2c_address,
+               (long)results[i].status, results[i].f0, results[i].quality, (unsigned long)results[i].elapsed_ms);
+        devs[i] = results[i].dev;
+    }
+    rt903_f0_hold(devs, count, false);
+    rt903_arm_expected();   //f0 波形覆盖了波形区，常驻效果和触发脚绑定重新准备
+}
+
+//f0 命令：所有在线的rt903同时测f0，两条总线并行，结果在回调里打印
+static int rt903_f0_cmd(int argc, char **argv)
+{
+    rt903x_dev_t *devs[RT903_CHIP_NUMBER_MAX];
+    uint8_t count = 0;
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i])){
+            devs[count++] = &rt903_dev[i];
+        }
+    }
+    if(count == 0){
+        printf("f0 measurement not started\n");
+        return 1;
+    }
+    //先停掉调度和后台准备，回调里再放开
+    if(rt903_f0_hold(devs, count, true) < 0){
+        rt903_f0_hold(devs, count, false);
+        printf("rt903 still playing, f0 measurement not started\n");
+        return 1;
+    }
+    if(rt903x_detect_f0_async(devs, count, 0, rt903_f0_done, NULL) < 0){
+        rt903_f0_hold(devs, count, false);
+        printf("f0 measurement not started\n");
+        return 1;
+    }
+    return 0;
+}
+
+static esp_err_t rt903_f0_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "f0",
+        .help = "Measure f0 of every online rt903 in parallel",
+        .hint = NULL,
+        .func = &rt903_f0_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+//rt903prot 命令：每颗芯片的保护事件计数，rt903prot reset 清零
+static int rt903_prot_cmd(int argc, char **argv)
+{
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(!is_rt903_online(RT903_INFO[i])) continue;
+        struct RT903X_PROT_STATS *prot = &rt903_dev[i].prot;
+        if(argc > 1 && strcmp(argv[1], "reset") == 0){
+            memset(prot, 0, sizeof(*prot));
+            continue;
+        }
+        rt903x_prot_gain(&rt903_dev[i], 0xFF);  //过了保持时间的增益上限先解除
+        printf("rt903[%d] events:%lu recovered:%lu retries:%lu gave_up:%lu last:0x%02x/0x%02x gain_cap:0x%02x\n", i,
+               (unsigned long)prot->events, (unsigned long)prot->recovered, (unsigned long)prot->retries,
+               (unsigned long)prot->gave_up, prot->status1, prot->status2, prot->gain_cap);
+    }
+    return 0;
+}
+
+static esp_err_t rt903_prot_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903prot",
+        .help = "rt903 protection event counters per chip, 'rt903prot reset' clears them",
+        .hint = NULL,
+        .func = &rt903_prot_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+//rt903sync 命令：所有在线芯片同时播当前效果组，打印最早和最晚一颗 GO 之间的偏差；rt903sync <次数> 统计最大偏差
+static int rt903_sync_cmd(int argc, char **argv)
+{
+    int rounds = (argc > 1) ? atoi(argv[1]) : 1;
+    if(rounds < 1) rounds = 1;
+    rt903x_dev_t *devs[RT903_CHIP_NUMBER_MAX];
+    uint8_t gain[RT903_CHIP_NUMBER_MAX];
+    uint8_t int_number[RT903_CHIP_NUMBER_MAX];
+    uint8_t count = 0;
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(!is_rt903_online(RT903_INFO[i]) || rt903_gpio_bound(i)) continue;
+        rt903x_sched_cancel(&rt903_dev[i]);    //调度任务别在中间插进来
+        devs[count] = &rt903_dev[i];
+        gain[count] = rt903_chip_gain(i);
+        int_number[count] = rt903_expected_int[i] ? rt903_expected_int[i] : INPUT_INT1;
+        count++;
+    }
+    if(count == 0){
+        printf("no rt903 to start\n");
+        return 1;
+    }
+    uint32_t skew_max = 0;
+    for(int r=0;r<rounds;r++){
+        uint32_t skew_us = 0;
+        int started = rt903x_Ram_sync_play(devs, count, gain, number % EFFECT_NUMBER_MAX, int_number, &skew_us);
+        if(started < 0){
+            printf("sync start failed\n");
+            return 1;
+        }
+        printf("round %d: %d/%d started, skew %lu us\n", r, started, count, (unsigned long)skew_us);
+        skew_max = (skew_us > skew_max) ? skew_us : skew_max;
+        vTaskDelay(pdMS_TO_TICKS(300));
+    }
+    printf("chips:%d rounds:%d skew max %lu us\n", count, rounds, (unsigned long)skew_max);
+    rt903_arm_expected();
+    return 0;
+}
+
+static esp_err_t rt903_sync_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903sync",
+        .help = "Start the current effect on every online rt903 at once and print the GO skew, 'rt903sync <rounds>'",
+        .hint = NULL,
+        .func = &rt903_sync_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+//rt903ram 命令：每颗芯片的 RAM 划分和常驻效果统计；rt903ram <chip> <fifo> [ae af] 重新划分，fifo 为字节数（可写 0x..）
+static int rt903_ram_cmd(int argc, char **argv)
+{
+    if(argc >= 3){
+        int chip = atoi(argv[1]);
+        if(chip < 0 || chip >= RT903_CHIP_NUMBER_MAX || !is_rt903_online(RT903_INFO[chip])){
+            printf("rt903[%d] not online\n", chip);
+            return 1;
+        }
+        uint16_t fifo = (uint16_t)strtoul(argv[2], NULL, 0);
+        uint16_t ae = (argc >= 5) ? (uint16_t)strtoul(argv[3], NULL, 0) : 0;
+        uint16_t af = (argc >= 5) ? (uint16_t)strtoul(argv[4], NULL, 0) : 0;
+        rt903x_sched_cancel(&rt903_dev[chip]);
+        if(rt903x_ram_partition(&rt903_dev[chip], fifo, ae, af) < 0){
+            printf("rt903[%d] fifo 0x%x not applied\n", chip, fifo);
+            return 1;
+        }
+        rt903_arm_expected();
+    }
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(!is_rt903_online(RT903_INFO[i])) continue;
+        struct RAM_PARAM *p = &rt903_dev[i].config.ram_param;
+        uint16_t wave_base = (p->WaveBaseAddrH << 8) | p->WaveBaseAddrL;
+        printf("rt903[%d] fifo:0x%03x refill:0x%03x ae:0x%03x af:0x%03x waves:0x%03x..0x%03x resident:%u hits:%lu uploads:%lu evictions:%lu\n", i,
+               rt903x_ram_fifo_size(&rt903_dev[i]), rt903x_ram_refill_size(&rt903_dev[i]),
+               (p->FifoAEH << 8) | p->FifoAEL, (p->FifoAFH << 8) | p->FifoAFL, wave_base, RT903X_RAM_SIZE,
+               rt903_dev[i].ram.cnt, (unsigned long)rt903_dev[i].ram.hits,
+               (unsigned long)rt903_dev[i].ram.uploads, (unsigned long)rt903_dev[i].ram.evictions);
+    }
+    return 0;
+}
+
+static esp_err_t rt903_ram_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903ram",
+        .help = "rt903 RAM partition per chip, 'rt903ram <chip> <fifo> [ae af]' moves the FIFO/waveform split",
+        .hint = NULL,
+        .func = &rt903_ram_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
+static void rt903_trim_verify_task(void *arg)
+{
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i])){
+            rt903x_trim_verify(&rt903_dev[i]);
+        }
+    }
+    vTaskDelete(NULL);
+}
+
+//rt903gpio 命令：把按键效果绑到芯片自己的触发脚上，按下时不经过MCU
+//rt903gpio <chip> <n1> <n2> <n3>，n 为 1..8 选 INPUT_INTn 的效果表，0 不用；rt903gpio <chip> off 解绑
+static int rt903_gpio_cmd(int argc, char **argv)
+{
+    static const uint8_t input_int[] = {0, INPUT_INT1, INPUT_INT2, INPUT_INT3, INPUT_INT4,
+                                        INPUT_INT5, INPUT_INT6, INPUT_INT7, INPUT_INT8};
+    if(argc < 3){
+        printf("usage: rt903gpio <chip> off | <n1> <n2> <n3>\n");
+        return 1;
+    }
+    int chip = atoi(argv[1]);
+    if(chip < 0 || chip >= RT903_CHIP_NUMBER_MAX || !is_rt903_online(RT903_INFO[chip])){
+        printf("rt903[%d] not online\n", chip);
+        return 1;
+    }
+    if(strcmp(argv[2], "off") == 0){
+        memset(rt903_gpio_bind_int[chip], 0, sizeof(rt903_gpio_bind_int[chip]));
+        if(rt903x_gpio_trig_unbind(&rt903_dev[chip]) < 0) return 1;
+        rt903_arm_expected();
+        return 0;
+    }
+    uint8_t bind_int[RT903X_GPIO_TRIG_NUM] = {0};
+    for(int n=0;n<RT903X_GPIO_TRIG_NUM && n+2<argc;n++){
+        int k = atoi(argv[n+2]);
+        if(k < 0 || k >= (int)(sizeof(input_int)/sizeof(input_int[0]))){
+            printf("effect table %d out of range\n", k);
+            return 1;
+        }
+        bind_int[n] = input_int[k];
+    }
+    if(rt903x_Ram_gpio_bind(&rt903_dev[chip], rt903_chip_gain(chip), number % EFFECT_NUMBER_MAX, bind_int) < 0){
+        printf("rt903[%d] gpio bind failed\n", chip);
+        return 1;
+    }
+    memcpy(rt903_gpio_bind_int[chip], bind_int, sizeof(bind_int));
+    return 0;
+}
+
+static esp_err_t rt903_gpio_register_cmd(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "rt903gpio",
+        .help = "Bind rt903 trigger inputs to RAM effects: rt903gpio <chip> off | <n1> <n2> <n3>",
+        .hint = NULL,
+        .func = &rt903_gpio_cmd,
+    };
+    return esp_console_cmd_register(&cmd);
+}
+
 //控制板载灯光
 void rgb_control(){
     //重新修改io为gpio7， 设置为输出模式
@@ -251,7 +574,7 @@ void app_main(void)
     vTaskDelay(pdMS_TO_TICKS(1000));
 #if 1
 //创建振动处理任务，在gpio触发时处理cust_gpio_isr_handler中发送的消息
-    gpio_int_evt_queue = xQueueCreate(10, sizeof(uint8_t));
+    gpio_int_evt_queue = xQueueCreate(32, sizeof(uint8_t));
     gpio_switch_evt_queue = xQueueCreate(10, sizeof(uint8_t));
     
 //注册中断服务函数，中断优先级1
@@ -273,22 +596,78 @@ void app_main(void)
     }
 
 
+//rt903 trim 缓存在 NVS，分区满或版本变化时擦掉重建
+    esp_err_t nvs_ret = nvs_flash_init();
+    if(nvs_ret == ESP_ERR_NVS_NO_FREE_PAGES || nvs_ret == ESP_ERR_NVS_NEW_VERSION_FOUND){
+        nvs_flash_erase();
+        nvs_flash_init();
+    }
+
 //i2c 初始化, 需要放到gpio操作之后，不然gpio的操作会影响i2c
     i2c_master_init(i2cConfig[0]);
     i2c_master_init(i2cConfig[1]);
+//每个i2c口一个独占任务，bus0 在core0, bus1 在core1，两条总线可以并行传输
+    i2c_executor_start(I2C_MASTER_NUM0, 0);
+    i2c_executor_start(I2C_MASTER_NUM1, 1);
 
 //rt903 初始化，四个IC全部初始化，如果未连接，设置为不在线 is_online=false
+//rt903 驱动通过 i2c_bus 接口访问总线，这里绑定 ESP 实现
+//每颗芯片一个任务同时初始化，两条总线并行；trim 从 NVS 缓存取，热启动不再走 efuse 读流程
+    rt903x_dev_t *init_devs[RT903_CHIP_NUMBER_MAX];
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        rt903x_dev_init(&rt903_dev[i], RT903_INFO[i], i2c_bus_esp_get(RT903_INFO[i].i2c_master_num));
+        init_devs[i] = &rt903_dev[i];
+    }
+    int64_t init_us = esp_timer_get_time();
+    rt903x_init_parallel(init_devs, RT903_CHIP_NUMBER_MAX);
+    printf("rt903 bring-up %lld us\n", (long long)(esp_timer_get_time() - init_us));
     for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
-        rt903x_soft_reset(RT903_INFO[i]);
-        int32_t ret = rt903x_init(RT903_INFO[i]);
-        if(ret >= 0){
-            RT903_INFO[i].is_online = true;
-        }else{
+        RT903_INFO[i].is_online = rt903_dev[i].info.is_online;
+        if(!RT903_INFO[i].is_online){
             printf("RT903_INFO[%d] is not online,set is_online=false!\n", i);
-            RT903_INFO[i].is_online = false;
         }
     }
 
+//每条总线上的rt903和ucs10100都通过读回校验后，切到能通过的最高时钟(最高1MHz)，出错时自动降速
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i])){
+            rt903x_speed_register(&rt903_dev[i]);
+        }
+    }
+    ussys_tp_speed_register(I2C_MASTER_NUM0);
+    ussys_tp_speed_register(I2C_MASTER_NUM1);
+    i2c_speed_negotiate(I2C_MASTER_NUM0);
+    i2c_speed_negotiate(I2C_MASTER_NUM1);
+
+//rt903 中断脚接到流播放 engine，FIFO_AE/PLAYDONE/PROTECTION 中断触发补数据，不再轮询 INT_STATUS
+    if(rt903x_stream_engine_init(RT903_INT_IO, 1) >= 0){
+        for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+            if(is_rt903_online(RT903_INFO[i])){
+                rt903x_stream_engine_add(&rt903_dev[i]);
+            }
+        }
+    }
+
+//按 rt903_fifo_size 给每颗芯片划分 RAM，默认划分的不用再写
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i]) && rt903_fifo_size[i] != RT903X_FIFO_SIZE_DEFAULT){
+            rt903x_ram_partition(&rt903_dev[i], rt903_fifo_size[i], 0, 0);
+        }
+    }
+
+//每颗芯片一个调度任务，跟它所在总线的 I2C 任务放在同一个核上
+    for(int i=0;i<RT903_CHIP_NUMBER_MAX; i++){
+        if(is_rt903_online(RT903_INFO[i])){
+            rt903x_sched_add(&rt903_dev[i], RT903_INFO[i].i2c_master_num);
+        }
+    }
+
+//每颗芯片先把默认效果放进RAM并设好模式和增益，第一次按键也只需要写 GO
+    rt903_arm_expected();
+
+//用了缓存 trim 的芯片在后台读一次 efuse 核对，换过芯片时改正
+    xTaskCreate(rt903_trim_verify_task, "rt903_trim_verify", 3072, NULL, 2, NULL);
+
 //创建子任务
     xTaskCreate(rt903_vibrate_task, "rt903_vibrate_task", 2048, NULL, 10, NULL);
     xTaskCreate(smart_surface_switch_dispatch, "smart_surface_switch_dispatch", 2048, NULL, 10, NULL);
@@ -310,6 +689,23 @@ void app_main(void)
     // xTaskCreate(aac_ledc_task, "aac_ledc_task", 2048, NULL, 10, NULL);
 	//filesystem_gpio_setup();
 
+//串口命令行，i2cstat 查看每条总线/每个器件的传输统计和总线占用率
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    if(esp_console_new_repl_uart(&uart_config, &repl_config, &repl) == ESP_OK){
+        esp_console_register_help_command();
+        i2c_stats_register_cmd();
+        rt903_f0_register_cmd();
+        rt903_gpio_register_cmd();
+        rt903_prot_register_cmd();
+        rt903_sync_register_cmd();
+        rt903_ram_register_cmd();
+        rt903x_stream_register_cmd();
+        rt903x_sched_register_cmd();
+        esp_console_start_repl(repl);
+    }
+
 //点亮板载灯
     rgb_control();
     while (true) {